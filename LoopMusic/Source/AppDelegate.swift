@@ -21,6 +21,7 @@ class AppDelegate: UIResponder, UIApplicationDelegate {
 
     /// Use this method to release shared resources, save user data, invalidate timers, and store enough application state information to restore your application to its current state in case it is terminated later. If your application supports background execution, this method is called instead of applicationWillTerminate: when the user quits.
     func applicationDidEnterBackground(_ application: UIApplication) {
+        MusicPlayer.player.updateBufferGeometry(background: true)
         if let window = self.window {
             if let viewController: LoopScrubberContainer = window.rootViewController as? LoopScrubberContainer {
                 viewController.getScrubber().unload()
@@ -30,6 +31,7 @@ class AppDelegate: UIResponder, UIApplicationDelegate {
 
     /// Called as part of the transition from the background to the active state; here you can undo many of the changes made on entering the background.
     func applicationWillEnterForeground(_ application: UIApplication) {
+        MusicPlayer.player.updateBufferGeometry(background: false)
         if let window = self.window {
             if let viewController: LoopScrubberContainer = window.rootViewController as? LoopScrubberContainer {
                 viewController.getScrubber().resume()
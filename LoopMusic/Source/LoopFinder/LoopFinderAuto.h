@@ -77,6 +77,10 @@ typedef enum loopModeValue { loopModeAuto, loopModeT1T2, loopModeT1Only, loopMod
 @property(nonatomic) bool useMonoAudio;
 /// Factor by which framerate is reduced for loop finding analysis.
 @property(nonatomic) int framerateReductionFactor;
+/// Filter applied when reducing the framerate.
+@property(nonatomic) DecimationFilter decimationFilter;
+/// Width of the FIR decimation filter's transition band, as a fraction of the effective framerate.
+@property(nonatomic) float decimationTransitionWidth;
 /// Actual framerate of the audio.
 @property(nonatomic) float framerate;
 /// Effective framerate within the loop finder, as a result of reducing the global FRAMERATE by some factor.
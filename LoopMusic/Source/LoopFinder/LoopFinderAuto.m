@@ -7,7 +7,7 @@
 
 @implementation LoopFinderAuto
 
-@synthesize nBestDurations, nBestPairs, leftIgnore, rightIgnore, sampleDiffTol, minLoopLength, minTimeDiff, fftLength, overlapPercent, t1Estimate, t2Estimate, tauRadius, t1Radius, t2Radius, tauPenalty, t1Penalty, t2Penalty, useFadeDetection, useMonoAudio, framerateReductionFactor, framerate, effectiveFramerate, lengthLimit, framerateReductionLimit, fftSetup, nSetup;
+@synthesize nBestDurations, nBestPairs, leftIgnore, rightIgnore, sampleDiffTol, minLoopLength, minTimeDiff, fftLength, overlapPercent, t1Estimate, t2Estimate, tauRadius, t1Radius, t2Radius, tauPenalty, t1Penalty, t2Penalty, useFadeDetection, useMonoAudio, framerateReductionFactor, decimationFilter, decimationTransitionWidth, framerate, effectiveFramerate, lengthLimit, framerateReductionLimit, fftSetup, nSetup;
 
 - (id)init
 {
@@ -53,6 +53,8 @@
     useFadeDetection = false;
     useMonoAudio = true;
     framerateReductionFactor = 6;
+    decimationFilter = DecimationFilterBoxcar;
+    decimationTransitionWidth = 0.25;
     
     lengthLimit = 1 << 22;   // Anything above this could lead to crashes under typical specs.
     framerateReductionLimit = 10; // Any lower and the typical human-audible frequencies will be unresolvable.
@@ -328,16 +330,28 @@
     self.framerateReductionFactor = calcFramerateReductionFactor(self.framerateReductionFactor, floatAudio->numFrames, framerateReductionLimit, lengthLimit);
     self.effectiveFramerate = (float)framerate / self.framerateReductionFactor;
     
-    // Convert audio to 32-bit floating point audio, with the necessary framerate reduction (also modifies floatAudio->numFrames)
+    // Convert audio to 32-bit floating point audio, with the necessary framerate reduction (also modifies floatAudio->numFrames). The mono signal is mixed in the same pass if needed.
     floatAudio->channel0 = malloc(floatAudio->numFrames/self.framerateReductionFactor * sizeof(float));  // Integer division will floor.
     floatAudio->channel1 = malloc(floatAudio->numFrames/self.framerateReductionFactor * sizeof(float));
-    audioFormatToFloatFormat(audio, floatAudio, self.framerateReductionFactor);
-    
-    if (self.useMonoAudio)
+    floatAudio->mono = self.useMonoAudio ? malloc(floatAudio->numFrames/self.framerateReductionFactor * sizeof(float)) : NULL;
+    Decimator *decimator = createDecimator(self.decimationFilter, self.framerateReductionFactor, self.decimationTransitionWidth);
+    if (!decimator)
     {
-        floatAudio->mono = malloc(floatAudio->numFrames * sizeof(float));
-        fillMonoSignalData(floatAudio);
+        NSLog(@"Failed to create decimator.");
+        free(floatAudio->mono); // This does nothing if passed a null pointer.
+        free(floatAudio->channel0);
+        free(floatAudio->channel1);
+        free(floatAudio);
+        // No loops found.
+        return @{@"baseDurations": @[],
+                 @"startFrames": @[],
+                 @"endFrames": @[],
+                 @"confidences": @[],
+                 @"sampleDifferences": @[]
+                 };
     }
+    audioFormatToFloatFormat(audio, floatAudio, decimator);
+    disposeDecimator(decimator);
     
     // Calculate average decibel level.
     avgVol = calcAvgVolume(floatAudio);
@@ -1,2 +1,6 @@
 #import "AudioEngine.h"
+#import "AudioEngineTesting.h"
+#import "AudioExport.h"
 #import "LoopFinderAuto.h"
+#import "DecodeProgress.h"
+#import "Resampler.h"
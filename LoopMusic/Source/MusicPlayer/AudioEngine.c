@@ -1,196 +1,1885 @@
 #include <stdio.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#import <Accelerate/Accelerate.h>
 #import "AudioEngine.h"
+#import "AudioEngineTesting.h"
+#import "../Utils/AudioUtils.h"
+#import "../Utils/Resampler.h"
 
-/// The number of buffers used in rotation during audio playback.
+/// The default number of buffers used in rotation during audio playback.
 #define NUM_BUFFERS 4
-/// The size of each buffer used in audio playback.
+/// The maximum number of buffers used in rotation during audio playback.
+#define MAX_BUFFERS 16
+/// The default size of each buffer used in audio playback, and the size of each block of audio rendered at once.
 #define BUFFER_SIZE 16384
+/// The number of consecutive callbacks well within their deadline before adaptive buffers shrink.
+#define ADAPTIVE_SHRINK_CALLBACKS 64
+/// The number of commands that can be waiting for the audio callback at once. Must be a power of 2.
+#define COMMAND_QUEUE_SIZE 256
+/// The number of notifications that can be waiting for the control thread at once. Must be a power of 2.
+#define NOTIFICATION_QUEUE_SIZE 64
+/// The number of scheduled events that can be pending at once.
+#define MAX_EVENTS 16
+/// The sample rate engines that play audio output at unless another is set.
+#define DEFAULT_OUTPUT_SAMPLE_RATE 44100
+/// The number of channels engines that play audio output unless another number is set.
+#define DEFAULT_OUTPUT_CHANNELS 2
+/// The most channels a track can have if it needs converting to the output format.
+#define MAX_CONVERTED_CHANNELS 8
+/// The number of frames of a track buffered while converting it to the output format.
+#define CONVERSION_BUFFER_FRAMES 4096
+/// The number of distinct sample-rate conversions an engine keeps filters for.
+#define MAX_RESAMPLE_FILTERS 16
+/// The number of position segments kept in the playback timeline. Enough to cover every frame queued for playback but not yet heard.
+#define TIMELINE_SEGMENTS 128
+/// The longest time to wait for the audio queue to return the buffers it flushed, in nanoseconds.
+#define FLUSH_TIMEOUT_NANOS 100000000
+/// The number of frames after a seek target or either side of a loop point that are decoded ahead of the rest of a track that's still decoding.
+#define PRIORITY_DECODE_FRAMES 131072
 
-/// The currently loaded audio data to be fed into the audio buffer every update.
-float *_Nonnull audioData;
-/// The index of the currently playing sample within the audio data.
-int64_t sampleCounter;
-/// The total number of samples in the audio data.
-int64_t numSamples;
-/// The audio sample to start the loop at.
-int64_t loopStart;
-/// The audio sample to end the loop at.
-int64_t loopEnd;
+/// Pre-rendered audio that replaces the end of the loop, crossfading from the audio just before the loop end into the audio just before the loop start.
+typedef struct SeamBuffer {
+    /// The number of frames in the seam.
+    int64_t numFrames;
+    /// Loop-points sequence of the command that replaced this seam. The seam can be freed once the audio callback has applied that command.
+    uint64_t retiredSequence;
+    /// Next seam waiting to be freed.
+    struct SeamBuffer *nextRetired;
+    /// Interleaved audio samples of the seam.
+    float data[];
+} SeamBuffer;
 
-/// The audio queue currently being used to play audio.
-AudioQueueRef queue;
-AudioStreamBasicDescription origAudioDesc;
-AudioQueueBufferRef buffers[NUM_BUFFERS];
+/// Audio data and loop metadata for one track, as seen by the audio callback.
+typedef struct TrackState {
+    /// The audio data to be fed into the audio buffer. NULL if there is no track.
+    const UInt8 *audioData;
+    /// The total number of samples in the audio data.
+    int64_t numSamples;
+    /// The format of the samples in the audio data. Samples are converted to floating point as they are rendered.
+    SampleFormat sampleFormat;
+    /// The size of each sample in the audio data in bytes.
+    UInt32 sampleSize;
+    /// The number of channels in the audio data.
+    UInt32 channels;
+    /// Filter converting the audio data's sample rate to the output sample rate. NULL if the rates match.
+    const ResampleFilter *resampleFilter;
+    /// Map of the parts of the audio data decoded so far. NULL if the audio data is fully decoded.
+    DecodeProgress *decodeProgress;
+    /// The index of the currently playing sample within the audio data.
+    int64_t sampleCounter;
+    /// The audio sample to start the loop at.
+    int64_t loopStart;
+    /// The audio sample to end the loop at.
+    int64_t loopEnd;
+    /// Crossfade played in place of the end of the loop. NULL if there is none.
+    const SeamBuffer *seam;
+    float volumeMultiplier;
+} TrackState;
 
-/// True if audio is currently playing.
-bool playing = false;
+/// Frames of a track rendered in its own format, waiting to be converted to the output format. Kept between blocks so the resampling filter runs continuously across them.
+typedef struct ConversionBuffer {
+    /// The position of the next output frame in the buffered frames, as 32.32 fixed point.
+    uint64_t position;
+    /// The number of frames buffered.
+    int64_t numFrames;
+    /// Interleaved samples of the buffered frames.
+    float data[CONVERSION_BUFFER_FRAMES * MAX_CONVERTED_CHANNELS];
+} ConversionBuffer;
 
-/// True if the audio is currently paused (but not stopped).
-bool paused = false;
+/// Ways of switching from the current track to the queued track.
+typedef enum HandoffMode {
+    /// No switch is pending.
+    HandoffNone,
+    /// Switch when playback next wraps, either at the loop end or at the end of the audio data.
+    HandoffAtLoopWrap,
+    /// Crossfade into the queued track, then switch.
+    HandoffCrossfade
+} HandoffMode;
 
-/// Sample counter at the time of an active pause. Will be -1 if inapplicable.
-int64_t sampleCounterOnPause;
+/// Types of parameter changes sent from the control thread to the audio callback. Commands of different types are sent in this order when retried.
+typedef enum EngineCommandType {
+    CommandSetAudio,
+    CommandSetDecodeProgress,
+    CommandSetSampleCounter,
+    CommandSetLoopPoints,
+    CommandSetVolumeMultiplier,
+    CommandRampGain,
+    CommandSetLoopPlayback,
+    CommandQueueAudio,
+    CommandStartHandoff,
+    CommandCancelEvents,
+    CommandScheduleEvent,
+    /// The number of command types. Not a valid command.
+    NUM_COMMAND_TYPES
+} EngineCommandType;
 
-/// True if loop times are used to loop playback.
-bool loopPlayback = true;
+/// A parameter change to be applied by the audio callback at the start of the next buffer.
+typedef struct EngineCommand {
+    EngineCommandType type;
+    union {
+        /// Audio data for the current track.
+        TrackState audio;
+        DecodeProgress *decodeProgress;
+        struct {
+            TrackState track;
+            /// Identifies the queued track so the control thread knows when the previously queued seam is no longer in use.
+            uint64_t loopPointsSequence;
+        } queuedTrack;
+        struct {
+            int64_t sampleCounter;
+            /// Identifies the seek so the control thread knows when it has been applied.
+            uint64_t seekSequence;
+        } seek;
+        struct {
+            int64_t loopStart;
+            int64_t loopEnd;
+            /// Crossfade played in place of the end of the loop. NULL if there is none.
+            SeamBuffer *seam;
+            /// Identifies the loop points so the control thread knows when the previous seam is no longer in use.
+            uint64_t loopPointsSequence;
+        } loopPoints;
+        double volumeMultiplier;
+        struct {
+            float targetGain;
+            /// The number of frames to ramp over. 0 sets the gain immediately.
+            int64_t numFrames;
+        } gainRamp;
+        bool loopPlayback;
+        struct {
+            HandoffMode mode;
+            /// The number of frames to crossfade over in HandoffCrossfade mode.
+            int64_t crossfadeFrames;
+        } handoff;
+        EngineEvent event;
+    };
+} EngineCommand;
 
-double volumeMultiplier;
+/// Wait-free single-producer, single-consumer ring of commands. The control thread is the only producer, and the audio callback is the only consumer.
+typedef struct CommandQueue {
+    EngineCommand commands[COMMAND_QUEUE_SIZE];
+    /// Index of the next command to be read. Only written by the consumer.
+    _Atomic uint32_t head;
+    /// Index of the next command to be written. Only written by the producer.
+    _Atomic uint32_t tail;
+    /// Set by the producer when a command doesn't fit, and cleared by the consumer once it has drained the queue.
+    _Atomic bool overflowed;
+} CommandQueue;
+
+/// Wait-free single-producer, single-consumer ring of notifications. The audio callback is the only producer, and the control thread is the only consumer.
+typedef struct NotificationQueue {
+    EngineNotification notifications[NOTIFICATION_QUEUE_SIZE];
+    /// Index of the next notification to be read. Only written by the consumer.
+    _Atomic uint32_t head;
+    /// Index of the next notification to be written. Only written by the producer.
+    _Atomic uint32_t tail;
+    /// Set by the producer when a notification is dropped, and cleared by the consumer once it has checked for dropped notifications.
+    _Atomic bool overflowed;
+} NotificationQueue;
+
+/// Playback parameters owned by the audio callback. Only read or written while rendering audio.
+typedef struct RenderState {
+    /// The track currently playing.
+    TrackState track;
+    /// The track to switch to when a handoff happens. Its audio data is NULL if no track is queued.
+    TrackState queuedTrack;
+    /// Conversion buffers of the current and queued tracks. Swapped when switching tracks.
+    ConversionBuffer *trackConversion;
+    ConversionBuffer *queuedConversion;
+    /// True if loop times are used to loop playback.
+    bool loopPlayback;
+    /// How the engine is switching to the queued track, if at all.
+    HandoffMode handoffMode;
+    /// The total length of the handoff crossfade in frames.
+    int64_t crossfadeFrames;
+    /// The number of frames left in the handoff crossfade.
+    int64_t crossfadeFramesRemaining;
+    /// Gain applied to all rendered audio on top of the volume multiplier. Used for fades.
+    float gain;
+    /// The gain being ramped towards.
+    float targetGain;
+    /// Change in gain per frame while ramping.
+    float gainStep;
+    /// The number of frames left in the gain ramp. 0 if the gain isn't ramping.
+    int64_t gainRampFramesRemaining;
+    /// Events waiting to fire, in the order they were scheduled.
+    EngineEvent events[MAX_EVENTS];
+    uint32_t numEvents;
+    /// The number of frames rendered since the engine was created.
+    int64_t renderedFrames;
+    /// The number of silent frames rendered while holding for audio to decode.
+    int64_t heldFrames;
+    /// The number of times playback of the current track has wrapped.
+    int64_t loopWraps;
+    /// True if notifications have been posted since the notification callback was last called.
+    bool notificationsPosted;
+} RenderState;
+
+/// Playback parameters as most recently requested by the control thread. Only read or written by the control thread.
+typedef struct ControlState {
+    /// Audio data of the current track. The sample counter, loop points and seam are unused.
+    TrackState track;
+    /// Audio data, loop points and seam of the queued track. Its audio data is NULL if no track is queued.
+    TrackState queuedTrack;
+    /// How the queued track should replace the current track.
+    HandoffMode handoffMode;
+    /// The number of frames to crossfade over when handing off to the queued track.
+    int64_t handoffCrossfadeFrames;
+    int64_t sampleCounter;
+    int64_t loopStart;
+    int64_t loopEnd;
+    bool loopPlayback;
+    double volumeMultiplier;
+    /// The gain most recently ramped towards.
+    float targetGain;
+    /// The number of frames of the most recent gain ramp.
+    int64_t gainRampFrames;
+    /// The number of frames to crossfade over at the loop seam. 0 if loops are played without a crossfade.
+    int64_t loopCrossfadeFrames;
+    /// Crossfade for the current loop points. NULL if there is none.
+    SeamBuffer *seam;
+    /// Seams that have been replaced but may still be in use by the audio callback.
+    SeamBuffer *retiredSeams;
+    /// Incremented every time the sample counter is set.
+    uint64_t seekSequence;
+    /// Incremented every time the loop points are set.
+    uint64_t loopPointsSequence;
+    /// The number of handoffs finished on the control thread.
+    uint64_t handoffCount;
+    /// Scheduled events that couldn't fit in the command queue and still need to be sent, in order.
+    EngineEvent unsentEvents[MAX_EVENTS];
+    uint32_t numUnsentEvents;
+    /// Bitmask of command types that couldn't fit in the command queue and still need to be sent.
+    uint32_t unsentCommands;
+    /// Callback timing counters at the last reset. Counters are reset by subtracting these, so the audio callback never has its counters overwritten.
+    RenderTelemetry telemetryBaseline;
+} ControlState;
+
+/// Snapshot of render state published by the audio callback after every buffer, for lock-free reading from the control thread.
+typedef struct StateSnapshot {
+    /// The index of the next frame to be rendered within the audio data of the current track.
+    _Atomic int64_t sampleCounter;
+    /// The most recent seek sequence applied by the audio callback.
+    _Atomic uint64_t seekSequence;
+    /// The most recent loop-points sequence applied by the audio callback.
+    _Atomic uint64_t loopPointsSequence;
+    /// The number of times the audio callback has switched to a queued track.
+    _Atomic uint64_t handoffCount;
+    /// The number of frames rendered since the engine was created.
+    _Atomic int64_t renderedFrames;
+    /// The number of silent frames rendered while holding for audio to decode.
+    _Atomic int64_t heldFrames;
+    /// The number of times playback of the current track has wrapped.
+    _Atomic int64_t loopWraps;
+} StateSnapshot;
+
+/// Maps a run of rendered frames to positions within the track they were rendered from.
+typedef struct PositionSegment {
+    /// The rendered frame the segment starts at.
+    int64_t renderedFrame;
+    /// The frame of the track heard at the start of the segment.
+    int64_t trackFrame;
+    /// The frame where playback of the track wraps, and the frame it wraps to.
+    int64_t endFrame;
+    int64_t wrapFrame;
+    /// Track frames per rendered frame, as 32.32 fixed point.
+    uint64_t step;
+} PositionSegment;
+
+/// Timeline of rendered audio, for mapping the frame being heard back to a track position. Guarded by a sequence lock, so readers never block the writer: the sequence is odd while a write is in progress, and readers retry if it changed while they read. Written by the audio callback, or by the control thread while the audio callback isn't running.
+typedef struct PlaybackTimeline {
+    _Atomic uint32_t sequence;
+    /// Ring of the most recent segments, oldest first from numSegments.
+    PositionSegment segments[TIMELINE_SEGMENTS];
+    /// The total number of segments written.
+    uint64_t numSegments;
+    /// A rendered frame known to be heard at anchorNanos.
+    int64_t anchorFrame;
+    uint64_t anchorNanos;
+} PlaybackTimeline;
+
+/// Timing statistics collected by the audio callback. Each counter is only incremented by the audio callback, so it can be read without locking.
+typedef struct CallbackTimings {
+    _Atomic uint64_t histogram[RENDER_TIMING_BUCKETS];
+    _Atomic uint64_t numCallbacks;
+    _Atomic uint64_t numLateCallbacks;
+    _Atomic uint64_t numUnderruns;
+    _Atomic uint64_t totalNanos;
+    /// Reset to 0 by the control thread.
+    _Atomic uint64_t maxNanos;
+    /// Time the audio callback last enqueued a buffer. 0 if the next callback shouldn't be checked for an underrun, such as after playback starts.
+    uint64_t lastEnqueueNanos;
+} CallbackTimings;
+
+/// Who renders an audio queue buffer next, while buffers are flushed and re-rendered. Changed with compare-and-swap, so a flushed buffer is rendered by exactly one of the control thread and the audio callback.
+typedef enum BufferState {
+    /// The audio callback renders the buffer when the audio queue returns it.
+    BufferQueued,
+    /// The buffer is being flushed. If the audio queue returns it, the audio callback hands it to the control thread rather than rendering it.
+    BufferFlushing,
+    /// The audio queue has returned the flushed buffer, and the control thread renders it.
+    BufferFlushed
+} BufferState;
+
+/// State of one playback engine. Each engine owns its audio queue, so several can play or render at once.
+struct AudioEngine {
+    /// Commands waiting to be applied by the audio callback.
+    CommandQueue commandQueue;
+    /// Notifications waiting to be read by the control thread.
+    NotificationQueue notificationQueue;
+    /// Playback parameters used by the audio callback.
+    RenderState renderState;
+    /// Playback parameters requested by the control thread.
+    ControlState controlState;
+    /// Render state readable from the control thread.
+    StateSnapshot stateSnapshot;
+    /// Timing statistics of the audio callback.
+    CallbackTimings timings;
+    /// Positions of rendered audio, for finding the position being heard.
+    PlaybackTimeline timeline;
+
+    /// Scratch buffer used to render the queued track while crossfading into it.
+    float crossfadeBuffer[BUFFER_SIZE / sizeof(float)];
+    /// Backing storage for the conversion buffers in the render state.
+    ConversionBuffer conversionBuffers[2];
+    /// Filters for every sample-rate conversion used so far. Kept for the life of the engine, so the audio callback can never be left using a freed filter.
+    ResampleFilter *resampleFilters[MAX_RESAMPLE_FILTERS];
+    UInt32 numResampleFilters;
+
+    /// Called by the audio callback after it posts notifications.
+    NotificationCallback notificationCallback;
+    /// Passed to notificationCallback.
+    void *notificationUserData;
+
+    /// True if the engine plays audio through an audio queue. If false, audio is only rendered by calling audioCallback directly.
+    bool playsAudio;
+    /// The audio queue used to play audio. Created when audio is first loaded, and only recreated if the output format changes.
+    AudioQueueRef queue;
+    /// The 32-bit float format audio is rendered in and the audio queue plays. Tracks in other formats are converted to it.
+    AudioStreamBasicDescription outputDesc;
+    /// Output format requested with setOutputFormat. 0 uses the default.
+    Float64 requestedOutputSampleRate;
+    UInt32 requestedOutputChannels;
+    AudioQueueBufferRef buffers[MAX_BUFFERS];
+    /// Buffer geometry requested with setBufferGeometry. 0 uses the default.
+    UInt32 requestedNumBuffers;
+    UInt32 requestedMinBufferFrames;
+    UInt32 requestedMaxBufferFrames;
+    /// The number of audio queue buffers in use.
+    UInt32 numBuffers;
+    /// The number of frames each audio queue buffer can hold.
+    UInt32 bufferCapacityFrames;
+    /// Range of frames rendered into each buffer. Equal if buffers don't adapt.
+    _Atomic UInt32 minBufferFrames;
+    _Atomic UInt32 maxBufferFrames;
+    /// The number of frames currently rendered into each buffer. Only written by the audio callback once playing.
+    _Atomic UInt32 bufferFrames;
+    /// The number of consecutive callbacks well within their deadline. Only used by the audio callback.
+    UInt32 calmCallbacks;
+    /// The rendered frame at the end of each audio queue buffer, so the frame being heard is known when the queue returns it.
+    int64_t bufferEndFrames[MAX_BUFFERS];
+    /// The seek sequence each audio queue buffer was rendered after, so buffers queued before a later seek can be found.
+    _Atomic uint64_t bufferSeekSequences[MAX_BUFFERS];
+    /// Who renders each audio queue buffer next. A BufferState.
+    _Atomic int bufferStates[MAX_BUFFERS];
+    /// True while buffers are rendered ahead of starting the audio queue, rather than returned by it after playing.
+    _Atomic bool primingBuffers;
+
+    /// True if audio is currently playing.
+    bool playing;
+    /// True if the audio is currently paused (but not stopped).
+    bool paused;
+};
+
+/// Engine used by the functions that don't take an engine.
+static AudioEngine defaultEngine = {
+    .renderState = { .loopPlayback = true, .gain = 1, .targetGain = 1, .trackConversion = &defaultEngine.conversionBuffers[0], .queuedConversion = &defaultEngine.conversionBuffers[1] },
+    .controlState = { .loopPlayback = true, .targetGain = 1 },
+    .playsAudio = true
+};
 
 bool areAudioDescsEqual(AudioStreamBasicDescription desc1, AudioStreamBasicDescription desc2);
 
-/// Used to load audio buffer data from any type of stored audio.
-#define loadBuffer(castedBufferData, castedAudioData) \
-for (unsigned int i = 0; i < BUFFER_SIZE / sizeof(castedAudioData[0]); i++) { \
-    if (sampleCounter >= numSamples) { \
-        castedBufferData[i] = 0; \
-    } else { \
-        castedBufferData[i] = castedAudioData[sampleCounter++] * volumeMultiplier; \
-    } \
-    if ((loopEnd > 0 && sampleCounter >= loopEnd && loopPlayback) || sampleCounter >= numSamples) { \
-        sampleCounter = loopPlayback ? loopStart : 0; \
-    } \
-} \
-
-/// Callback to load audio buffers with audio samples.
-void audioCallback(void *customData, AudioQueueRef queue, AudioQueueBufferRef buffer) {
-    float* bufferData = (float*) buffer->mAudioData;
+/// Adds a command to the command queue without blocking. Returns false if the queue is full.
+static bool pushCommand(AudioEngine *engine, const EngineCommand *command) {
+    const uint32_t tail = atomic_load_explicit(&engine->commandQueue.tail, memory_order_relaxed);
+    const uint32_t head = atomic_load_explicit(&engine->commandQueue.head, memory_order_acquire);
+    if (tail - head >= COMMAND_QUEUE_SIZE) {
+        atomic_store_explicit(&engine->commandQueue.overflowed, true, memory_order_relaxed);
+        return false;
+    }
+    engine->commandQueue.commands[tail & (COMMAND_QUEUE_SIZE - 1)] = *command;
+    atomic_store_explicit(&engine->commandQueue.tail, tail + 1, memory_order_release);
+    return true;
+}
+
+/// Removes the oldest command from the command queue without blocking. Returns false if the queue is empty.
+static bool popCommand(AudioEngine *engine, EngineCommand *command) {
+    const uint32_t head = atomic_load_explicit(&engine->commandQueue.head, memory_order_relaxed);
+    const uint32_t tail = atomic_load_explicit(&engine->commandQueue.tail, memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+    *command = engine->commandQueue.commands[head & (COMMAND_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&engine->commandQueue.head, head + 1, memory_order_release);
+    return true;
+}
+
+/// Builds a command carrying the control thread's current value for the given parameter.
+static EngineCommand makeCommand(AudioEngine *engine, EngineCommandType type) {
+    EngineCommand command = { .type = type };
+    switch (type) {
+        case CommandSetAudio:
+            command.audio = engine->controlState.track;
+            break;
+        case CommandSetDecodeProgress:
+            command.decodeProgress = engine->controlState.track.decodeProgress;
+            break;
+        case CommandQueueAudio:
+            command.queuedTrack.track = engine->controlState.queuedTrack;
+            command.queuedTrack.track.volumeMultiplier = (float) engine->controlState.volumeMultiplier;
+            command.queuedTrack.loopPointsSequence = engine->controlState.loopPointsSequence;
+            break;
+        case CommandStartHandoff:
+            command.handoff.mode = engine->controlState.handoffMode;
+            command.handoff.crossfadeFrames = engine->controlState.handoffCrossfadeFrames;
+            break;
+        case CommandSetSampleCounter:
+            command.seek.sampleCounter = engine->controlState.sampleCounter;
+            command.seek.seekSequence = engine->controlState.seekSequence;
+            break;
+        case CommandSetLoopPoints:
+            command.loopPoints.loopStart = engine->controlState.loopStart;
+            command.loopPoints.loopEnd = engine->controlState.loopEnd;
+            command.loopPoints.seam = engine->controlState.seam;
+            command.loopPoints.loopPointsSequence = engine->controlState.loopPointsSequence;
+            break;
+        case CommandSetVolumeMultiplier:
+            command.volumeMultiplier = engine->controlState.volumeMultiplier;
+            break;
+        case CommandRampGain:
+            command.gainRamp.targetGain = engine->controlState.targetGain;
+            command.gainRamp.numFrames = engine->controlState.gainRampFrames;
+            break;
+        case CommandSetLoopPlayback:
+            command.loopPlayback = engine->controlState.loopPlayback;
+            break;
+        default:
+            break;
+    }
+    return command;
+}
+
+/// Starts ramping the gain from its current value. Called by the audio callback.
+static void startGainRamp(AudioEngine *engine, float targetGain, int64_t numFrames) {
+    // Ramps start from the current gain, even if a previous ramp was cut short.
+    engine->renderState.targetGain = targetGain;
+    engine->renderState.gainRampFramesRemaining = numFrames > 0 ? numFrames : 0;
+    if (numFrames > 0) {
+        engine->renderState.gainStep = (targetGain - engine->renderState.gain) / (float) numFrames;
+    } else {
+        engine->renderState.gain = targetGain;
+    }
+}
+
+/// Starts handing off to the queued track, if there is one. Called by the audio callback.
+static void startQueuedHandoff(AudioEngine *engine, int64_t crossfadeFrames) {
+    if (engine->renderState.queuedTrack.audioData != NULL) {
+        engine->renderState.handoffMode = crossfadeFrames > 0 ? HandoffCrossfade : HandoffAtLoopWrap;
+        engine->renderState.crossfadeFrames = crossfadeFrames;
+        engine->renderState.crossfadeFramesRemaining = crossfadeFrames;
+    }
+}
+
+/// Empties a conversion buffer for a track starting from a new position. The filter's history starts as silence, so the first output frame lines up with the track's first frame.
+static void resetConversion(ConversionBuffer *conversion) {
+    conversion->position = 0;
+    conversion->numFrames = RESAMPLER_TAPS / 2 - 1;
+    memset(conversion->data, 0, conversion->numFrames * MAX_CONVERTED_CHANNELS * sizeof(float));
+}
+
+/// Applies all pending commands to the render state. Called by the audio callback at the start of each buffer, so every change takes effect on a buffer boundary, or by the control thread while the audio callback can't be running.
+static void applyCommands(AudioEngine *engine) {
+    EngineCommand command;
+    while (popCommand(engine, &command)) {
+        switch (command.type) {
+            case CommandSetAudio:
+                engine->renderState.track.audioData = command.audio.audioData;
+                engine->renderState.track.numSamples = command.audio.numSamples;
+                engine->renderState.track.sampleFormat = command.audio.sampleFormat;
+                engine->renderState.track.sampleSize = command.audio.sampleSize;
+                engine->renderState.track.channels = command.audio.channels;
+                engine->renderState.track.resampleFilter = command.audio.resampleFilter;
+                engine->renderState.track.decodeProgress = command.audio.decodeProgress;
+                resetConversion(engine->renderState.trackConversion);
+                // Loading new audio cancels any queued track.
+                engine->renderState.queuedTrack.audioData = NULL;
+                engine->renderState.handoffMode = HandoffNone;
+                engine->renderState.loopWraps = 0;
+                break;
+            case CommandSetDecodeProgress:
+                engine->renderState.track.decodeProgress = command.decodeProgress;
+                break;
+            case CommandQueueAudio:
+                engine->renderState.queuedTrack = command.queuedTrack.track;
+                resetConversion(engine->renderState.queuedConversion);
+                if (command.queuedTrack.track.audioData == NULL) {
+                    engine->renderState.handoffMode = HandoffNone;
+                }
+                atomic_store_explicit(&engine->stateSnapshot.loopPointsSequence, command.queuedTrack.loopPointsSequence, memory_order_release);
+                break;
+            case CommandStartHandoff:
+                startQueuedHandoff(engine, command.handoff.mode == HandoffCrossfade ? command.handoff.crossfadeFrames : 0);
+                break;
+            case CommandCancelEvents:
+                engine->renderState.numEvents = 0;
+                break;
+            case CommandScheduleEvent:
+                if (engine->renderState.numEvents < MAX_EVENTS) {
+                    engine->renderState.events[engine->renderState.numEvents++] = command.event;
+                }
+                break;
+            case CommandSetSampleCounter:
+                engine->renderState.track.sampleCounter = command.seek.sampleCounter;
+                resetConversion(engine->renderState.trackConversion);
+                // Publish the new position along with the seek, since nothing may be rendered from it for a while if playback is stopped.
+                if (engine->renderState.track.channels > 0) {
+                    atomic_store_explicit(&engine->stateSnapshot.sampleCounter, engine->renderState.track.sampleCounter / engine->renderState.track.channels, memory_order_release);
+                }
+                atomic_store_explicit(&engine->stateSnapshot.seekSequence, command.seek.seekSequence, memory_order_release);
+                break;
+            case CommandSetLoopPoints:
+                engine->renderState.track.loopStart = command.loopPoints.loopStart;
+                engine->renderState.track.loopEnd = command.loopPoints.loopEnd;
+                engine->renderState.track.seam = command.loopPoints.seam;
+                atomic_store_explicit(&engine->stateSnapshot.loopPointsSequence, command.loopPoints.loopPointsSequence, memory_order_release);
+                break;
+            case CommandSetVolumeMultiplier:
+                engine->renderState.track.volumeMultiplier = (float) command.volumeMultiplier;
+                break;
+            case CommandRampGain:
+                startGainRamp(engine, command.gainRamp.targetGain, command.gainRamp.numFrames);
+                break;
+            case CommandSetLoopPlayback:
+                engine->renderState.loopPlayback = command.loopPlayback;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/// Sends scheduled events to the audio callback in order. Unlike parameters, every event is delivered, not just the latest. Returns false if some events didn't fit in the command queue.
+static bool sendScheduledEvents(AudioEngine *engine) {
+    uint32_t numSent = 0;
+    while (numSent < engine->controlState.numUnsentEvents) {
+        const EngineCommand command = { .type = CommandScheduleEvent, .event = engine->controlState.unsentEvents[numSent] };
+        if (!pushCommand(engine, &command)) {
+            break;
+        }
+        numSent++;
+    }
+    engine->controlState.numUnsentEvents -= numSent;
+    memmove(engine->controlState.unsentEvents, engine->controlState.unsentEvents + numSent, engine->controlState.numUnsentEvents * sizeof(EngineEvent));
+    return engine->controlState.numUnsentEvents == 0;
+}
+
+/// Pushes all parameters changed on the control thread to the command queue. If the command queue is full, the parameters stay marked as unsent and are retried once the audio callback has drained the queue, or on the next change, so only the latest value of each parameter is ever delivered late. Returns false if some parameters didn't fit.
+static bool pushUnsentCommands(AudioEngine *engine) {
+    for (unsigned int type = 0; type < NUM_COMMAND_TYPES; type++) {
+        if (engine->controlState.unsentCommands & (1u << type)) {
+            if (type == CommandScheduleEvent) {
+                if (!sendScheduledEvents(engine)) {
+                    return false;
+                }
+            } else {
+                const EngineCommand command = makeCommand(engine, type);
+                if (!pushCommand(engine, &command)) {
+                    return false;
+                }
+            }
+            engine->controlState.unsentCommands &= ~(1u << type);
+        }
+    }
+    return true;
+}
+
+/// Sends all parameters changed on the control thread to the audio callback. Only a running audio callback drains the command queue, so commands don't pile up in it otherwise: while stopped, the audio callback can't be running, so commands are applied right away on the control thread. Engines that don't play audio render on the control thread, so they're treated as stopped. While paused, commands are held back until playback resumes, keeping only the latest value of each parameter.
+static void sendCommands(AudioEngine *engine) {
+    if (engine->paused) {
+        return;
+    }
+    if (!engine->playing) {
+        // Apply anything left over from before playback stopped first, so commands keep their order.
+        applyCommands(engine);
+        while (!pushUnsentCommands(engine)) {
+            applyCommands(engine);
+        }
+        applyCommands(engine);
+        // Everything was delivered, so there's nothing for the audio callback to ask to be retried.
+        atomic_store_explicit(&engine->commandQueue.overflowed, false, memory_order_relaxed);
+        return;
+    }
+    pushUnsentCommands(engine);
+}
+
+/// Marks a parameter as changed on the control thread and sends it to the audio callback.
+static void sendCommand(AudioEngine *engine, EngineCommandType type) {
+    engine->controlState.unsentCommands |= 1u << type;
+    sendCommands(engine);
+}
+
+/// Gets the frame at which playback of a track wraps: the loop end, or the end of the audio data.
+static inline int64_t wrapPointFrame(const AudioEngine *engine, const TrackState *_Nonnull track, const int64_t channels) {
+    const int64_t numSamples = track->audioData != NULL ? track->numSamples : 0;
+    // Loop points are stored in samples, but are always aligned to whole frames.
+    return (engine->renderState.loopPlayback && track->loopEnd > 0 && track->loopEnd < numSamples ? track->loopEnd : numSamples) / channels;
+}
 
-    for (unsigned int i = 0; i < BUFFER_SIZE / sizeof(audioData[0]); i++) {
-        if (sampleCounter >= numSamples) {
-            bufferData[i] = 0;
+/// Renders frames of a track as a series of contiguous spans, each running from the current position up to the next wrap point (the loop end or the end of the audio data). Each span is copied with a vectorized gain multiply, so the loop conditions are checked once per span rather than once per sample. Inlined into renderTrackFrames so the channel count is a constant for common layouts. If stopAtWrap is true, rendering stops where playback would wrap, and the number of frames rendered is returned.
+static inline __attribute__((always_inline)) int64_t renderSpans(AudioEngine *engine, TrackState *_Nonnull track, float *_Nonnull outData, const int64_t numFrames, const int64_t channels, const bool stopAtWrap) {
+    const UInt8 *audioData = track->audioData;
+    // A constant gain is folded into the span copies. A ramping gain is applied to the whole block afterwards.
+    const float volumeMultiplier = engine->renderState.gainRampFramesRemaining > 0 ? track->volumeMultiplier : track->volumeMultiplier * engine->renderState.gain;
+    const int64_t endFrame = wrapPointFrame(engine, track, channels);
+    int64_t wrapFrame = engine->renderState.loopPlayback ? track->loopStart / channels : 0;
+    if (wrapFrame >= endFrame) {
+        wrapFrame = 0;
+    }
+    // The seam only applies when playback wraps at the loop end it was rendered for, and not when handing off to another track there.
+    const SeamBuffer *seam = !stopAtWrap && engine->renderState.loopPlayback && endFrame == track->loopEnd / channels ? track->seam : NULL;
+    const int64_t seamStartFrame = seam != NULL ? endFrame - seam->numFrames : endFrame;
+
+    int64_t frame = track->sampleCounter / channels;
+    int64_t framesLeft = numFrames;
+    while (framesLeft > 0) {
+        if (frame >= endFrame) {
+            if (stopAtWrap) {
+                break;
+            }
+            frame = wrapFrame;
+            if (frame >= endFrame) {
+                // No audio to play.
+                vDSP_vclr(outData, 1, framesLeft * channels);
+                framesLeft = 0;
+                break;
+            }
+            if (track == &engine->renderState.track) {
+                engine->renderState.loopWraps++;
+            }
+        }
+        // Play from the seam in place of the audio data once within it.
+        const int64_t spanEndFrame = frame >= seamStartFrame ? endFrame : seamStartFrame;
+        const int64_t spanFrames = spanEndFrame - frame < framesLeft ? spanEndFrame - frame : framesLeft;
+        if (frame >= seamStartFrame) {
+            vDSP_vsmul(seam->data + (frame - seamStartFrame) * channels, 1, &volumeMultiplier, outData, 1, spanFrames * channels);
         } else {
-            bufferData[i] = audioData[sampleCounter++] * volumeMultiplier;
+            convertSamplesToFloat(audioData + frame * channels * track->sampleSize, 1, track->sampleFormat, volumeMultiplier, outData, 1, spanFrames * channels);
         }
-        if ((loopEnd > 0 && sampleCounter >= loopEnd && loopPlayback) || sampleCounter >= numSamples) {
-            sampleCounter = loopPlayback ? loopStart : 0;
+        outData += spanFrames * channels;
+        frame += spanFrames;
+        framesLeft -= spanFrames;
+    }
+    if (frame >= endFrame && !stopAtWrap) {
+        frame = wrapFrame;
+        if (track == &engine->renderState.track) {
+            engine->renderState.loopWraps++;
         }
     }
-    
-    AudioQueueEnqueueBuffer(queue, buffer, 0, NULL);
+    track->sampleCounter = frame * channels;
+    return numFrames - framesLeft;
 }
 
-/// Loads audio data into the engine in preparation for audio playback.
-OSStatus loadAudio(void *_Nonnull newAudioData, int64_t newNumSamples, const AudioStreamBasicDescription audioDesc) {
-    if (areAudioDescsEqual(audioDesc, origAudioDesc)) {
-        // If audio format is the same, no need to recreate the audio queue.
-        audioData = newAudioData;
-        numSamples = newNumSamples;
-        return 0;
+/// Renders frames of a track in its own sample rate and channel count. If stopAtWrap is true, rendering stops where playback would wrap. Returns the number of frames rendered.
+static int64_t renderTrackFrames(AudioEngine *engine, TrackState *_Nonnull track, float *_Nonnull outData, int64_t numFrames, bool stopAtWrap) {
+    switch (track->channels) {
+        case 1:
+            return renderSpans(engine, track, outData, numFrames, 1, stopAtWrap);
+        case 2:
+            return renderSpans(engine, track, outData, numFrames, 2, stopAtWrap);
+        default:
+            return renderSpans(engine, track, outData, numFrames, track->channels, stopAtWrap);
+    }
+}
+
+/// Copies frames between channel layouts. Output channels beyond the input's channels repeat the last input channel, and extra input channels are dropped, matching the resampler.
+static void mapChannels(const float *_Nonnull inData, UInt32 inChannels, float *_Nonnull outData, UInt32 outChannels, int64_t numFrames) {
+    const float unity = 1;
+    for (UInt32 c = 0; c < outChannels; c++) {
+        const UInt32 inChannel = c < inChannels ? c : inChannels - 1;
+        vDSP_vsmul(inData + inChannel, inChannels, &unity, outData + c, outChannels, numFrames);
+    }
+}
+
+/// Renders frames of a track converted to the output format. Tracks already in the output format are rendered directly. If stopAtWrap is true, rendering stops once the track has no more output frames before its wrap point. Returns the number of output frames rendered.
+static int64_t renderTrack(AudioEngine *engine, TrackState *_Nonnull track, ConversionBuffer *_Nonnull conversion, float *_Nonnull outData, int64_t numFrames, bool stopAtWrap) {
+    const UInt32 outputChannels = engine->outputDesc.mChannelsPerFrame;
+    const ResampleFilter *filter = track->resampleFilter;
+    if (filter == NULL) {
+        if (track->channels == outputChannels) {
+            return renderTrackFrames(engine, track, outData, numFrames, stopAtWrap);
+        }
+        // Only the channels differ, so render through the conversion buffer in chunks and remap them.
+        int64_t renderedFrames = 0;
+        while (renderedFrames < numFrames) {
+            const int64_t chunkFrames = numFrames - renderedFrames < CONVERSION_BUFFER_FRAMES ? numFrames - renderedFrames : CONVERSION_BUFFER_FRAMES;
+            const int64_t chunkRenderedFrames = renderTrackFrames(engine, track, conversion->data, chunkFrames, stopAtWrap);
+            mapChannels(conversion->data, track->channels, outData + renderedFrames * outputChannels, outputChannels, chunkRenderedFrames);
+            renderedFrames += chunkRenderedFrames;
+            if (chunkRenderedFrames < chunkFrames) {
+                break;
+            }
+        }
+        return renderedFrames;
+    }
+
+    const UInt32 inputChannels = track->channels;
+    int64_t renderedFrames = 0;
+    while (renderedFrames < numFrames) {
+        // Render only the input the remaining output frames need, so the track's position stays just ahead of what's been rendered.
+        const int64_t lastInputFrame = (int64_t) ((conversion->position + filter->step * (uint64_t) (numFrames - renderedFrames - 1)) >> 32);
+        int64_t inputFrames = lastInputFrame + RESAMPLER_TAPS - conversion->numFrames;
+        if (inputFrames > CONVERSION_BUFFER_FRAMES - conversion->numFrames) {
+            inputFrames = CONVERSION_BUFFER_FRAMES - conversion->numFrames;
+        }
+        int64_t inputRenderedFrames = 0;
+        if (inputFrames > 0) {
+            inputRenderedFrames = renderTrackFrames(engine, track, conversion->data + conversion->numFrames * inputChannels, inputFrames, stopAtWrap);
+            conversion->numFrames += inputRenderedFrames;
+        }
+        const int64_t outputFrames = resampleFrames(filter, conversion->data, conversion->numFrames, inputChannels, &conversion->position, outData + renderedFrames * outputChannels, outputChannels, numFrames - renderedFrames);
+        renderedFrames += outputFrames;
+
+        // Drop buffered frames that no later output frame needs.
+        int64_t consumedFrames = (int64_t) (conversion->position >> 32);
+        if (consumedFrames > conversion->numFrames) {
+            consumedFrames = conversion->numFrames;
+        }
+        conversion->numFrames -= consumedFrames;
+        conversion->position -= (uint64_t) consumedFrames << 32;
+        memmove(conversion->data, conversion->data + consumedFrames * inputChannels, conversion->numFrames * inputChannels * sizeof(float));
+        // Stop at the wrap point, or if no progress can be made.
+        if (inputRenderedFrames < inputFrames || (inputRenderedFrames == 0 && outputFrames == 0)) {
+            break;
+        }
+    }
+    return renderedFrames;
+}
+
+/// Adds a notification to the notification queue without blocking. If the queue is full, the notification is dropped and the queue is marked as overflowed. Called by the audio callback.
+static void postNotification(AudioEngine *engine, EngineNotificationType type, uint32_t tag) {
+    const uint32_t tail = atomic_load_explicit(&engine->notificationQueue.tail, memory_order_relaxed);
+    const uint32_t head = atomic_load_explicit(&engine->notificationQueue.head, memory_order_acquire);
+    // Still call the notification callback, so the control thread finds out about the dropped notification.
+    engine->renderState.notificationsPosted = true;
+    if (tail - head >= NOTIFICATION_QUEUE_SIZE) {
+        atomic_store_explicit(&engine->notificationQueue.overflowed, true, memory_order_release);
+        return;
+    }
+    engine->notificationQueue.notifications[tail & (NOTIFICATION_QUEUE_SIZE - 1)] = (EngineNotification) { .type = type, .tag = tag, .renderedFrames = engine->renderState.renderedFrames };
+    atomic_store_explicit(&engine->notificationQueue.tail, tail + 1, memory_order_release);
+}
+
+/// Starts writing to the playback timeline.
+static void beginTimelineWrite(AudioEngine *engine) {
+    atomic_fetch_add_explicit(&engine->timeline.sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/// Finishes writing to the playback timeline, publishing the write to readers.
+static void endTimelineWrite(AudioEngine *engine) {
+    atomic_fetch_add_explicit(&engine->timeline.sequence, 1, memory_order_release);
+}
+
+/// Records which frame of the current track is heard at the given rendered frame, and how the track advances from there. If stalled is true, the track stays at that frame. Called by the audio callback wherever the mapping may change.
+static void recordPositionSegment(AudioEngine *engine, int64_t renderedFrame, bool stalled) {
+    const TrackState *track = &engine->renderState.track;
+    if (track->audioData == NULL) {
+        return;
+    }
+    PositionSegment segment = {
+        .renderedFrame = renderedFrame,
+        .trackFrame = track->sampleCounter / track->channels,
+        .endFrame = wrapPointFrame(engine, track, track->channels),
+        .wrapFrame = engine->renderState.loopPlayback ? track->loopStart / track->channels : 0,
+        .step = (uint64_t) 1 << 32
+    };
+    if (segment.wrapFrame >= segment.endFrame) {
+        segment.wrapFrame = 0;
+    }
+    if (track->resampleFilter != NULL) {
+        // The track's position is at the end of the buffered frames, and the next output frame is centered partway through them.
+        const ConversionBuffer *conversion = engine->renderState.trackConversion;
+        segment.trackFrame += (int64_t) (conversion->position >> 32) + RESAMPLER_TAPS / 2 - 1 - conversion->numFrames;
+        segment.step = track->resampleFilter->step;
+    }
+    if (stalled) {
+        segment.step = 0;
+    }
+    beginTimelineWrite(engine);
+    engine->timeline.segments[engine->timeline.numSegments % TIMELINE_SEGMENTS] = segment;
+    engine->timeline.numSegments++;
+    endTimelineWrite(engine);
+}
+
+/// Records that the given rendered frame is heard at the given time.
+static void setTimelineAnchor(AudioEngine *engine, int64_t renderedFrame, uint64_t nanos) {
+    beginTimelineWrite(engine);
+    engine->timeline.anchorFrame = renderedFrame;
+    engine->timeline.anchorNanos = nanos;
+    endTimelineWrite(engine);
+}
+
+/// Makes the queued track the current track, continuing from its current position. Called by the audio callback.
+static void switchToQueuedTrack(AudioEngine *engine) {
+    engine->renderState.track = engine->renderState.queuedTrack;
+    engine->renderState.queuedTrack.audioData = NULL;
+    ConversionBuffer *conversion = engine->renderState.trackConversion;
+    engine->renderState.trackConversion = engine->renderState.queuedConversion;
+    engine->renderState.queuedConversion = conversion;
+    engine->renderState.handoffMode = HandoffNone;
+    engine->renderState.loopWraps = 0;
+    atomic_fetch_add_explicit(&engine->stateSnapshot.handoffCount, 1, memory_order_release);
+    postNotification(engine, NotificationTrackChanged, 0);
+}
+
+/// Moves the current track's buffered frames into the queued track's conversion buffer when switching at the wrap point, so the queued track's first frames follow them through the filter instead of starting from silence, and the current track's last frames are still heard. Tracks converted differently can't share the filter, so the queued track then starts from silence. Called by the audio callback.
+static void carryConversionHistory(AudioEngine *engine) {
+    const TrackState *track = &engine->renderState.track;
+    const TrackState *queuedTrack = &engine->renderState.queuedTrack;
+    if (track->resampleFilter == NULL || queuedTrack->resampleFilter != track->resampleFilter || queuedTrack->channels != track->channels) {
+        return;
+    }
+    const ConversionBuffer *conversion = engine->renderState.trackConversion;
+    ConversionBuffer *queuedConversion = engine->renderState.queuedConversion;
+    queuedConversion->position = conversion->position;
+    queuedConversion->numFrames = conversion->numFrames;
+    memcpy(queuedConversion->data, conversion->data, conversion->numFrames * track->channels * sizeof(float));
+}
+
+/// Checks whether a scheduled event should fire before the next frame is rendered.
+static bool isEventDue(const AudioEngine *engine, const EngineEvent *event) {
+    if (event->trigger == EventTriggerLoopWraps) {
+        // A handoff at a loop wrap is started one wrap early, so the switch happens at the wrap itself.
+        const int64_t loopWraps = event->action == EventActionHandoff && event->numFrames <= 0 ? engine->renderState.loopWraps + 1 : engine->renderState.loopWraps;
+        return loopWraps >= event->position;
+    }
+    return engine->renderState.renderedFrames >= event->position;
+}
+
+/// Performs and removes all scheduled events that are due, in the order they were scheduled. Called by the audio callback between blocks of frames.
+static void fireDueEvents(AudioEngine *engine) {
+    uint32_t numPending = 0;
+    for (uint32_t i = 0; i < engine->renderState.numEvents; i++) {
+        const EngineEvent event = engine->renderState.events[i];
+        if (!isEventDue(engine, &event)) {
+            engine->renderState.events[numPending++] = event;
+            continue;
+        }
+        switch (event.action) {
+            case EventActionRampGain:
+                startGainRamp(engine, (float) event.targetGain, event.numFrames);
+                break;
+            case EventActionHandoff:
+                startQueuedHandoff(engine, event.numFrames);
+                break;
+            default:
+                break;
+        }
+        postNotification(engine, NotificationEventFired, event.tag);
+    }
+    engine->renderState.numEvents = numPending;
+}
+
+/// Pushes back events keyed to rendered frames that haven't fired yet. Called by the audio callback for frames rendered without playing the track, so the events stay the same amount of playback away.
+static void delayRenderedFrameEvents(AudioEngine *engine, int64_t numFrames) {
+    for (uint32_t i = 0; i < engine->renderState.numEvents; i++) {
+        if (engine->renderState.events[i].trigger == EventTriggerRenderedFrames) {
+            engine->renderState.events[i].position += numFrames;
+        }
+    }
+}
+
+/// Limits a number of frames to render so that the block ends where the next event could become due: at the next event keyed to rendered frames, or at the next wrap if any event is keyed to loop wraps.
+static int64_t framesUntilNextEvent(const AudioEngine *engine, int64_t numFrames) {
+    for (uint32_t i = 0; i < engine->renderState.numEvents; i++) {
+        const EngineEvent *event = &engine->renderState.events[i];
+        int64_t eventFrames;
+        if (event->trigger == EventTriggerLoopWraps) {
+            const TrackState *track = &engine->renderState.track;
+            eventFrames = wrapPointFrame(engine, track, track->channels) - track->sampleCounter / track->channels;
+            if (track->resampleFilter != NULL) {
+                // Convert to output frames.
+                eventFrames = (int64_t) (((uint64_t) eventFrames << 32) / track->resampleFilter->step);
+            }
+        } else {
+            eventFrames = event->position - engine->renderState.renderedFrames;
+        }
+        if (eventFrames > 0 && eventFrames < numFrames) {
+            numFrames = eventFrames;
+        }
+    }
+    return numFrames;
+}
+
+/// Renders frames of audio from the current track, handing off to the queued track if a handoff is in progress.
+static void renderAudio(AudioEngine *engine, float *_Nonnull outData, int64_t numFrames) {
+    const int64_t channels = engine->outputDesc.mChannelsPerFrame;
+    if (engine->renderState.handoffMode == HandoffAtLoopWrap) {
+        const int64_t renderedFrames = renderTrack(engine, &engine->renderState.track, engine->renderState.trackConversion, outData, numFrames, true);
+        if (renderedFrames < numFrames) {
+            // Playback reached the wrap point, so continue seamlessly with the queued track.
+            carryConversionHistory(engine);
+            switchToQueuedTrack(engine);
+            recordPositionSegment(engine, engine->renderState.renderedFrames + renderedFrames, false);
+            outData += renderedFrames * channels;
+            numFrames -= renderedFrames;
+        } else {
+            return;
+        }
+    } else if (engine->renderState.handoffMode == HandoffCrossfade) {
+        const int64_t fadeFrames = engine->renderState.crossfadeFramesRemaining < numFrames ? engine->renderState.crossfadeFramesRemaining : numFrames;
+        // Linear gain ramps, stepped per sample. Stepping within a frame is inaudible and lets one ramp cover interleaved channels.
+        const float fadeStep = 1.0f / (float) (engine->renderState.crossfadeFrames * channels);
+        float fadeOutGain = (float) engine->renderState.crossfadeFramesRemaining / (float) engine->renderState.crossfadeFrames;
+        float fadeInGain = 1 - fadeOutGain;
+        const float fadeOutStep = -fadeStep;
+        renderTrack(engine, &engine->renderState.track, engine->renderState.trackConversion, outData, fadeFrames, false);
+        vDSP_vrampmul(outData, 1, &fadeOutGain, &fadeOutStep, outData, 1, fadeFrames * channels);
+        renderTrack(engine, &engine->renderState.queuedTrack, engine->renderState.queuedConversion, engine->crossfadeBuffer, fadeFrames, false);
+        vDSP_vrampmul(engine->crossfadeBuffer, 1, &fadeInGain, &fadeStep, engine->crossfadeBuffer, 1, fadeFrames * channels);
+        vDSP_vadd(outData, 1, engine->crossfadeBuffer, 1, outData, 1, fadeFrames * channels);
+
+        engine->renderState.crossfadeFramesRemaining -= fadeFrames;
+        if (engine->renderState.crossfadeFramesRemaining > 0) {
+            return;
+        }
+        switchToQueuedTrack(engine);
+        recordPositionSegment(engine, engine->renderState.renderedFrames + fadeFrames, false);
+        outData += fadeFrames * channels;
+        numFrames -= fadeFrames;
+    }
+    renderTrack(engine, &engine->renderState.track, engine->renderState.trackConversion, outData, numFrames, false);
+}
+
+/// Checks whether the audio data the current track needs for the next frames has been decoded. If not, asks for it to be decoded next. Called by the audio callback before each block.
+static bool isTrackDecoded(AudioEngine *engine, int64_t numFrames) {
+    const TrackState *track = &engine->renderState.track;
+    DecodeProgress *progress = track->decodeProgress;
+    if (progress == NULL || track->audioData == NULL) {
+        return true;
+    }
+    const int64_t channels = track->channels;
+    int64_t neededFrames = numFrames;
+    if (track->resampleFilter != NULL) {
+        // Convert to input frames, including the filter's lookahead.
+        neededFrames = (int64_t) ((track->resampleFilter->step * (uint64_t) numFrames) >> 32) + RESAMPLER_TAPS;
+    }
+    const int64_t endFrame = wrapPointFrame(engine, track, channels);
+    int64_t wrapFrame = engine->renderState.loopPlayback ? track->loopStart / channels : 0;
+    if (wrapFrame >= endFrame) {
+        wrapFrame = 0;
+    }
+    // Check up to the wrap point, then from where playback wraps to.
+    int64_t startFrame = track->sampleCounter / channels;
+    int64_t spanEndFrame = startFrame + neededFrames < endFrame ? startFrame + neededFrames : endFrame;
+    if (startFrame < spanEndFrame && !isFrameRangeDecoded(progress, startFrame, spanEndFrame)) {
+        requestDecodeFrames(progress, startFrame, spanEndFrame);
+        return false;
+    }
+    neededFrames -= spanEndFrame > startFrame ? spanEndFrame - startFrame : 0;
+    startFrame = wrapFrame;
+    spanEndFrame = startFrame + neededFrames < endFrame ? startFrame + neededFrames : endFrame;
+    if (neededFrames > 0 && !isFrameRangeDecoded(progress, startFrame, spanEndFrame)) {
+        requestDecodeFrames(progress, startFrame, spanEndFrame);
+        return false;
+    }
+    return true;
+}
+
+/// Applies the gain ramp to a block of rendered frames, then the gain it reaches to any frames after the ramp ends. Called by the audio callback only if the gain was ramping when the block was rendered.
+static void applyGainRamp(AudioEngine *engine, float *_Nonnull outData, int64_t numFrames) {
+    const UInt32 channels = engine->outputDesc.mChannelsPerFrame;
+    const int64_t rampFrames = engine->renderState.gainRampFramesRemaining < numFrames ? engine->renderState.gainRampFramesRemaining : numFrames;
+    // Ramp each channel separately so the gain steps once per frame.
+    float gain = engine->renderState.gain;
+    for (UInt32 c = 0; c < channels; c++) {
+        gain = engine->renderState.gain;
+        vDSP_vrampmul(outData + c, channels, &gain, &engine->renderState.gainStep, outData + c, channels, rampFrames);
+    }
+    engine->renderState.gainRampFramesRemaining -= rampFrames;
+    if (engine->renderState.gainRampFramesRemaining > 0) {
+        engine->renderState.gain = gain;
+        return;
+    }
+    // Land exactly on the target to avoid accumulated rounding error.
+    engine->renderState.gain = engine->renderState.targetGain;
+    if (rampFrames < numFrames) {
+        vDSP_vsmul(outData + rampFrames * channels, 1, &engine->renderState.gain, outData + rampFrames * channels, 1, (numFrames - rampFrames) * channels);
+    }
+}
+
+void engineRender(AudioEngine *_Nonnull engine, float *_Nonnull outData, int64_t numFrames) {
+    // Until audio is loaded there's no output format, and nothing to render.
+    if (engine->outputDesc.mBytesPerFrame == 0) {
+        vDSP_vclr(outData, 1, numFrames * engine->outputDesc.mChannelsPerFrame);
+        return;
+    }
+    applyCommands(engine);
+    // Ask the control thread to retry the parameters that didn't fit, now that there's room, rather than waiting for it to change another.
+    if (atomic_load_explicit(&engine->commandQueue.overflowed, memory_order_relaxed) && atomic_exchange_explicit(&engine->commandQueue.overflowed, false, memory_order_relaxed)) {
+        postNotification(engine, NotificationCommandsDrained, 0);
+    }
+
+    // The crossfade scratch buffer holds one audio queue buffer's worth of frames, so longer renders are split into blocks of that size.
+    const int64_t maxBlockFrames = BUFFER_SIZE / engine->outputDesc.mBytesPerFrame;
+    while (numFrames > 0) {
+        fireDueEvents(engine);
+        // Blocks are also split at scheduled events, so each fires on its exact frame.
+        const int64_t blockFrames = framesUntilNextEvent(engine, numFrames < maxBlockFrames ? numFrames : maxBlockFrames);
+        if (isTrackDecoded(engine, blockFrames)) {
+            recordPositionSegment(engine, engine->renderState.renderedFrames, false);
+            renderAudio(engine, outData, blockFrames);
+            if (engine->renderState.gainRampFramesRemaining > 0) {
+                applyGainRamp(engine, outData, blockFrames);
+            }
+        } else {
+            // Hold the track where it is until the audio it needs has been decoded, rather than playing the silence in its place.
+            recordPositionSegment(engine, engine->renderState.renderedFrames, true);
+            vDSP_vclr(outData, 1, blockFrames * engine->outputDesc.mChannelsPerFrame);
+            delayRenderedFrameEvents(engine, blockFrames);
+            engine->renderState.heldFrames += blockFrames;
+        }
+        engine->renderState.renderedFrames += blockFrames;
+        outData += blockFrames * engine->outputDesc.mChannelsPerFrame;
+        numFrames -= blockFrames;
+    }
+    // Fire events that became due at the end of the buffer now rather than a buffer later.
+    fireDueEvents(engine);
+    atomic_store_explicit(&engine->stateSnapshot.sampleCounter, engine->renderState.track.sampleCounter / engine->renderState.track.channels, memory_order_release);
+    atomic_store_explicit(&engine->stateSnapshot.renderedFrames, engine->renderState.renderedFrames, memory_order_release);
+    atomic_store_explicit(&engine->stateSnapshot.heldFrames, engine->renderState.heldFrames, memory_order_release);
+    atomic_store_explicit(&engine->stateSnapshot.loopWraps, engine->renderState.loopWraps, memory_order_release);
+    if (engine->renderState.notificationsPosted) {
+        engine->renderState.notificationsPosted = false;
+        if (engine->notificationCallback != NULL) {
+            engine->notificationCallback(engine->notificationUserData);
+        }
+    }
+}
+
+/// Gets the current time in nanoseconds from a monotonic clock.
+static uint64_t currentNanos(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + (uint64_t) time.tv_nsec;
+}
+
+/// Records how long the audio callback took to render a buffer of the given duration. Called by the audio callback.
+static void recordCallbackTiming(AudioEngine *engine, uint64_t renderNanos, uint64_t bufferNanos) {
+    const uint64_t micros = renderNanos / 1000;
+    // Bucket i holds durations with i significant bits of microseconds.
+    unsigned int bucket = micros > 0 ? 64 - __builtin_clzll(micros) : 0;
+    if (bucket >= RENDER_TIMING_BUCKETS) {
+        bucket = RENDER_TIMING_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&engine->timings.histogram[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&engine->timings.numCallbacks, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&engine->timings.totalNanos, renderNanos, memory_order_relaxed);
+    if (renderNanos > bufferNanos) {
+        atomic_fetch_add_explicit(&engine->timings.numLateCallbacks, 1, memory_order_relaxed);
+    }
+    if (renderNanos > atomic_load_explicit(&engine->timings.maxNanos, memory_order_relaxed)) {
+        atomic_store_explicit(&engine->timings.maxNanos, renderNanos, memory_order_relaxed);
+    }
+}
+
+/// Buffers double after a callback that took over half its buffer's duration or found an underrun, and halve after 64 callbacks in a row that took under an eighth. calmCallbacks counts those callbacks, and is updated in place.
+UInt32 nextBufferFrames(UInt32 frames, UInt32 minFrames, UInt32 maxFrames, UInt32 *_Nonnull calmCallbacks, uint64_t renderNanos, uint64_t bufferNanos, bool underrun) {
+    if (underrun || renderNanos > bufferNanos / 2) {
+        frames *= 2;
+        *calmCallbacks = 0;
+    } else if (renderNanos < bufferNanos / 8) {
+        if (++*calmCallbacks >= ADAPTIVE_SHRINK_CALLBACKS) {
+            frames /= 2;
+            *calmCallbacks = 0;
+        }
     } else {
-        if (queue != NULL) {
-            // Deallocate any existing audio buffers.
-            for (unsigned int i = 0; i < NUM_BUFFERS; i++) {
-                OSStatus status = AudioQueueFreeBuffer(queue, buffers[i]);
-                if (status != 0) {
-                    return status;
-                }
+        *calmCallbacks = 0;
+    }
+    return frames < minFrames ? minFrames : frames > maxFrames ? maxFrames : frames;
+}
+
+/// Adapts the number of frames rendered into each buffer to how long rendering took. Called by the audio callback.
+static void adaptBufferFrames(AudioEngine *engine, uint64_t renderNanos, uint64_t bufferNanos, bool underrun) {
+    const UInt32 minFrames = atomic_load_explicit(&engine->minBufferFrames, memory_order_relaxed);
+    const UInt32 maxFrames = atomic_load_explicit(&engine->maxBufferFrames, memory_order_relaxed);
+    const UInt32 frames = atomic_load_explicit(&engine->bufferFrames, memory_order_relaxed);
+    atomic_store_explicit(&engine->bufferFrames, nextBufferFrames(frames, minFrames, maxFrames, &engine->calmCallbacks, renderNanos, bufferNanos, underrun), memory_order_relaxed);
+}
+
+/// Renders the next audio samples into a buffer, and enqueues it on the audio queue if there is one. bufferIndex is the buffer's index among the engine's audio queue buffers, or -1 for a standalone buffer.
+static void fillBuffer(AudioEngine *engine, AudioQueueRef queue, AudioQueueBufferRef buffer, int bufferIndex) {
+    if (engine->outputDesc.mBytesPerFrame == 0) {
+        memset(buffer->mAudioData, 0, buffer->mAudioDataByteSize);
+        return;
+    }
+    if (queue != NULL) {
+        buffer->mAudioDataByteSize = atomic_load_explicit(&engine->bufferFrames, memory_order_relaxed) * engine->outputDesc.mBytesPerFrame;
+    }
+    const int64_t numFrames = buffer->mAudioDataByteSize / engine->outputDesc.mBytesPerFrame;
+    const uint64_t bufferNanos = (uint64_t) ((double) numFrames / engine->outputDesc.mSampleRate * 1e9);
+    const uint64_t startNanos = currentNanos();
+    if (bufferIndex >= 0 && !atomic_load_explicit(&engine->primingBuffers, memory_order_relaxed)) {
+        // The audio queue returns a buffer once it has played, so playback has just reached the end of it.
+        setTimelineAnchor(engine, engine->bufferEndFrames[bufferIndex], startNanos);
+    }
+    engineRender(engine, (float*) buffer->mAudioData, numFrames);
+    const uint64_t endNanos = currentNanos();
+    recordCallbackTiming(engine, endNanos - startNanos, bufferNanos);
+
+    if (queue != NULL) {
+        // Once every buffer has played since the last enqueue, the queue has nothing left to play.
+        const bool underrun = engine->timings.lastEnqueueNanos != 0 && endNanos - engine->timings.lastEnqueueNanos > engine->numBuffers * bufferNanos;
+        if (underrun) {
+            atomic_fetch_add_explicit(&engine->timings.numUnderruns, 1, memory_order_relaxed);
+        }
+        engine->timings.lastEnqueueNanos = endNanos;
+        adaptBufferFrames(engine, endNanos - startNanos, bufferNanos, underrun);
+        if (bufferIndex >= 0) {
+            engine->bufferEndFrames[bufferIndex] = engine->renderState.renderedFrames;
+            // Tag the buffer with the seek it was rendered after.
+            atomic_store_explicit(&engine->bufferSeekSequences[bufferIndex], atomic_load_explicit(&engine->stateSnapshot.seekSequence, memory_order_relaxed), memory_order_release);
+        }
+        AudioQueueEnqueueBuffer(queue, buffer, 0, NULL);
+    }
+}
+
+/// Callback to load audio buffers with audio samples. Buffers aren't enqueued if queue is NULL, which allows rendering into a standalone buffer for benchmarking.
+void audioCallback(void *customData, AudioQueueRef queue, AudioQueueBufferRef buffer) {
+    AudioEngine *engine = customData != NULL ? (AudioEngine*) customData : &defaultEngine;
+    int bufferIndex = -1;
+    if (queue != NULL) {
+        for (unsigned int i = 0; i < engine->numBuffers; i++) {
+            if (engine->buffers[i] == buffer) {
+                bufferIndex = i;
             }
         }
-        
-        OSStatus status = AudioQueueNewOutput(&audioDesc, audioCallback, NULL, NULL, NULL, 0, &queue);
+    }
+    if (bufferIndex >= 0) {
+        // A buffer returned while it's being flushed is handed to the control thread to re-render.
+        int expected = BufferFlushing;
+        if (atomic_compare_exchange_strong_explicit(&engine->bufferStates[bufferIndex], &expected, BufferFlushed, memory_order_acq_rel, memory_order_acquire)) {
+            return;
+        }
+    }
+    fillBuffer(engine, queue, buffer, bufferIndex);
+}
+
+/// Gets the 32-bit float format the audio queue uses to play audio data in the given format.
+static AudioStreamBasicDescription queueAudioDesc(AudioStreamBasicDescription dataAudioDesc) {
+    // The audio queue always plays 32-bit float, whatever the format the audio data is stored in.
+    AudioStreamBasicDescription audioDesc = dataAudioDesc;
+    audioDesc.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked;
+    audioDesc.mBitsPerChannel = 32;
+    audioDesc.mBytesPerFrame = 4 * audioDesc.mChannelsPerFrame;
+    audioDesc.mBytesPerPacket = audioDesc.mBytesPerFrame * audioDesc.mFramesPerPacket;
+    return audioDesc;
+}
+
+/// Gets the format audio is rendered in when audio in the given format is loaded: the requested output format, falling back to a fixed default for engines that play audio and to the loaded audio's format for engines that don't.
+static AudioStreamBasicDescription outputAudioDesc(const AudioEngine *engine, AudioStreamBasicDescription dataAudioDesc) {
+    AudioStreamBasicDescription audioDesc = queueAudioDesc(dataAudioDesc);
+    if (engine->requestedOutputSampleRate > 0) {
+        audioDesc.mSampleRate = engine->requestedOutputSampleRate;
+    } else if (engine->playsAudio) {
+        audioDesc.mSampleRate = DEFAULT_OUTPUT_SAMPLE_RATE;
+    }
+    if (engine->requestedOutputChannels > 0) {
+        audioDesc.mChannelsPerFrame = engine->requestedOutputChannels;
+    } else if (engine->playsAudio) {
+        audioDesc.mChannelsPerFrame = DEFAULT_OUTPUT_CHANNELS;
+    }
+    audioDesc.mFramesPerPacket = 1;
+    audioDesc.mBytesPerFrame = 4 * audioDesc.mChannelsPerFrame;
+    audioDesc.mBytesPerPacket = audioDesc.mBytesPerFrame;
+    return audioDesc;
+}
+
+/// Gets the resampling filter for converting audio in the given format to the output format, creating it if needed. The filter is NULL if the sample rates match. Fails if the audio can't be converted.
+static OSStatus getResampleFilter(AudioEngine *engine, AudioStreamBasicDescription dataAudioDesc, AudioStreamBasicDescription outputDesc, const ResampleFilter **filter) {
+    *filter = NULL;
+    if (dataAudioDesc.mSampleRate == outputDesc.mSampleRate && dataAudioDesc.mChannelsPerFrame == outputDesc.mChannelsPerFrame) {
+        return 0;
+    }
+    if (dataAudioDesc.mChannelsPerFrame == 0 || dataAudioDesc.mChannelsPerFrame > MAX_CONVERTED_CHANNELS || dataAudioDesc.mSampleRate <= 0) {
+        return kAudioFormatUnsupportedDataFormatError;
+    }
+    if (dataAudioDesc.mSampleRate == outputDesc.mSampleRate) {
+        return 0;
+    }
+    for (UInt32 i = 0; i < engine->numResampleFilters; i++) {
+        if (engine->resampleFilters[i]->inputRate == dataAudioDesc.mSampleRate && engine->resampleFilters[i]->outputRate == outputDesc.mSampleRate) {
+            *filter = engine->resampleFilters[i];
+            return 0;
+        }
+    }
+    if (engine->numResampleFilters >= MAX_RESAMPLE_FILTERS) {
+        return kAudioFormatUnsupportedDataFormatError;
+    }
+    ResampleFilter *newFilter = createResampleFilter(dataAudioDesc.mSampleRate, outputDesc.mSampleRate);
+    if (newFilter == NULL) {
+        return kAudio_MemFullError;
+    }
+    engine->resampleFilters[engine->numResampleFilters++] = newFilter;
+    *filter = newFilter;
+    return 0;
+}
+
+/// Frees the seam of the queued track and forgets the queued track. Only safe once the audio callback can no longer be using it.
+static void clearQueuedTrack(AudioEngine *engine) {
+    free((SeamBuffer*) engine->controlState.queuedTrack.seam);
+    engine->controlState.queuedTrack = (TrackState) { 0 };
+    engine->controlState.handoffMode = HandoffNone;
+}
+
+AudioEngine *createAudioEngine(bool playsAudio) {
+    AudioEngine *engine = calloc(1, sizeof(AudioEngine));
+    if (engine == NULL) {
+        return NULL;
+    }
+    engine->renderState.loopPlayback = true;
+    engine->renderState.gain = 1;
+    engine->renderState.targetGain = 1;
+    engine->controlState.loopPlayback = true;
+    engine->controlState.targetGain = 1;
+    engine->renderState.trackConversion = &engine->conversionBuffers[0];
+    engine->renderState.queuedConversion = &engine->conversionBuffers[1];
+    engine->playsAudio = playsAudio;
+    return engine;
+}
+
+void disposeAudioEngine(AudioEngine *engine) {
+    if (engine == &defaultEngine) {
+        return;
+    }
+    if (engine->queue != NULL) {
+        // Disposing the audio queue also disposes its buffers.
+        AudioQueueDispose(engine->queue, true);
+    }
+    free(engine->controlState.seam);
+    free((SeamBuffer*) engine->controlState.queuedTrack.seam);
+    while (engine->controlState.retiredSeams != NULL) {
+        SeamBuffer *seam = engine->controlState.retiredSeams;
+        engine->controlState.retiredSeams = seam->nextRetired;
+        free(seam);
+    }
+    for (UInt32 i = 0; i < engine->numResampleFilters; i++) {
+        free(engine->resampleFilters[i]);
+    }
+    free(engine);
+}
+
+AudioEngine *getDefaultAudioEngine(void) {
+    return &defaultEngine;
+}
+
+/// Gets the buffer geometry to use for audio with the given frame size, filling in defaults for anything not requested.
+static void resolveBufferGeometry(const AudioEngine *engine, UInt32 bytesPerFrame, UInt32 *numBuffers, UInt32 *minFrames, UInt32 *maxFrames) {
+    *numBuffers = engine->requestedNumBuffers == 0 ? NUM_BUFFERS : engine->requestedNumBuffers < MAX_BUFFERS ? engine->requestedNumBuffers : MAX_BUFFERS;
+    *maxFrames = engine->requestedMaxBufferFrames == 0 ? BUFFER_SIZE / bytesPerFrame : engine->requestedMaxBufferFrames;
+    *minFrames = engine->requestedMinBufferFrames == 0 || engine->requestedMinBufferFrames > *maxFrames ? *maxFrames : engine->requestedMinBufferFrames;
+}
+
+/// Sets the range of frames rendered into each buffer, clamping the current number of frames to it.
+static void setBufferFrameRange(AudioEngine *engine, UInt32 minFrames, UInt32 maxFrames) {
+    atomic_store_explicit(&engine->minBufferFrames, minFrames, memory_order_relaxed);
+    atomic_store_explicit(&engine->maxBufferFrames, maxFrames, memory_order_relaxed);
+    const UInt32 frames = atomic_load_explicit(&engine->bufferFrames, memory_order_relaxed);
+    // Start new playback with the largest buffers, which adaptive buffers shrink from.
+    atomic_store_explicit(&engine->bufferFrames, frames == 0 || frames > maxFrames ? maxFrames : frames < minFrames ? minFrames : frames, memory_order_relaxed);
+}
+
+/// Loads audio data into the engine in preparation for audio playback.
+OSStatus engineLoadAudio(AudioEngine *_Nonnull engine, void *_Nonnull newAudioData, int64_t newNumSamples, const AudioStreamBasicDescription dataAudioDesc) {
+    SampleFormat newSampleFormat;
+    if (sampleFormatFromAudioDesc(&dataAudioDesc, &newSampleFormat) != 0) {
+        return kAudioFormatUnsupportedDataFormatError;
+    }
+    const AudioStreamBasicDescription audioDesc = outputAudioDesc(engine, dataAudioDesc);
+    const ResampleFilter *resampleFilter;
+    OSStatus filterStatus = getResampleFilter(engine, dataAudioDesc, audioDesc, &resampleFilter);
+    if (filterStatus != 0) {
+        return filterStatus;
+    }
+
+    // Audio is only loaded while playback is stopped, so any queued track is no longer in use, and any unfinished handoff is abandoned.
+    clearQueuedTrack(engine);
+    engine->controlState.handoffCount = atomic_load_explicit(&engine->stateSnapshot.handoffCount, memory_order_acquire);
+    engine->controlState.track.audioData = newAudioData;
+    engine->controlState.track.numSamples = newNumSamples;
+    engine->controlState.track.sampleFormat = newSampleFormat;
+    engine->controlState.track.sampleSize = bytesPerSample(newSampleFormat);
+    engine->controlState.track.channels = dataAudioDesc.mChannelsPerFrame;
+    engine->controlState.track.resampleFilter = resampleFilter;
+    engine->controlState.track.decodeProgress = NULL;
+    sendCommand(engine, CommandSetAudio);
+
+    // Tracks are converted to the output format, so this only changes when the output format itself does.
+    const bool formatChanged = !areAudioDescsEqual(audioDesc, engine->outputDesc);
+    UInt32 numBuffers, minFrames, maxFrames;
+    resolveBufferGeometry(engine, audioDesc.mBytesPerFrame, &numBuffers, &minFrames, &maxFrames);
+    // If the audio format and buffer geometry are the same, no need to recreate the audio queue or its buffers.
+    if (!formatChanged && numBuffers == engine->numBuffers && maxFrames == engine->bufferCapacityFrames) {
+        setBufferFrameRange(engine, minFrames, maxFrames);
+        return 0;
+    }
+    if (engine->playsAudio && engine->queue != NULL && formatChanged) {
+        // Disposing the audio queue also disposes its buffers.
+        OSStatus status = AudioQueueDispose(engine->queue, true);
         if (status != 0) {
             return status;
         }
-        
-        origAudioDesc = audioDesc;
-        audioData = newAudioData;
-        numSamples = newNumSamples;
-        
-        // Initialize audio buffers according to the audio description.
-        for (unsigned int i = 0; i < NUM_BUFFERS; i++) {
-            OSStatus status = AudioQueueAllocateBuffer(queue, BUFFER_SIZE, &buffers[i]);
+        engine->queue = NULL;
+    } else if (engine->playsAudio && engine->queue != NULL) {
+        // Deallocate any existing audio buffers.
+        for (unsigned int i = 0; i < engine->numBuffers; i++) {
+            OSStatus status = AudioQueueFreeBuffer(engine->queue, engine->buffers[i]);
             if (status != 0) {
                 return status;
             }
-            buffers[i]->mAudioDataByteSize = BUFFER_SIZE;
         }
-        return status;
     }
+    engine->numBuffers = 0;
+    if (formatChanged) {
+        if (engine->playsAudio) {
+            OSStatus status = AudioQueueNewOutput(&audioDesc, audioCallback, engine, NULL, NULL, 0, &engine->queue);
+            if (status != 0) {
+                return status;
+            }
+        }
+        engine->outputDesc = audioDesc;
+    }
+
+    engine->bufferCapacityFrames = maxFrames;
+    setBufferFrameRange(engine, minFrames, maxFrames);
+    if (!engine->playsAudio) {
+        return 0;
+    }
+    // Initialize audio buffers large enough for the most frames they can hold. Adaptive buffers only fill part of that.
+    for (unsigned int i = 0; i < numBuffers; i++) {
+        OSStatus status = AudioQueueAllocateBuffer(engine->queue, maxFrames * audioDesc.mBytesPerFrame, &engine->buffers[i]);
+        if (status != 0) {
+            return status;
+        }
+        engine->buffers[i]->mAudioDataByteSize = maxFrames * audioDesc.mBytesPerFrame;
+        atomic_store_explicit(&engine->bufferStates[i], BufferQueued, memory_order_relaxed);
+        engine->numBuffers = i + 1;
+    }
+    return 0;
 }
 
-void setSampleCounter(int64_t newSampleCounter) {
-    sampleCounter = newSampleCounter * origAudioDesc.mChannelsPerFrame;
+void engineSetDecodeProgress(AudioEngine *_Nonnull engine, DecodeProgress *_Nullable decodeProgress) {
+    // While playback holds, the audio callback asks for the missing audio to be decoded next. Seeks and loop points also ask for the audio around them to be decoded first.
+    engine->controlState.track.decodeProgress = decodeProgress;
+    sendCommand(engine, CommandSetDecodeProgress);
 }
 
-void setLoopPoints(int64_t newLoopStart, int64_t newLoopEnd) {
-    loopStart = newLoopStart * origAudioDesc.mChannelsPerFrame;
-    loopEnd = newLoopEnd * origAudioDesc.mChannelsPerFrame;
+void engineSetSampleCounter(AudioEngine *_Nonnull engine, int64_t newSampleCounter) {
+    if (engine->controlState.track.decodeProgress != NULL) {
+        requestDecodeFrames(engine->controlState.track.decodeProgress, newSampleCounter, newSampleCounter + PRIORITY_DECODE_FRAMES);
+    }
+    engine->controlState.sampleCounter = newSampleCounter * engine->controlState.track.channels;
+    engine->controlState.seekSequence++;
+    sendCommand(engine, CommandSetSampleCounter);
 }
 
-void setVolumeMultiplier(double newVolumeMultiplier) {
-    volumeMultiplier = newVolumeMultiplier;
+/// Frees replaced seams that the audio callback is no longer using.
+static void freeRetiredSeams(AudioEngine *engine) {
+    const uint64_t appliedSequence = atomic_load_explicit(&engine->stateSnapshot.loopPointsSequence, memory_order_acquire);
+    SeamBuffer **retired = &engine->controlState.retiredSeams;
+    while (*retired != NULL) {
+        if ((*retired)->retiredSequence <= appliedSequence) {
+            SeamBuffer *seam = *retired;
+            *retired = seam->nextRetired;
+            free(seam);
+        } else {
+            retired = &(*retired)->nextRetired;
+        }
+    }
 }
 
-void setLoopPlayback(bool newLoopPlayback) {
-    loopPlayback = newLoopPlayback;
+/// Retires a seam so it is freed once the audio callback has applied the command with the current loop-points sequence.
+static void retireSeam(AudioEngine *engine, SeamBuffer *seam) {
+    if (seam != NULL) {
+        seam->retiredSequence = engine->controlState.loopPointsSequence;
+        seam->nextRetired = engine->controlState.retiredSeams;
+        engine->controlState.retiredSeams = seam;
+    }
 }
 
-OSStatus playAudio() {
-    // Preload the first set of audio data either if the queue wasn't paused, or if the sample counter has changed since playback was paused.
-    if (!paused || (paused && sampleCounter != sampleCounterOnPause)) {
-        // If the latter condition was true, then stop playback first to flush the audio queue.
-        if (paused) {
-            // Record the sample counter before calling stop, since audioCallback can be called a few times while the audio queue stops.
-            const int64_t preStopSampleCounter = sampleCounter;
-            OSStatus status = AudioQueueStop(queue, true);
-            if (status != 0) {
-                return status;
-            }
-            // Now rollback the sample counter to be what it was before stopping.
-            sampleCounter = preStopSampleCounter;
+/// Renders an equal-power crossfade from the audio leading up to the loop end into the audio leading up to the loop start of a track, so that the jump to the loop start is continuous. Returns NULL if crossfading is disabled or there isn't enough audio before the loop start.
+static SeamBuffer *renderSeam(AudioEngine *engine, const TrackState *track, int64_t loopStartFrame, int64_t loopEndFrame) {
+    const int64_t channels = track->channels;
+    int64_t seamFrames = engine->controlState.loopCrossfadeFrames;
+    if (seamFrames > loopStartFrame) {
+        seamFrames = loopStartFrame;
+    }
+    if (seamFrames > loopEndFrame - loopStartFrame) {
+        seamFrames = loopEndFrame - loopStartFrame;
+    }
+    if (seamFrames <= 0 || loopEndFrame * channels > track->numSamples) {
+        return NULL;
+    }
+    if (track->decodeProgress != NULL && (!isFrameRangeDecoded(track->decodeProgress, loopEndFrame - seamFrames, loopEndFrame) || !isFrameRangeDecoded(track->decodeProgress, loopStartFrame - seamFrames, loopStartFrame))) {
+        // Crossfading from audio that hasn't been decoded yet would fade through silence. Loops play without a crossfade until the loop points are set again.
+        return NULL;
+    }
+
+    SeamBuffer *seam = malloc(sizeof(SeamBuffer) + seamFrames * channels * sizeof(float));
+    float *fadeInData = malloc(seamFrames * channels * sizeof(float));
+    if (seam == NULL || fadeInData == NULL) {
+        free(seam);
+        free(fadeInData);
+        return NULL;
+    }
+    seam->numFrames = seamFrames;
+    seam->nextRetired = NULL;
+
+    // The seam is stored as floating point regardless of the audio data's format.
+    float *fadeOutData = seam->data;
+    convertSamplesToFloat(track->audioData + (loopEndFrame - seamFrames) * channels * track->sampleSize, 1, track->sampleFormat, 1, fadeOutData, 1, seamFrames * channels);
+    convertSamplesToFloat(track->audioData + (loopStartFrame - seamFrames) * channels * track->sampleSize, 1, track->sampleFormat, 1, fadeInData, 1, seamFrames * channels);
+    for (int64_t i = 0; i < seamFrames; i++) {
+        const float angle = (float) M_PI_2 * ((float) i + 0.5f) / (float) seamFrames;
+        const float fadeOutGain = cosf(angle);
+        const float fadeInGain = sinf(angle);
+        for (int64_t c = 0; c < channels; c++) {
+            seam->data[i * channels + c] = fadeOutData[i * channels + c] * fadeOutGain + fadeInData[i * channels + c] * fadeInGain;
+        }
+    }
+    free(fadeInData);
+    return seam;
+}
+
+void engineSetLoopPoints(AudioEngine *_Nonnull engine, int64_t newLoopStart, int64_t newLoopEnd) {
+    freeRetiredSeams(engine);
+
+    DecodeProgress *decodeProgress = engine->controlState.track.decodeProgress;
+    if (decodeProgress != NULL) {
+        // Decode around the loop points first so loops play correctly while the rest of the track decodes. The most recent request is decoded first, and playback reaches the loop end before it wraps to the loop start.
+        requestDecodeFrames(decodeProgress, newLoopStart - engine->controlState.loopCrossfadeFrames, newLoopStart + PRIORITY_DECODE_FRAMES);
+        requestDecodeFrames(decodeProgress, newLoopEnd - PRIORITY_DECODE_FRAMES, newLoopEnd);
+    }
+
+    engine->controlState.loopStart = newLoopStart * engine->controlState.track.channels;
+    engine->controlState.loopEnd = newLoopEnd * engine->controlState.track.channels;
+    engine->controlState.loopPointsSequence++;
+    retireSeam(engine, engine->controlState.seam);
+    engine->controlState.seam = renderSeam(engine, &engine->controlState.track, newLoopStart, newLoopEnd);
+    sendCommand(engine, CommandSetLoopPoints);
+}
+
+OSStatus engineQueueAudio(AudioEngine *_Nonnull engine, void *_Nullable newAudioData, int64_t newNumSamples, const AudioStreamBasicDescription dataAudioDesc, int64_t startSample, int64_t newLoopStart, int64_t newLoopEnd) {
+    freeRetiredSeams(engine);
+
+    TrackState track = { 0 };
+    if (newAudioData != NULL) {
+        SampleFormat newSampleFormat;
+        if (sampleFormatFromAudioDesc(&dataAudioDesc, &newSampleFormat) != 0) {
+            return kAudioFormatUnsupportedDataFormatError;
         }
-        for (unsigned int i = 0; i < NUM_BUFFERS; i++) {
-            audioCallback(NULL, queue, buffers[i]);
+        // Tracks in other formats are converted while rendering, so any track can be handed off to without touching the audio queue.
+        const ResampleFilter *resampleFilter;
+        OSStatus status = getResampleFilter(engine, dataAudioDesc, engine->outputDesc, &resampleFilter);
+        if (status != 0) {
+            return status;
         }
+        const int64_t channels = dataAudioDesc.mChannelsPerFrame;
+        track.audioData = newAudioData;
+        track.numSamples = newNumSamples;
+        track.sampleFormat = newSampleFormat;
+        track.sampleSize = bytesPerSample(newSampleFormat);
+        track.channels = dataAudioDesc.mChannelsPerFrame;
+        track.resampleFilter = resampleFilter;
+        track.sampleCounter = startSample * channels;
+        track.loopStart = newLoopStart * channels;
+        track.loopEnd = newLoopEnd * channels;
+        track.seam = renderSeam(engine, &track, newLoopStart, newLoopEnd);
+    }
+
+    engine->controlState.loopPointsSequence++;
+    retireSeam(engine, (SeamBuffer*) engine->controlState.queuedTrack.seam);
+    engine->controlState.queuedTrack = track;
+    engine->controlState.handoffMode = HandoffNone;
+    sendCommand(engine, CommandQueueAudio);
+    return 0;
+}
+
+void engineStartHandoff(AudioEngine *_Nonnull engine, int64_t crossfadeLength) {
+    if (engine->controlState.queuedTrack.audioData == NULL) {
+        return;
+    }
+    engine->controlState.handoffMode = crossfadeLength > 0 ? HandoffCrossfade : HandoffAtLoopWrap;
+    engine->controlState.handoffCrossfadeFrames = crossfadeLength;
+    sendCommand(engine, CommandStartHandoff);
+}
+
+bool engineFinishHandoff(AudioEngine *_Nonnull engine) {
+    // Only finish a handoff that the audio callback has actually made.
+    if (engine->controlState.queuedTrack.audioData == NULL || atomic_load_explicit(&engine->stateSnapshot.handoffCount, memory_order_acquire) == engine->controlState.handoffCount) {
+        return false;
+    }
+    engine->controlState.handoffCount++;
+    freeRetiredSeams(engine);
+
+    // Resend the queued track's loop points, in case they were overwritten by loop points set for the old track after the audio callback switched tracks. The old seam is freed once that's applied.
+    engine->controlState.loopPointsSequence++;
+    retireSeam(engine, engine->controlState.seam);
+    engine->controlState.seam = (SeamBuffer*) engine->controlState.queuedTrack.seam;
+    engine->controlState.loopStart = engine->controlState.queuedTrack.loopStart;
+    engine->controlState.loopEnd = engine->controlState.queuedTrack.loopEnd;
+    engine->controlState.track = engine->controlState.queuedTrack;
+    engine->controlState.track.seam = NULL;
+    engine->controlState.queuedTrack = (TrackState) { 0 };
+    engine->controlState.handoffMode = HandoffNone;
+    sendCommand(engine, CommandSetLoopPoints);
+    return true;
+}
+
+bool engineScheduleEvent(AudioEngine *_Nonnull engine, EngineEvent event) {
+    if (engine->controlState.numUnsentEvents >= MAX_EVENTS) {
+        return false;
+    }
+    engine->controlState.unsentEvents[engine->controlState.numUnsentEvents++] = event;
+    sendCommand(engine, CommandScheduleEvent);
+    return true;
+}
+
+void engineCancelEvents(AudioEngine *_Nonnull engine) {
+    // Unsent events would be cancelled as soon as they arrived, so they're never sent.
+    engine->controlState.numUnsentEvents = 0;
+    engine->controlState.unsentCommands &= ~(1u << CommandScheduleEvent);
+    sendCommand(engine, CommandCancelEvents);
+}
+
+bool enginePollNotification(AudioEngine *_Nonnull engine, EngineNotification *_Nonnull notification) {
+    if (engine->controlState.unsentCommands != 0) {
+        sendCommands(engine);
+    }
+    const uint32_t head = atomic_load_explicit(&engine->notificationQueue.head, memory_order_relaxed);
+    const uint32_t tail = atomic_load_explicit(&engine->notificationQueue.tail, memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+    *notification = engine->notificationQueue.notifications[head & (NOTIFICATION_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&engine->notificationQueue.head, head + 1, memory_order_release);
+    return true;
+}
+
+bool engineTakeNotificationsDropped(AudioEngine *_Nonnull engine) {
+    return atomic_load_explicit(&engine->notificationQueue.overflowed, memory_order_relaxed) && atomic_exchange_explicit(&engine->notificationQueue.overflowed, false, memory_order_acquire);
+}
+
+void engineSetNotificationCallback(AudioEngine *_Nonnull engine, NotificationCallback _Nullable callback, void *_Nullable userData) {
+    engine->notificationCallback = callback;
+    engine->notificationUserData = userData;
+}
+
+void engineSetBufferGeometry(AudioEngine *_Nonnull engine, UInt32 numBuffers, UInt32 minFrames, UInt32 maxFrames) {
+    // Fewer, smaller buffers make parameter changes heard sooner. More, larger buffers use less power and are more robust against underruns, so buffers shrink while the audio callback stays well within its deadline and grow after it comes close or underruns.
+    engine->requestedNumBuffers = numBuffers;
+    engine->requestedMinBufferFrames = minFrames;
+    engine->requestedMaxBufferFrames = maxFrames;
+    if (engine->outputDesc.mBytesPerFrame == 0) {
+        return;
     }
-    playing = true;
-    paused = false;
-    sampleCounterOnPause = -1;
-    return AudioQueueStart(queue, NULL);
+    // A new range that fits in the existing buffers applies right away. Anything else waits for audio to be loaded.
+    UInt32 resolvedNumBuffers, resolvedMinFrames, resolvedMaxFrames;
+    resolveBufferGeometry(engine, engine->outputDesc.mBytesPerFrame, &resolvedNumBuffers, &resolvedMinFrames, &resolvedMaxFrames);
+    if (resolvedNumBuffers == engine->numBuffers && resolvedMaxFrames <= engine->bufferCapacityFrames) {
+        setBufferFrameRange(engine, resolvedMinFrames, resolvedMaxFrames);
+    }
+}
+
+void engineSetOutputFormat(AudioEngine *_Nonnull engine, Float64 sampleRate, UInt32 numChannels) {
+    // Tracks in other formats are resampled and channel-mapped while rendering, so loading or handing off to a track never recreates the audio queue. Sample counters, loop points and the loop crossfade length stay in frames of each track, while gain ramps, handoff crossfades and scheduled events count output frames.
+    engine->requestedOutputSampleRate = sampleRate;
+    engine->requestedOutputChannels = numChannels;
+}
+
+void engineSetLoopCrossfadeLength(AudioEngine *_Nonnull engine, int64_t newLoopCrossfadeLength) {
+    engine->controlState.loopCrossfadeFrames = newLoopCrossfadeLength;
+}
+
+void engineSetVolumeMultiplier(AudioEngine *_Nonnull engine, double newVolumeMultiplier) {
+    engine->controlState.volumeMultiplier = newVolumeMultiplier;
+    sendCommand(engine, CommandSetVolumeMultiplier);
 }
 
-OSStatus pauseAudio() {
-    playing = false;
-    paused = true;
-    OSStatus status = AudioQueuePause(queue);
+void engineRampGain(AudioEngine *_Nonnull engine, double targetGain, int64_t numFrames) {
+    engine->controlState.targetGain = (float) targetGain;
+    engine->controlState.gainRampFrames = numFrames > 0 ? numFrames : 0;
+    sendCommand(engine, CommandRampGain);
+}
+
+void engineSetLoopPlayback(AudioEngine *_Nonnull engine, bool newLoopPlayback) {
+    engine->controlState.loopPlayback = newLoopPlayback;
+    sendCommand(engine, CommandSetLoopPlayback);
+}
+
+/// Flushes the audio queue and re-renders its buffers if any were rendered before the latest seek, so the seek is heard as soon as playback resumes. Only safe while the audio queue isn't running.
+static OSStatus rerenderStaleBuffers(AudioEngine *engine) {
+    bool anyStale = false;
+    for (unsigned int i = 0; i < engine->numBuffers; i++) {
+        anyStale = anyStale || atomic_load_explicit(&engine->bufferSeekSequences[i], memory_order_acquire) != engine->controlState.seekSequence;
+    }
+    if (!anyStale) {
+        return 0;
+    }
+    // The audio queue returns flushed buffers through the audio callback, possibly on its own thread, which hands them back here rather than rendering them.
+    for (unsigned int i = 0; i < engine->numBuffers; i++) {
+        atomic_store_explicit(&engine->bufferStates[i], BufferFlushing, memory_order_release);
+    }
+    OSStatus status = AudioQueueReset(engine->queue);
+    bool allReturned = false;
+    const uint64_t deadlineNanos = currentNanos() + FLUSH_TIMEOUT_NANOS;
+    while (status == 0 && !allReturned && currentNanos() <= deadlineNanos) {
+        allReturned = true;
+        for (unsigned int i = 0; i < engine->numBuffers; i++) {
+            allReturned = allReturned && atomic_load_explicit(&engine->bufferStates[i], memory_order_acquire) == BufferFlushed;
+        }
+        if (!allReturned) {
+            const struct timespec pause = { .tv_sec = 0, .tv_nsec = 100000 };
+            nanosleep(&pause, NULL);
+        }
+    }
+    if (status == 0 && !allReturned) {
+        // A buffer that hasn't come back could still be returned at any time and rendered twice. Stopping immediately waits for the audio callback and leaves nothing in flight.
+        status = AudioQueueStop(engine->queue, true);
+    }
+    for (unsigned int i = 0; i < engine->numBuffers; i++) {
+        atomic_store_explicit(&engine->bufferStates[i], BufferQueued, memory_order_release);
+    }
     if (status != 0) {
         return status;
     }
-    // Need to record this after pausing since audioCallback can still be called for a bit until the audio actually pauses.
-    sampleCounterOnPause = sampleCounter;
-    return status;
+    // None of the buffers are in the audio queue anymore, so they're all re-rendered from the new position.
+    for (unsigned int i = 0; i < engine->numBuffers; i++) {
+        fillBuffer(engine, engine->queue, engine->buffers[i], i);
+    }
+    return 0;
+}
+
+/// Reads the rendered frame being heard at the given time, extrapolated from the timeline anchor while playing, and the segment of the timeline it falls in. Returns false if nothing has been rendered.
+static bool readPlaybackTimeline(AudioEngine *engine, uint64_t nanos, int64_t *frame, PositionSegment *segment) {
+    const int64_t renderedFrames = engineGetRenderedFrames(engine);
+    const double sampleRate = engine->outputDesc.mSampleRate;
+    uint32_t sequence;
+    uint64_t numSegments;
+    do {
+        sequence = atomic_load_explicit(&engine->timeline.sequence, memory_order_acquire);
+        numSegments = engine->timeline.numSegments;
+        *frame = engine->timeline.anchorFrame;
+        if (engine->playing && nanos > engine->timeline.anchorNanos) {
+            *frame += (int64_t) ((double) (nanos - engine->timeline.anchorNanos) * 1e-9 * sampleRate);
+        }
+        // Never extrapolate past what has been rendered, such as when the audio callback is running late.
+        if (*frame > renderedFrames) {
+            *frame = renderedFrames;
+        }
+        // Find the latest segment starting at or before the frame, falling back to the oldest one kept.
+        const uint64_t oldestSegment = numSegments > TIMELINE_SEGMENTS ? numSegments - TIMELINE_SEGMENTS : 0;
+        uint64_t index = numSegments;
+        while (index > oldestSegment + 1 && engine->timeline.segments[(index - 1) % TIMELINE_SEGMENTS].renderedFrame > *frame) {
+            index--;
+        }
+        if (index > 0) {
+            *segment = engine->timeline.segments[(index - 1) % TIMELINE_SEGMENTS];
+        }
+        atomic_thread_fence(memory_order_acquire);
+    } while ((sequence & 1) || sequence != atomic_load_explicit(&engine->timeline.sequence, memory_order_relaxed));
+    return numSegments > 0;
+}
+
+OSStatus enginePlayAudio(AudioEngine *_Nonnull engine) {
+    if (engine->queue == NULL) {
+        return kAudio_ParamError;
+    }
+    // Send the parameter changes held back while paused, for the buffers about to be rendered to apply.
+    pushUnsentCommands(engine);
+    // The audio callback isn't running, and the gap since it last ran isn't an underrun.
+    engine->timings.lastEnqueueNanos = 0;
+    const int64_t framesBeforePriming = engineGetRenderedFrames(engine);
+    atomic_store_explicit(&engine->primingBuffers, true, memory_order_relaxed);
+    if (engine->paused) {
+        // Replace any buffers queued before a seek made during the pause, without a stop/start cycle.
+        OSStatus status = rerenderStaleBuffers(engine);
+        if (status != 0) {
+            atomic_store_explicit(&engine->primingBuffers, false, memory_order_relaxed);
+            return status;
+        }
+    } else {
+        // Preload the first set of audio data.
+        for (unsigned int i = 0; i < engine->numBuffers; i++) {
+            audioCallback(engine, engine->queue, engine->buffers[i]);
+        }
+    }
+    atomic_store_explicit(&engine->primingBuffers, false, memory_order_relaxed);
+    // Playback starts from the first buffer just rendered, or from where it paused if nothing was re-rendered.
+    const bool resumingQueuedBuffers = engine->paused && engineGetRenderedFrames(engine) == framesBeforePriming;
+    setTimelineAnchor(engine, resumingQueuedBuffers ? engine->timeline.anchorFrame : framesBeforePriming, currentNanos());
+    engine->playing = true;
+    engine->paused = false;
+    return AudioQueueStart(engine->queue, NULL);
 }
 
-OSStatus stopAudio() {
-    playing = false;
-    paused = false;
-    sampleCounterOnPause = -1;
-    OSStatus status = AudioQueueStop(queue, true);
+OSStatus enginePauseAudio(AudioEngine *_Nonnull engine) {
+    if (engine->queue == NULL) {
+        return kAudio_ParamError;
+    }
+    OSStatus status = AudioQueuePause(engine->queue);
     if (status != 0) {
         return status;
     }
-    sampleCounter = 0;
-    return status;
+    // Hold the position being heard where playback paused.
+    const uint64_t nowNanos = currentNanos();
+    int64_t pausedFrame;
+    PositionSegment segment;
+    if (readPlaybackTimeline(engine, nowNanos, &pausedFrame, &segment)) {
+        setTimelineAnchor(engine, pausedFrame, nowNanos);
+    }
+    engine->playing = false;
+    engine->paused = true;
+    return 0;
 }
 
-int64_t getSampleCounter(void) {
-    return sampleCounter / origAudioDesc.mChannelsPerFrame;
+OSStatus engineStopAudio(AudioEngine *_Nonnull engine) {
+    if (engine->queue != NULL) {
+        OSStatus status = AudioQueueStop(engine->queue, true);
+        if (status != 0) {
+            return status;
+        }
+    }
+    // Stopping immediately waits for the audio callback, so from here on commands are applied on the control thread. No flushed buffers are still on their way back either.
+    for (unsigned int i = 0; i < engine->numBuffers; i++) {
+        atomic_store_explicit(&engine->bufferStates[i], BufferQueued, memory_order_relaxed);
+    }
+    engine->playing = false;
+    engine->paused = false;
+    engineSetSampleCounter(engine, 0);
+    // Playback has stopped, so a queued track can't be handed off to anymore.
+    if (engine->controlState.queuedTrack.audioData != NULL) {
+        engineQueueAudio(engine, NULL, 0, engine->outputDesc, 0, 0, 0);
+    }
+    return 0;
 }
 
-int64_t getNumSamples(void) {
-    return numSamples / origAudioDesc.mChannelsPerFrame;
+int64_t engineGetSampleCounter(AudioEngine *_Nonnull engine) {
+    // Until the audio callback picks up the latest seek, the requested position is more accurate than the rendered one.
+    if (atomic_load_explicit(&engine->stateSnapshot.seekSequence, memory_order_acquire) != engine->controlState.seekSequence) {
+        return engine->controlState.sampleCounter / engine->controlState.track.channels;
+    }
+    return atomic_load_explicit(&engine->stateSnapshot.sampleCounter, memory_order_acquire);
 }
 
-int64_t getLoopStart(void) {
-    return loopStart / origAudioDesc.mChannelsPerFrame;
+int64_t engineGetNumSamples(AudioEngine *_Nonnull engine) {
+    return engine->controlState.track.numSamples / engine->controlState.track.channels;
 }
 
-int64_t getLoopEnd(void) {
-    return loopEnd / origAudioDesc.mChannelsPerFrame;
+int64_t engineGetLoopStart(AudioEngine *_Nonnull engine) {
+    return engine->controlState.loopStart / engine->controlState.track.channels;
 }
 
-bool getLoopPlayback(void) {
-    return loopPlayback;
+int64_t engineGetLoopEnd(AudioEngine *_Nonnull engine) {
+    return engine->controlState.loopEnd / engine->controlState.track.channels;
+}
+
+bool engineGetLoopPlayback(AudioEngine *_Nonnull engine) {
+    return engine->controlState.loopPlayback;
+}
+
+void engineGetRenderTelemetry(AudioEngine *_Nonnull engine, RenderTelemetry *_Nonnull telemetry) {
+    const RenderTelemetry *baseline = &engine->controlState.telemetryBaseline;
+    for (unsigned int i = 0; i < RENDER_TIMING_BUCKETS; i++) {
+        telemetry->histogram[i] = atomic_load_explicit(&engine->timings.histogram[i], memory_order_relaxed) - baseline->histogram[i];
+    }
+    telemetry->numCallbacks = atomic_load_explicit(&engine->timings.numCallbacks, memory_order_relaxed) - baseline->numCallbacks;
+    telemetry->numLateCallbacks = atomic_load_explicit(&engine->timings.numLateCallbacks, memory_order_relaxed) - baseline->numLateCallbacks;
+    telemetry->numUnderruns = atomic_load_explicit(&engine->timings.numUnderruns, memory_order_relaxed) - baseline->numUnderruns;
+    telemetry->totalRenderSeconds = (double) atomic_load_explicit(&engine->timings.totalNanos, memory_order_relaxed) * 1e-9 - baseline->totalRenderSeconds;
+    telemetry->maxRenderSeconds = (double) atomic_load_explicit(&engine->timings.maxNanos, memory_order_relaxed) * 1e-9;
+    telemetry->bufferSeconds = engine->outputDesc.mSampleRate > 0 ? (double) atomic_load_explicit(&engine->bufferFrames, memory_order_relaxed) / engine->outputDesc.mSampleRate : 0;
+}
+
+void engineResetRenderTelemetry(AudioEngine *_Nonnull engine) {
+    // Take the current counters as the new baseline.
+    engine->controlState.telemetryBaseline = (RenderTelemetry) { 0 };
+    RenderTelemetry current;
+    engineGetRenderTelemetry(engine, &current);
+    engine->controlState.telemetryBaseline = current;
+    atomic_store_explicit(&engine->timings.maxNanos, 0, memory_order_relaxed);
+}
+
+double engineGetRenderHeadroom(AudioEngine *_Nonnull engine) {
+    RenderTelemetry telemetry;
+    engineGetRenderTelemetry(engine, &telemetry);
+    if (telemetry.numCallbacks == 0 || telemetry.bufferSeconds <= 0) {
+        return 1;
+    }
+    return 1 - telemetry.maxRenderSeconds / telemetry.bufferSeconds;
+}
+
+int64_t engineGetRenderedFrames(AudioEngine *_Nonnull engine) {
+    return atomic_load_explicit(&engine->stateSnapshot.renderedFrames, memory_order_acquire);
+}
+
+void engineGetPlaybackPosition(AudioEngine *_Nonnull engine, PlaybackPosition *_Nonnull position) {
+    // Extrapolated from the time the audio queue last returned a buffer, and mapped back to a track position through the timeline of rendered audio, so the position follows loop wraps and handoffs as they are heard.
+    const uint64_t nowNanos = currentNanos();
+    position->timestamp = (double) nowNanos * 1e-9;
+    int64_t frame;
+    PositionSegment segment;
+    // While stopped, or until the audio callback picks up the latest seek, nothing queued will be heard, so the position rendering starts from is.
+    if ((!engine->playing && !engine->paused) || atomic_load_explicit(&engine->stateSnapshot.seekSequence, memory_order_acquire) != engine->controlState.seekSequence || !readPlaybackTimeline(engine, nowNanos, &frame, &segment)) {
+        position->sampleCounter = engineGetSampleCounter(engine);
+        position->renderedFrames = engineGetRenderedFrames(engine);
+        return;
+    }
+    // Advance through the segment, wrapping the way rendering does.
+    const int64_t segmentFrames = frame > segment.renderedFrame ? frame - segment.renderedFrame : 0;
+    int64_t trackFrame = segment.trackFrame + (int64_t) (((uint64_t) segmentFrames * segment.step) >> 32);
+    if (trackFrame >= segment.endFrame && segment.endFrame > segment.wrapFrame) {
+        trackFrame = segment.wrapFrame + (trackFrame - segment.endFrame) % (segment.endFrame - segment.wrapFrame);
+    }
+    // Right after a handoff, the previous track's last buffered frames are still playing through the filter.
+    if (trackFrame < 0) {
+        trackFrame = 0;
+    }
+    position->sampleCounter = trackFrame;
+    position->renderedFrames = frame;
+}
+
+int64_t engineGetHeldFrames(AudioEngine *_Nonnull engine) {
+    return atomic_load_explicit(&engine->stateSnapshot.heldFrames, memory_order_acquire);
+}
+
+int64_t engineGetLoopWraps(AudioEngine *_Nonnull engine) {
+    return atomic_load_explicit(&engine->stateSnapshot.loopWraps, memory_order_acquire);
+}
+
+UInt32 engineGetNumChannels(AudioEngine *_Nonnull engine) {
+    return engine->outputDesc.mChannelsPerFrame;
+}
+
+Float64 engineGetSampleRate(AudioEngine *_Nonnull engine) {
+    return engine->outputDesc.mSampleRate;
+}
+
+Float64 engineGetTrackSampleRate(AudioEngine *_Nonnull engine) {
+    const ResampleFilter *resampleFilter = engine->controlState.track.resampleFilter;
+    return resampleFilter != NULL ? resampleFilter->inputRate : engine->outputDesc.mSampleRate;
 }
 
 /// Checks if two audio stream descriptions are equal. Returns false if either description is null.
@@ -205,3 +1894,137 @@ bool areAudioDescsEqual(AudioStreamBasicDescription desc1, AudioStreamBasicDescr
         desc1.mReserved == desc2.mReserved &&
         desc1.mSampleRate == desc2.mSampleRate;
 }
+
+// Functions operating on the default engine.
+
+OSStatus loadAudio(void *_Nonnull newAudioData, int64_t newNumSamples, const AudioStreamBasicDescription dataAudioDesc) {
+    return engineLoadAudio(&defaultEngine, newAudioData, newNumSamples, dataAudioDesc);
+}
+
+void setDecodeProgress(DecodeProgress *_Nullable decodeProgress) {
+    engineSetDecodeProgress(&defaultEngine, decodeProgress);
+}
+
+void setSampleCounter(int64_t newSampleCounter) {
+    engineSetSampleCounter(&defaultEngine, newSampleCounter);
+}
+
+void setLoopPoints(int64_t newLoopStart, int64_t newLoopEnd) {
+    engineSetLoopPoints(&defaultEngine, newLoopStart, newLoopEnd);
+}
+
+void setBufferGeometry(UInt32 numBuffers, UInt32 minFrames, UInt32 maxFrames) {
+    engineSetBufferGeometry(&defaultEngine, numBuffers, minFrames, maxFrames);
+}
+
+void setOutputFormat(Float64 sampleRate, UInt32 numChannels) {
+    engineSetOutputFormat(&defaultEngine, sampleRate, numChannels);
+}
+
+void setLoopCrossfadeLength(int64_t newLoopCrossfadeLength) {
+    engineSetLoopCrossfadeLength(&defaultEngine, newLoopCrossfadeLength);
+}
+
+void setVolumeMultiplier(double newVolumeMultiplier) {
+    engineSetVolumeMultiplier(&defaultEngine, newVolumeMultiplier);
+}
+
+void rampGain(double targetGain, int64_t numFrames) {
+    engineRampGain(&defaultEngine, targetGain, numFrames);
+}
+
+void setLoopPlayback(bool newLoopPlayback) {
+    engineSetLoopPlayback(&defaultEngine, newLoopPlayback);
+}
+
+OSStatus queueAudio(void *_Nullable newAudioData, int64_t newNumSamples, const AudioStreamBasicDescription dataAudioDesc, int64_t startSample, int64_t newLoopStart, int64_t newLoopEnd) {
+    return engineQueueAudio(&defaultEngine, newAudioData, newNumSamples, dataAudioDesc, startSample, newLoopStart, newLoopEnd);
+}
+
+void startHandoff(int64_t crossfadeLength) {
+    engineStartHandoff(&defaultEngine, crossfadeLength);
+}
+
+bool finishHandoff(void) {
+    return engineFinishHandoff(&defaultEngine);
+}
+
+bool scheduleEvent(EngineEvent event) {
+    return engineScheduleEvent(&defaultEngine, event);
+}
+
+void cancelEvents(void) {
+    engineCancelEvents(&defaultEngine);
+}
+
+bool pollNotification(EngineNotification *_Nonnull notification) {
+    return enginePollNotification(&defaultEngine, notification);
+}
+
+bool takeNotificationsDropped(void) {
+    return engineTakeNotificationsDropped(&defaultEngine);
+}
+
+void setNotificationCallback(NotificationCallback _Nullable callback, void *_Nullable userData) {
+    engineSetNotificationCallback(&defaultEngine, callback, userData);
+}
+
+OSStatus playAudio(void) {
+    return enginePlayAudio(&defaultEngine);
+}
+
+OSStatus pauseAudio(void) {
+    return enginePauseAudio(&defaultEngine);
+}
+
+OSStatus stopAudio(void) {
+    return engineStopAudio(&defaultEngine);
+}
+
+int64_t getSampleCounter(void) {
+    return engineGetSampleCounter(&defaultEngine);
+}
+
+int64_t getNumSamples(void) {
+    return engineGetNumSamples(&defaultEngine);
+}
+
+int64_t getLoopStart(void) {
+    return engineGetLoopStart(&defaultEngine);
+}
+
+int64_t getLoopEnd(void) {
+    return engineGetLoopEnd(&defaultEngine);
+}
+
+bool getLoopPlayback(void) {
+    return engineGetLoopPlayback(&defaultEngine);
+}
+
+int64_t getRenderedFrames(void) {
+    return engineGetRenderedFrames(&defaultEngine);
+}
+
+int64_t getHeldFrames(void) {
+    return engineGetHeldFrames(&defaultEngine);
+}
+
+int64_t getLoopWraps(void) {
+    return engineGetLoopWraps(&defaultEngine);
+}
+
+void getPlaybackPosition(PlaybackPosition *_Nonnull position) {
+    engineGetPlaybackPosition(&defaultEngine, position);
+}
+
+void getRenderTelemetry(RenderTelemetry *_Nonnull telemetry) {
+    engineGetRenderTelemetry(&defaultEngine, telemetry);
+}
+
+void resetRenderTelemetry(void) {
+    engineResetRenderTelemetry(&defaultEngine);
+}
+
+double getRenderHeadroom(void) {
+    return engineGetRenderHeadroom(&defaultEngine);
+}
@@ -4,22 +4,240 @@
 #import <AudioToolbox/AudioToolbox.h>
 #import <CoreAudio/CoreAudioTypes.h>
 #import <CoreFoundation/CFRunLoop.h>
+#import "DecodeProgress.h"
 
-/// Loads 32-bit float audio samples and playback metadata into the player.
+/// A playback engine with its own audio data, playback parameters and audio queue. The functions that don't take an engine use a default engine shared by the app.
+typedef struct AudioEngine AudioEngine;
+
+/// Called on the audio thread at the end of a rendered buffer in which the engine posted notifications. Must not allocate or block. Notifications are read with pollNotification, typically after signalling the control thread.
+typedef void (*NotificationCallback)(void *_Nullable);
+
+/// What the position of a scheduled event counts.
+typedef enum EngineEventTrigger {
+    /// Frames rendered by the engine since it was created. Only advances while audio is rendered, so it is unaffected by seeks and loop wraps, and stands still while paused. Events that haven't fired are pushed back by the frames of silence rendered while playback holds for audio to decode, so they stay the same amount of playback away.
+    EventTriggerRenderedFrames,
+    /// Times playback of the current track has wrapped, either at the loop end or at the end of the audio data. Restarts from 0 when audio is loaded or handed off to.
+    EventTriggerLoopWraps
+} EngineEventTrigger;
+
+/// What the engine does when a scheduled event fires, besides posting a notification.
+typedef enum EngineEventAction {
+    /// Only posts a notification.
+    EventActionNotify,
+    /// Ramps the gain to the event's target gain over its number of frames, like rampGain.
+    EventActionRampGain,
+    /// Starts handing off to the queued track with the event's number of frames as the crossfade length, like startHandoff. Does nothing if no track is queued. A loop-wrap event without a crossfade switches tracks exactly at the wrap it is scheduled for.
+    EventActionHandoff
+} EngineEventAction;
+
+/// An action scheduled by the control thread for an exact position in playback, and performed by the audio callback.
+typedef struct EngineEvent {
+    EngineEventTrigger trigger;
+    /// Rendered frame or loop wrap count at which the event fires. An event scheduled for a position that has already passed fires at the start of the next buffer.
+    int64_t position;
+    EngineEventAction action;
+    /// Gain ramped towards by EventActionRampGain.
+    double targetGain;
+    /// Length in frames of the gain ramp or handoff crossfade.
+    int64_t numFrames;
+    /// Identifies the event in its notification.
+    uint32_t tag;
+} EngineEvent;
+
+/// The number of buckets in the render timing histogram.
+#define RENDER_TIMING_BUCKETS 20
+
+/// Timing statistics of the audio callback, for checking how close rendering comes to its deadline.
+typedef struct RenderTelemetry {
+    /// Callbacks counted by how long they took to render. Bucket 0 counts durations under 1 microsecond, and bucket i counts durations from 2^(i-1) up to 2^i microseconds. The last bucket also counts anything longer.
+    uint64_t histogram[RENDER_TIMING_BUCKETS];
+    uint64_t numCallbacks;
+    /// Callbacks that took longer to render than the duration of the audio they rendered.
+    uint64_t numLateCallbacks;
+    /// Estimated underruns: times more audio was enqueued later than all buffers' worth of audio after the previous enqueue, so the audio queue must have run dry.
+    uint64_t numUnderruns;
+    /// Total time spent rendering in seconds.
+    double totalRenderSeconds;
+    /// Longest time a callback took to render in seconds.
+    double maxRenderSeconds;
+    /// Duration of the audio in one buffer in seconds, which is the deadline for rendering it in steady state.
+    double bufferSeconds;
+} RenderTelemetry;
+
+/// Kinds of notifications posted by the audio callback.
+typedef enum EngineNotificationType {
+    /// A scheduled event fired.
+    NotificationEventFired,
+    /// Playback switched to the queued track. finishHandoff should be called.
+    NotificationTrackChanged,
+    /// The audio callback drained the command queue after parameter changes didn't fit in it. Polling sends them again.
+    NotificationCommandsDrained
+} EngineNotificationType;
+
+/// Something that happened in the audio callback, reported to the control thread.
+typedef struct EngineNotification {
+    EngineNotificationType type;
+    /// Tag of the event that fired. 0 for other notifications.
+    uint32_t tag;
+    /// Rendered frame at which the event fired. For track changes, the rendered frame at the start of the block in which playback switched.
+    int64_t renderedFrames;
+} EngineNotification;
+
+/// The position of the audio being heard at a moment in time.
+typedef struct PlaybackPosition {
+    /// The frame being heard within the audio data of the track it was rendered from.
+    int64_t sampleCounter;
+    /// The output frame being heard, counted like getRenderedFrames.
+    int64_t renderedFrames;
+    /// The monotonic time the position is for, in seconds.
+    double timestamp;
+} PlaybackPosition;
+
+/// Creates an engine. If playsAudio is false, the engine has no audio queue and only renders audio when audioCallback is called with it, which allows offline rendering and parallel tests alongside live playback. Returns NULL if memory can't be allocated.
+AudioEngine *_Nullable createAudioEngine(bool playsAudio);
+
+/// Disposes an engine and its audio queue. The default engine is never disposed.
+void disposeAudioEngine(AudioEngine *_Nonnull);
+
+/// Gets the engine used by the functions that don't take an engine.
+AudioEngine *_Nonnull getDefaultAudioEngine(void);
+
+/// Like loadAudio, for the given engine.
+OSStatus engineLoadAudio(AudioEngine *_Nonnull, void *_Nonnull, int64_t, AudioStreamBasicDescription);
+/// Like setDecodeProgress, for the given engine.
+void engineSetDecodeProgress(AudioEngine *_Nonnull, DecodeProgress *_Nullable);
+/// Like setSampleCounter, for the given engine.
+void engineSetSampleCounter(AudioEngine *_Nonnull, int64_t);
+/// Like setLoopPoints, for the given engine.
+void engineSetLoopPoints(AudioEngine *_Nonnull, int64_t, int64_t);
+/// Like setBufferGeometry, for the given engine.
+void engineSetBufferGeometry(AudioEngine *_Nonnull, UInt32, UInt32, UInt32);
+/// Like setOutputFormat, for the given engine. Engines that don't play audio render in the format of the loaded audio unless an output format is set.
+void engineSetOutputFormat(AudioEngine *_Nonnull, Float64, UInt32);
+/// Like setLoopCrossfadeLength, for the given engine.
+void engineSetLoopCrossfadeLength(AudioEngine *_Nonnull, int64_t);
+/// Like setVolumeMultiplier, for the given engine.
+void engineSetVolumeMultiplier(AudioEngine *_Nonnull, double);
+/// Like rampGain, for the given engine.
+void engineRampGain(AudioEngine *_Nonnull, double, int64_t);
+/// Like setLoopPlayback, for the given engine.
+void engineSetLoopPlayback(AudioEngine *_Nonnull, bool);
+/// Like queueAudio, for the given engine.
+OSStatus engineQueueAudio(AudioEngine *_Nonnull, void *_Nullable, int64_t, AudioStreamBasicDescription, int64_t, int64_t, int64_t);
+/// Like startHandoff, for the given engine.
+void engineStartHandoff(AudioEngine *_Nonnull, int64_t);
+/// Like finishHandoff, for the given engine.
+bool engineFinishHandoff(AudioEngine *_Nonnull);
+/// Like scheduleEvent, for the given engine.
+bool engineScheduleEvent(AudioEngine *_Nonnull, EngineEvent);
+/// Like cancelEvents, for the given engine.
+void engineCancelEvents(AudioEngine *_Nonnull);
+/// Like pollNotification, for the given engine.
+bool enginePollNotification(AudioEngine *_Nonnull, EngineNotification *_Nonnull);
+/// Like takeNotificationsDropped, for the given engine.
+bool engineTakeNotificationsDropped(AudioEngine *_Nonnull);
+/// Like setNotificationCallback, for the given engine.
+void engineSetNotificationCallback(AudioEngine *_Nonnull, NotificationCallback _Nullable, void *_Nullable);
+/// Like playAudio, for the given engine. Fails if the engine doesn't play audio or has no audio loaded.
+OSStatus enginePlayAudio(AudioEngine *_Nonnull);
+/// Like pauseAudio, for the given engine. Fails if the engine doesn't play audio or has no audio loaded.
+OSStatus enginePauseAudio(AudioEngine *_Nonnull);
+/// Like stopAudio, for the given engine.
+OSStatus engineStopAudio(AudioEngine *_Nonnull);
+/// Like getSampleCounter, for the given engine.
+int64_t engineGetSampleCounter(AudioEngine *_Nonnull);
+/// Like getNumSamples, for the given engine.
+int64_t engineGetNumSamples(AudioEngine *_Nonnull);
+/// Like getLoopStart, for the given engine.
+int64_t engineGetLoopStart(AudioEngine *_Nonnull);
+/// Like getLoopEnd, for the given engine.
+int64_t engineGetLoopEnd(AudioEngine *_Nonnull);
+/// Like getLoopPlayback, for the given engine.
+bool engineGetLoopPlayback(AudioEngine *_Nonnull);
+/// Like getRenderTelemetry, for the given engine.
+void engineGetRenderTelemetry(AudioEngine *_Nonnull, RenderTelemetry *_Nonnull);
+/// Like resetRenderTelemetry, for the given engine.
+void engineResetRenderTelemetry(AudioEngine *_Nonnull);
+/// Like getRenderHeadroom, for the given engine.
+double engineGetRenderHeadroom(AudioEngine *_Nonnull);
+/// Like getRenderedFrames, for the given engine.
+int64_t engineGetRenderedFrames(AudioEngine *_Nonnull);
+/// Like getHeldFrames, for the given engine.
+int64_t engineGetHeldFrames(AudioEngine *_Nonnull);
+/// Like getLoopWraps, for the given engine.
+int64_t engineGetLoopWraps(AudioEngine *_Nonnull);
+/// Like getPlaybackPosition, for the given engine.
+void engineGetPlaybackPosition(AudioEngine *_Nonnull, PlaybackPosition *_Nonnull);
+
+/// Loads interleaved audio samples and playback metadata into the player. Samples may be 32-bit float or 16/24-bit signed integer, and are converted to float during playback.
 OSStatus loadAudio(void *_Nonnull, int64_t, AudioStreamBasicDescription);
 
-/// Sets the index of the currently playing sample within the audio data.
+/// Attaches a map of the parts of the loaded audio decoded so far, so playback holds at audio that isn't decoded yet. The map must stay valid until audio is loaded or playback is handed off to a queued track, which must be fully decoded.
+void setDecodeProgress(DecodeProgress *_Nullable);
+
+/// Sets the index of the currently playing sample within the audio data. Like all setters, takes effect at the start of the next rendered buffer without blocking playback.
 void setSampleCounter(int64_t);
 
 /// Sets the points where the track will start and end looping.
 void setLoopPoints(int64_t, int64_t);
 
+/// Sets the number of audio queue buffers and the range of frames rendered into each, within which buffers adapt to rendering speed. 0 uses the default of 4 fixed buffers; a geometry that doesn't fit the existing buffers applies the next time audio is loaded.
+void setBufferGeometry(UInt32, UInt32, UInt32);
+
+/// Sets the sample rate and number of channels audio is played at, normally those of the output device, converting tracks in other formats while rendering. 0 uses the default of 44.1 kHz stereo, and changes take effect the next time audio is loaded.
+void setOutputFormat(Float64, UInt32);
+
+/// Sets the number of frames to crossfade over when playback wraps from the loop end to the loop start. 0 disables the crossfade. Takes effect the next time loop points are set.
+void setLoopCrossfadeLength(int64_t);
+
 /// Sets the multiplier used to alter the volume of the track.
 void setVolumeMultiplier(double);
 
+/// Ramps a gain applied on top of the volume multiplier linearly from its current value to the given target over the given number of frames. The gain is interpolated per frame while rendering, so fades are smooth and continue without the control thread. A length of 0 sets the gain immediately. The gain starts at 1.
+void rampGain(double, int64_t);
+
 /// Sets whether loop times are used to loop playback.
 void setLoopPlayback(bool);
 
+/// Queues a second track to be handed off to without a gap, starting from the given sample and using the given loop points. The audio may have any sample rate and channel count; it is converted to the output format while rendering. Passing NULL audio data cancels the queued track. The audio data must stay allocated until the handoff finishes or the queued track is replaced.
+OSStatus queueAudio(void *_Nullable, int64_t, AudioStreamBasicDescription, int64_t, int64_t, int64_t);
+
+/// Starts handing off to the queued track. With a crossfade length of 0 frames, playback switches at the next loop wrap; otherwise the current track crossfades into the queued track over that many frames.
+void startHandoff(int64_t);
+
+/// Makes the queued track the loaded audio once the audio callback has switched to it. Should be called on the control thread after a NotificationTrackChanged notification, before the old audio data is freed. Returns false if playback hasn't switched to the queued track, or if the switch was abandoned by loading other audio.
+bool finishHandoff(void);
+
+/// Schedules an event to be fired by the audio callback. Events keyed to rendered frames fire on their exact frame, even in the middle of a buffer. Up to 16 events can be pending at once; further events are dropped. Returns false if the event can't be scheduled because too many events are still waiting to be sent to the audio callback.
+bool scheduleEvent(EngineEvent);
+
+/// Cancels all scheduled events that haven't fired yet. Actions that have already started, such as a gain ramp, continue.
+void cancelEvents(void);
+
+/// Reads the oldest notification posted by the audio callback, first sending any parameter changes that didn't fit in the command queue. Returns false if there are none. Notifications are dropped if they aren't read before 64 more are posted.
+bool pollNotification(EngineNotification *_Nonnull);
+
+/// Returns true if notifications were dropped because they weren't read in time since the last call, and clears the flag.
+bool takeNotificationsDropped(void);
+
+/// Sets the function called after the audio callback posts notifications, and the pointer passed to it.
+void setNotificationCallback(NotificationCallback _Nullable, void *_Nullable);
+
+/// Renders the given number of frames of an engine's audio as interleaved 32-bit float, applying pending parameter changes first. Uses the same render path as playback, so rendering is deterministic for the same audio and parameters. Used for offline rendering; must not be called while the engine is playing.
+void engineRender(AudioEngine *_Nonnull, float *_Nonnull, int64_t);
+
+/// Gets the number of channels an engine renders.
+UInt32 engineGetNumChannels(AudioEngine *_Nonnull);
+
+/// Gets the sample rate an engine renders at.
+Float64 engineGetSampleRate(AudioEngine *_Nonnull);
+
+/// Gets the sample rate of the audio loaded into an engine, which is resampled to the rate the engine renders at if they differ.
+Float64 engineGetTrackSampleRate(AudioEngine *_Nonnull);
+
+/// Fills an audio buffer with the next audio samples of the engine passed as the first argument, and enqueues it on the given audio queue. If the engine is NULL, the default engine is used. If the queue is NULL, the buffer is only filled.
+void audioCallback(void *_Nullable, AudioQueueRef _Nullable, AudioQueueBufferRef _Nonnull);
+
 /// Starts playing the loaded audio.
 OSStatus playAudio(void);
 
@@ -44,4 +262,25 @@ int64_t getLoopEnd(void);
 /// Gets whether loop times are used to loop playback.
 bool getLoopPlayback(void);
 
+/// Gets the number of frames rendered since the engine was created, as of the last rendered buffer. Used as the time base for scheduled events.
+int64_t getRenderedFrames(void);
+
+/// Gets the number of frames of silence rendered while playback held for audio to decode, as of the last rendered buffer. Pending events keyed to rendered frames have been pushed back by every frame held since they were scheduled.
+int64_t getHeldFrames(void);
+
+/// Gets the number of times playback of the current track has wrapped, as of the last rendered buffer.
+int64_t getLoopWraps(void);
+
+/// Gets the position of the audio being heard right now, which lags behind getSampleCounter by the buffers queued for playback. Lock-free and cheap enough to poll at display rate.
+void getPlaybackPosition(PlaybackPosition *_Nonnull);
+
+/// Gets timing statistics of the audio callback since the engine was created or the statistics were last reset. Collecting them is lock-free and doesn't block the audio callback.
+void getRenderTelemetry(RenderTelemetry *_Nonnull);
+
+/// Resets the timing statistics of the audio callback.
+void resetRenderTelemetry(void);
+
+/// Gets the fraction of a buffer's duration left over by the slowest callback since the statistics were last reset. Negative if a callback missed its deadline; 1 if nothing has been rendered.
+double getRenderHeadroom(void);
+
 #endif
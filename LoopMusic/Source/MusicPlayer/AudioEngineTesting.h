@@ -0,0 +1,11 @@
+#ifndef AudioEngineTesting_h
+#define AudioEngineTesting_h
+
+#import <CoreAudio/CoreAudioTypes.h>
+#import <stdbool.h>
+#import <stdint.h>
+
+/// Gets the number of frames to render into each buffer after a callback, clamped to [minFrames, maxFrames]. Exposed so tests can check how adaptive buffers grow and shrink.
+UInt32 nextBufferFrames(UInt32 frames, UInt32 minFrames, UInt32 maxFrames, UInt32 *_Nonnull calmCallbacks, uint64_t renderNanos, uint64_t bufferNanos, bool underrun);
+
+#endif /* AudioEngineTesting_h */
@@ -0,0 +1,119 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#import <Accelerate/Accelerate.h>
+#import "AudioExport.h"
+
+/// The number of frames rendered and written at a time.
+#define EXPORT_BLOCK_FRAMES 4096
+/// The size of a WAV header with a RIFF chunk, a 16-byte format chunk and a data chunk header.
+#define WAV_HEADER_SIZE 44
+/// WAV format tag for IEEE floating point samples.
+#define WAVE_FORMAT_IEEE_FLOAT 3
+
+/// Writes an unsigned integer of the given number of bytes in little-endian order.
+static void writeLittleEndian(UInt8 *_Nonnull out, uint64_t value, int numBytes) {
+    for (int i = 0; i < numBytes; i++) {
+        out[i] = (UInt8) (value >> (8 * i));
+    }
+}
+
+/// Writes a WAV header for 32-bit float audio with the given format and data size.
+static bool writeWavHeader(FILE *_Nonnull file, UInt32 numChannels, UInt32 sampleRate, uint64_t dataSize) {
+    UInt8 header[WAV_HEADER_SIZE];
+    const UInt32 bytesPerFrame = numChannels * sizeof(float);
+    memcpy(header, "RIFF", 4);
+    writeLittleEndian(header + 4, WAV_HEADER_SIZE - 8 + dataSize, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    writeLittleEndian(header + 16, 16, 4);
+    writeLittleEndian(header + 20, WAVE_FORMAT_IEEE_FLOAT, 2);
+    writeLittleEndian(header + 22, numChannels, 2);
+    writeLittleEndian(header + 24, sampleRate, 4);
+    writeLittleEndian(header + 28, (uint64_t) sampleRate * bytesPerFrame, 4);
+    writeLittleEndian(header + 32, bytesPerFrame, 2);
+    writeLittleEndian(header + 34, 8 * sizeof(float), 2);
+    memcpy(header + 36, "data", 4);
+    writeLittleEndian(header + 40, dataSize, 4);
+    return fseek(file, 0, SEEK_SET) == 0 && fwrite(header, 1, WAV_HEADER_SIZE, file) == WAV_HEADER_SIZE;
+}
+
+/// Gets the current time in seconds from a monotonic clock.
+static double currentTimeSeconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+/// Applies the part of a linear fade-out that falls within a block of interleaved frames. fadeStartFrame is the index of the first frame of the fade relative to the start of the block, and may be negative if the fade started in an earlier block.
+static void applyFadeOut(float *_Nonnull data, int64_t numFrames, UInt32 numChannels, int64_t fadeStartFrame, int64_t fadeFrames) {
+    const int64_t firstFrame = fadeStartFrame > 0 ? fadeStartFrame : 0;
+    if (firstFrame >= numFrames) {
+        return;
+    }
+    const float step = -1.0f / (float) fadeFrames;
+    for (UInt32 c = 0; c < numChannels; c++) {
+        float gain = 1 - (float) (firstFrame - fadeStartFrame) / (float) fadeFrames;
+        vDSP_vrampmul(data + firstFrame * numChannels + c, numChannels, &gain, &step, data + firstFrame * numChannels + c, numChannels, numFrames - firstFrame);
+    }
+}
+
+OSStatus exportLoopedAudio(AudioEngine *_Nonnull engine, const char *_Nonnull path, int64_t loopCount, int64_t fadeOutFrames, double *_Nullable realtimeMultiple) {
+    const UInt32 numChannels = engineGetNumChannels(engine);
+    if (numChannels == 0) {
+        return kAudio_ParamError;
+    }
+    const int64_t loopStart = engineGetLoopStart(engine);
+    // Playback wraps at the end of the audio data if the loop end is past it.
+    const int64_t numFrames = engineGetNumSamples(engine);
+    const int64_t loopEnd = engineGetLoopEnd(engine) < numFrames ? engineGetLoopEnd(engine) : numFrames;
+    if (loopEnd <= loopStart || loopCount < 1 || fadeOutFrames < 0) {
+        return kAudio_ParamError;
+    }
+    // Loop points and the fade-out are in frames of the loaded audio, but the engine renders frames at its own rate.
+    const double outputFramesPerTrackFrame = engineGetSampleRate(engine) / engineGetTrackSampleRate(engine);
+    fadeOutFrames = llround((double) fadeOutFrames * outputFramesPerTrackFrame);
+    const int64_t totalFrames = llround((double) (loopStart + loopCount * (loopEnd - loopStart)) * outputFramesPerTrackFrame) + fadeOutFrames;
+    const uint64_t dataSize = (uint64_t) totalFrames * numChannels * sizeof(float);
+    // WAV sizes are 32-bit.
+    if (dataSize > UINT32_MAX - WAV_HEADER_SIZE) {
+        return kAudio_ParamError;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return kAudio_FileNotFoundError;
+    }
+    float *block = malloc(EXPORT_BLOCK_FRAMES * numChannels * sizeof(float));
+    if (block == NULL) {
+        fclose(file);
+        return kAudio_MemFullError;
+    }
+
+    const double startTime = currentTimeSeconds();
+    engineSetLoopPlayback(engine, true);
+    engineSetSampleCounter(engine, 0);
+    OSStatus status = writeWavHeader(file, numChannels, (UInt32) engineGetSampleRate(engine), dataSize) ? 0 : kAudioFileUnspecifiedError;
+    for (int64_t frame = 0; frame < totalFrames && status == 0; frame += EXPORT_BLOCK_FRAMES) {
+        const int64_t blockFrames = totalFrames - frame < EXPORT_BLOCK_FRAMES ? totalFrames - frame : EXPORT_BLOCK_FRAMES;
+        engineRender(engine, block, blockFrames);
+        if (fadeOutFrames > 0) {
+            applyFadeOut(block, blockFrames, numChannels, totalFrames - fadeOutFrames - frame, fadeOutFrames);
+        }
+        // WAV samples are little-endian, which matches every platform the app runs on.
+        if (fwrite(block, sizeof(float) * numChannels, blockFrames, file) != (size_t) blockFrames) {
+            status = kAudioFileUnspecifiedError;
+        }
+    }
+    if (fclose(file) != 0 && status == 0) {
+        status = kAudioFileUnspecifiedError;
+    }
+    free(block);
+
+    if (status == 0 && realtimeMultiple != NULL) {
+        const double elapsedTime = currentTimeSeconds() - startTime;
+        *realtimeMultiple = (double) totalFrames / engineGetSampleRate(engine) / elapsedTime;
+    }
+    return status;
+}
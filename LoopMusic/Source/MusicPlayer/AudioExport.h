@@ -0,0 +1,9 @@
+#ifndef AudioExport_h
+#define AudioExport_h
+
+#import "AudioEngine.h"
+
+/// Renders the audio loaded into an engine from the start, through the intro and the given number of loop repetitions, then fades out over the given number of frames of the loaded audio and writes the result to a 32-bit float WAV file at the given path, at the engine's sample rate. Audio is rendered and written in fixed-size blocks, so memory use doesn't depend on the length of the render. The engine's playback position and loop playback setting are changed, so the engine should not be one that is playing. If the last argument isn't NULL, it's set to the duration of the rendered audio divided by the time taken to render and write it.
+OSStatus exportLoopedAudio(AudioEngine *_Nonnull, const char *_Nonnull, int64_t, int64_t, double *_Nullable);
+
+#endif /* AudioExport_h */
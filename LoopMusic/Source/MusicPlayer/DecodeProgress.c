@@ -0,0 +1,180 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#import "DecodeProgress.h"
+
+/// The number of decode requests kept at once. Older requests are overwritten by newer ones.
+#define DECODE_REQUEST_SLOTS 8
+/// Stored in a request slot that holds no request.
+#define NO_REQUEST UINT64_MAX
+
+/// Decoding state of a chunk.
+typedef enum ChunkState {
+    ChunkPending,
+    ChunkClaimed,
+    ChunkDecoded
+} ChunkState;
+
+struct DecodeProgress {
+    /// Frames before this were decoded before the map was created.
+    int64_t firstFrame;
+    /// The frame just past the end of the track.
+    int64_t numFrames;
+    int64_t chunkFrames;
+    uint32_t numChunks;
+    /// True once decoding has been cancelled.
+    _Atomic bool cancelled;
+    /// The next chunk to claim in order. Chunks before it have all been claimed.
+    _Atomic uint32_t nextChunk;
+    /// The number of chunks decoded so far.
+    _Atomic uint32_t numDecodedChunks;
+    /// Ring of requested chunk ranges, each packed as the first chunk in the high 32 bits and the last chunk in the low 32 bits.
+    _Atomic uint64_t requests[DECODE_REQUEST_SLOTS];
+    /// The total number of requests made.
+    _Atomic uint32_t numRequests;
+    /// ChunkState of each chunk.
+    _Atomic uint8_t chunkStates[];
+};
+
+DecodeProgress *createDecodeProgress(int64_t firstFrame, int64_t numFrames, int64_t chunkFrames) {
+    if (chunkFrames <= 0) {
+        return NULL;
+    }
+    const int64_t framesToDecode = numFrames > firstFrame ? numFrames - firstFrame : 0;
+    const uint32_t numChunks = (uint32_t) ((framesToDecode + chunkFrames - 1) / chunkFrames);
+    DecodeProgress *progress = malloc(sizeof(DecodeProgress) + numChunks * sizeof(_Atomic uint8_t));
+    if (progress == NULL) {
+        return NULL;
+    }
+    progress->firstFrame = firstFrame;
+    progress->numFrames = numFrames > firstFrame ? numFrames : firstFrame;
+    progress->chunkFrames = chunkFrames;
+    progress->numChunks = numChunks;
+    atomic_init(&progress->cancelled, false);
+    atomic_init(&progress->nextChunk, 0);
+    atomic_init(&progress->numDecodedChunks, 0);
+    for (uint32_t i = 0; i < DECODE_REQUEST_SLOTS; i++) {
+        atomic_init(&progress->requests[i], NO_REQUEST);
+    }
+    atomic_init(&progress->numRequests, 0);
+    for (uint32_t i = 0; i < numChunks; i++) {
+        atomic_init(&progress->chunkStates[i], ChunkPending);
+    }
+    return progress;
+}
+
+void disposeDecodeProgress(DecodeProgress *progress) {
+    free(progress);
+}
+
+uint32_t getNumDecodeChunks(const DecodeProgress *progress) {
+    return progress->numChunks;
+}
+
+int64_t getDecodeChunkStart(const DecodeProgress *progress, uint32_t chunk) {
+    return progress->firstFrame + chunk * progress->chunkFrames;
+}
+
+int64_t getDecodeChunkEnd(const DecodeProgress *progress, uint32_t chunk) {
+    const int64_t endFrame = getDecodeChunkStart(progress, chunk) + progress->chunkFrames;
+    return endFrame < progress->numFrames ? endFrame : progress->numFrames;
+}
+
+/// Claims a chunk if no other worker has claimed it yet.
+static bool tryClaimChunk(DecodeProgress *progress, uint32_t chunk) {
+    if (atomic_load_explicit(&progress->chunkStates[chunk], memory_order_relaxed) != ChunkPending) {
+        return false;
+    }
+    uint8_t expected = ChunkPending;
+    return atomic_compare_exchange_strong_explicit(&progress->chunkStates[chunk], &expected, ChunkClaimed, memory_order_relaxed, memory_order_relaxed);
+}
+
+bool claimDecodeChunk(DecodeProgress *progress, uint32_t *chunk) {
+    if (isDecodeCancelled(progress)) {
+        return false;
+    }
+    // Requested chunks come first, most recent request first.
+    const uint32_t numRequests = atomic_load_explicit(&progress->numRequests, memory_order_acquire);
+    for (uint32_t i = 0; i < DECODE_REQUEST_SLOTS && i < numRequests; i++) {
+        const uint64_t request = atomic_load_explicit(&progress->requests[(numRequests - 1 - i) % DECODE_REQUEST_SLOTS], memory_order_relaxed);
+        if (request == NO_REQUEST) {
+            continue;
+        }
+        const uint32_t lastChunk = (uint32_t) request < progress->numChunks ? (uint32_t) request : progress->numChunks - 1;
+        for (uint32_t c = (uint32_t) (request >> 32); c <= lastChunk; c++) {
+            if (tryClaimChunk(progress, c)) {
+                *chunk = c;
+                return true;
+            }
+        }
+    }
+    // Then everything else in order, skipping chunks already claimed for requests.
+    for (uint32_t c = atomic_fetch_add_explicit(&progress->nextChunk, 1, memory_order_relaxed); c < progress->numChunks; c = atomic_fetch_add_explicit(&progress->nextChunk, 1, memory_order_relaxed)) {
+        if (tryClaimChunk(progress, c)) {
+            *chunk = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+void finishDecodeChunk(DecodeProgress *progress, uint32_t chunk) {
+    // Release, so readers that see the chunk as decoded also see its audio.
+    atomic_store_explicit(&progress->chunkStates[chunk], ChunkDecoded, memory_order_release);
+    atomic_fetch_add_explicit(&progress->numDecodedChunks, 1, memory_order_release);
+}
+
+bool isDecodeFinished(const DecodeProgress *progress) {
+    return atomic_load_explicit(&((DecodeProgress*) progress)->numDecodedChunks, memory_order_acquire) == progress->numChunks;
+}
+
+/// Finds the chunks covering a range of frames. Returns false if none of the range needs decoding.
+static bool chunksInFrameRange(const DecodeProgress *progress, int64_t startFrame, int64_t endFrame, uint32_t *firstChunk, uint32_t *lastChunk) {
+    if (startFrame < progress->firstFrame) {
+        startFrame = progress->firstFrame;
+    }
+    if (endFrame > progress->numFrames) {
+        endFrame = progress->numFrames;
+    }
+    if (startFrame >= endFrame) {
+        return false;
+    }
+    *firstChunk = (uint32_t) ((startFrame - progress->firstFrame) / progress->chunkFrames);
+    *lastChunk = (uint32_t) ((endFrame - 1 - progress->firstFrame) / progress->chunkFrames);
+    return true;
+}
+
+bool isFrameRangeDecoded(const DecodeProgress *progress, int64_t startFrame, int64_t endFrame) {
+    uint32_t firstChunk, lastChunk;
+    if (!chunksInFrameRange(progress, startFrame, endFrame, &firstChunk, &lastChunk)) {
+        return true;
+    }
+    for (uint32_t c = firstChunk; c <= lastChunk; c++) {
+        if (atomic_load_explicit(&((DecodeProgress*) progress)->chunkStates[c], memory_order_acquire) != ChunkDecoded) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void requestDecodeFrames(DecodeProgress *progress, int64_t startFrame, int64_t endFrame) {
+    uint32_t firstChunk, lastChunk;
+    if (!chunksInFrameRange(progress, startFrame, endFrame, &firstChunk, &lastChunk)) {
+        return;
+    }
+    const uint64_t request = (uint64_t) firstChunk << 32 | lastChunk;
+    // Repeating the most recent request would only push older ones out.
+    const uint32_t numRequests = atomic_load_explicit(&progress->numRequests, memory_order_relaxed);
+    if (numRequests > 0 && atomic_load_explicit(&progress->requests[(numRequests - 1) % DECODE_REQUEST_SLOTS], memory_order_relaxed) == request) {
+        return;
+    }
+    const uint32_t slot = atomic_fetch_add_explicit(&progress->numRequests, 1, memory_order_relaxed);
+    atomic_store_explicit(&progress->requests[slot % DECODE_REQUEST_SLOTS], request, memory_order_release);
+}
+
+void cancelDecode(DecodeProgress *progress) {
+    atomic_store_explicit(&progress->cancelled, true, memory_order_relaxed);
+}
+
+bool isDecodeCancelled(const DecodeProgress *progress) {
+    return atomic_load_explicit(&((DecodeProgress*) progress)->cancelled, memory_order_relaxed);
+}
@@ -0,0 +1,46 @@
+#ifndef DecodeProgress_h
+#define DecodeProgress_h
+
+#import <CoreAudioTypes/CoreAudioTypes.h>
+#include <stdbool.h>
+
+/// Map of which parts of a track have been decoded, shared by the workers decoding it and the audio engine playing it. The frames still to decode are split into fixed-size chunks, each claimed and decoded by a single worker into its own slice of the audio buffer, so the map is updated and read without locks. Chunks around requested frames are claimed first, and the rest in order.
+typedef struct DecodeProgress DecodeProgress;
+
+/// Creates a map for decoding the frames from the first frame up to the given number of frames, in chunks of the given number of frames. Frames before the first frame are treated as already decoded. Returns NULL if memory can't be allocated.
+DecodeProgress *_Nullable createDecodeProgress(int64_t firstFrame, int64_t numFrames, int64_t chunkFrames);
+
+/// Frees a decode map. Must only be called once no worker or audio engine is using it.
+void disposeDecodeProgress(DecodeProgress *_Nonnull);
+
+/// Gets the number of chunks left to decode when the map was created.
+uint32_t getNumDecodeChunks(const DecodeProgress *_Nonnull);
+
+/// Gets the first frame of a chunk.
+int64_t getDecodeChunkStart(const DecodeProgress *_Nonnull, uint32_t);
+
+/// Gets the frame just past the end of a chunk.
+int64_t getDecodeChunkEnd(const DecodeProgress *_Nonnull, uint32_t);
+
+/// Claims the next chunk to decode for the calling worker: the first undecoded chunk of the most recent request still waiting, or else the first unclaimed chunk in order. Returns false once every chunk has been claimed, or if decoding has been cancelled.
+bool claimDecodeChunk(DecodeProgress *_Nonnull, uint32_t *_Nonnull);
+
+/// Marks a claimed chunk as decoded. Also called if decoding the chunk failed, so nothing waits on it forever.
+void finishDecodeChunk(DecodeProgress *_Nonnull, uint32_t);
+
+/// Checks whether every chunk has been decoded.
+bool isDecodeFinished(const DecodeProgress *_Nonnull);
+
+/// Checks whether every frame from the given start frame up to the given end frame has been decoded. Frames outside the map count as decoded.
+bool isFrameRangeDecoded(const DecodeProgress *_Nonnull, int64_t, int64_t);
+
+/// Asks for the frames from the given start frame up to the given end frame to be decoded before anything else. Lock-free, so it can be called from the audio callback. Only the most recent requests are kept.
+void requestDecodeFrames(DecodeProgress *_Nonnull, int64_t, int64_t);
+
+/// Asks every worker to stop claiming chunks.
+void cancelDecode(DecodeProgress *_Nonnull);
+
+/// Checks whether decoding has been cancelled.
+bool isDecodeCancelled(const DecodeProgress *_Nonnull);
+
+#endif /* DecodeProgress_h */
@@ -0,0 +1,53 @@
+import Foundation
+
+/// Time spent in each phase of loading a track into the music player, in seconds. Phases are timed back to back, so they add up to the time from starting the load to starting playback.
+class LoadTimings {
+
+    /// Names and key paths of every phase, in the order they happen.
+    static let PHASES: [(name: String, keyPath: KeyPath<LoadTimings, Double>)] = [
+        ("stop", \.stop),
+        ("lookup", \.lookup),
+        ("open", \.open),
+        ("fileSetup", \.fileSetup),
+        ("allocate", \.allocate),
+        ("initialRead", \.initialRead),
+        ("engineLoad", \.engineLoad),
+        ("start", \.start)
+    ]
+
+    /// Stopping the previous track and freeing its audio.
+    var stop: Double = 0
+    /// Looking up the track's settings in the database.
+    var lookup: Double = 0
+    /// Opening the audio file.
+    var open: Double = 0
+    /// Reading the length and format of the audio file, removing priming frames from its packet table and setting the decoded format.
+    var fileSetup: Double = 0
+    /// Allocating or mapping the audio buffer.
+    var allocate: Double = 0
+    /// Decoding the audio played before the rest is decoded in the background.
+    var initialRead: Double = 0
+    /// Loading the audio into the audio engine.
+    var engineLoad: Double = 0
+    /// Updating the track history and loop points, starting the background decode and starting playback.
+    var start: Double = 0
+
+    /// Uptime at the end of the last timed phase, in nanoseconds.
+    private var phaseStart: UInt64 = DispatchTime.now().uptimeNanoseconds
+
+    /// Time from starting the load to starting playback.
+    var total: Double {
+        get {
+            return LoadTimings.PHASES.reduce(0) { $0 + self[keyPath: $1.keyPath] }
+        }
+    }
+
+    /// Adds the time since the last phase ended to the given phase.
+    /// - parameter phase: The phase that just ended.
+    func endPhase(_ phase: ReferenceWritableKeyPath<LoadTimings, Double>) {
+        /// Current uptime in nanoseconds.
+        let now: UInt64 = DispatchTime.now().uptimeNanoseconds
+        self[keyPath: phase] += Double(now - phaseStart) / 1e9
+        phaseStart = now
+    }
+}
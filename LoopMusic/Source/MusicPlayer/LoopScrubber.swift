@@ -3,18 +3,8 @@ import UIKit
 /// Scrubber for controlling playback position.
 class LoopScrubber: UISlider {
 
-    /// The amount of time (seconds) between each slider position update.
-    static let PLAYBACK_TIMER_INTERVAL: Double = 0.2
-    /// The amount of time (seconds) between each slider position update if the loop point is near.
-    static let PLAYBACK_TIMER_INTERVAL_FAST: Double = 1e-3
-    /// The timer will switch to fast mode when the loop point is within this amount of time, as a multiple of the normal timer interval.
-    static let INTERVAL_THRESHOLD: Double = 1.5
-
-    /// Whether or not the timer is in fast mode.
-    private var fastMode: Bool = false
-    
-    /// Timer used to update the slider position as audio playback progresses.
-    private var playbackTimer: Timer?
+    /// Display link used to update the slider position once per frame as audio playback progresses.
+    private var displayLink: CADisplayLink?
     
     /// Renders the rectangle marking the looped portion of the track.
     private var loopBox: UIView?
@@ -50,42 +40,20 @@ class LoopScrubber: UISlider {
     
     /// Starts the slider update loop when a track starts.
     func playTrack() {
-        self.startTimer()
+        self.startDisplayLink()
         self.isEnabled = true
     }
     
-    /// Updates the slider value with the current playback time.
-    func updateValue() {
-        value = Float(MusicPlayer.player.sampleCounter) / Float(MusicPlayer.player.numSamples)
-    }
-
-    /// Checks whether playback is within the fast-mode threshold.
-    private func withinFastModeThreshold() -> Bool {
-        return MusicPlayer.player.loopPlayback && MusicPlayer.player.loopEndSeconds - MusicPlayer.player.playbackTimeSeconds <= LoopScrubber.INTERVAL_THRESHOLD*LoopScrubber.PLAYBACK_TIMER_INTERVAL
+    /// Updates the slider value with the position being heard. The position is extrapolated by the audio engine, so it's smooth and follows loop wraps as they're heard.
+    @objc func updateValue() {
+        value = Float(MusicPlayer.player.audibleSampleCounter) / Float(MusicPlayer.player.numSamples)
     }
 
     /// Starts the slider update loop.
-    func startTimer() {
-        if self.playbackTimer == nil {
-            if fastMode {
-                self.playbackTimer = Timer.scheduledTimer(withTimeInterval: LoopScrubber.self.PLAYBACK_TIMER_INTERVAL_FAST, repeats: true) { [weak self] _ in
-                    self?.updateValue()
-                    if let inThreshold = self?.withinFastModeThreshold(), !inThreshold {
-                        self?.fastMode = false
-                        self?.unload()
-                        self?.startTimer()
-                    }
-                }
-            } else {
-                self.playbackTimer = Timer.scheduledTimer(withTimeInterval: LoopScrubber.self.PLAYBACK_TIMER_INTERVAL, repeats: true) { [weak self] _ in
-                    self?.updateValue()
-                    if let inThreshold = self?.withinFastModeThreshold(), inThreshold {
-                        self?.fastMode = true
-                        self?.unload()
-                        self?.startTimer()
-                    }
-                }
-            }
+    func startDisplayLink() {
+        if self.displayLink == nil {
+            self.displayLink = CADisplayLink(target: self, selector: #selector(updateValue))
+            self.displayLink?.add(to: .main, forMode: .common)
         }
     }
     
@@ -118,16 +86,16 @@ class LoopScrubber: UISlider {
         self.value = 0
     }
     
-    /// Invalidates the playback timer before unloading the view.
+    /// Invalidates the display link before unloading the view.
     func unload() {
-        self.playbackTimer?.invalidate()
-        self.playbackTimer = nil
+        self.displayLink?.invalidate()
+        self.displayLink = nil
     }
     
-    /// Starts the update timer again after resuming the app.
+    /// Starts the update loop again after resuming the app.
     func resume() {
         if self.isEnabled {
-            self.startTimer()
+            self.startDisplayLink()
         }
     }
 }
@@ -5,17 +5,28 @@ import MediaPlayer
 /// Handles playback and looping of music tracks.
 class MusicPlayer {
     
-    /// The default number of samples to be read from an audio file when loading the initial portion of audio.
+    /// The default number of frames to be read from an audio file when loading the initial portion of audio, before playback starts.
     static let START_READ_SAMPLES: Int = 1048576
-    /// The number of samples to be read from an audio file each time it is read from asynchronously.
+    /// The number of frames to be read from an audio file by each read call while decoding in the background.
     static let SAMPLE_READ_INCREMENT: Int = 131072
-    
-    /// The amount of time (seconds) between each volume decrement when fading out.
-    static let FADE_DECREMENT_TIME: Double = 0.1
+    /// The number of upcoming shuffle tracks predicted and decoded ahead of time.
+    static let PREFETCH_DEPTH: Int = 2
 
     /// The threshold time (seconds) for playback before which rewinding will try to play the previous track, and after which rewinding will just reset the current playback. This is 3 seconds in Apple Music 1.0.5.14.
     static let REWIND_THRESHOLD_TIME: Double = 3
 
+    /// The number of audio engine buffers used in rotation during playback.
+    static let NUM_BUFFERS: UInt32 = 4
+    /// The fewest frames rendered into each audio engine buffer while in the foreground. Buffers shrink towards this while rendering keeps up, so seeks and loop edits are heard quickly.
+    static let MIN_FOREGROUND_BUFFER_FRAMES: UInt32 = 512
+    /// The most frames rendered into each audio engine buffer. Buffers are always this large in the background to save power.
+    static let MAX_BUFFER_FRAMES: UInt32 = 4096
+
+    /// Tag of audio engine events that start shuffling away from the current track.
+    static let SHUFFLE_EVENT_TAG: UInt32 = 1
+    /// Tag of the audio engine event that fires once the current track has faded out and the next track should be loaded.
+    static let LOAD_NEXT_EVENT_TAG: UInt32 = 2
+
     /// Singleton instance.
     static let player: MusicPlayer = MusicPlayer()
     
@@ -32,39 +43,56 @@ class MusicPlayer {
     /// True if the player is paused because of an interrupt.
     private(set) var interrupted: Bool = false
 
-    /// Timer used to shuffle tracks after playing for a while.
-    private var shuffleTimer: Timer?
-    /// Time remaining for the shuffle timer if it was paused.
-    private var shuffleTimeRemaining: TimeInterval?
-
-    /// Timer used to fade out tracks before shuffling them.
-    private var fadeTimer: Timer?
+    /// Rendered frame of the audio engine at which shuffling away from the current track starts, or nil if no shuffle is scheduled. Rendered frames only advance while audio plays, so the schedule pauses along with playback.
+    private var shuffleFrame: Int64? {
+        // The engine pushes back its scheduled events by any frames held for audio to decode, so follow it.
+        return scheduledShuffleFrame.map { $0 + getHeldFrames() - shuffleHeldFrames }
+    }
+    /// Rendered frame at which shuffling starts, as of when the shuffle was scheduled.
+    private var scheduledShuffleFrame: Int64?
+    /// Frames the audio engine had held for audio to decode when the shuffle was scheduled.
+    private var shuffleHeldFrames: Int64 = 0
     
     /// Sample rate of the currently loaded track.
     private(set) var sampleRate: Double = 44100
     
     /// Audio data for the currently playing track.
     private(set) var audioBuffer: AudioBuffer?
+    /// Format of the samples in the audio buffer.
+    private(set) var sampleFormat: SampleFormat = SampleFormatFloat32
+    /// Audio description of the audio buffer.
+    private var audioDesc: AudioStreamBasicDescription = AudioStreamBasicDescription()
     /// True if the current audio track was converted manually.
     private var manuallyAllocatedBuffer: Bool = false
     
-    /// Lock to prevent the audio buffer from being loaded and freed at the same time.
-    private var bufferLock: DispatchSemaphore = DispatchSemaphore(value: 1)
-    /// Passed to the dispatch queue tasks so the audio loading task knows if the track changes while it's still loading.
-    private var trackUuid: UUID = UUID()
+    /// Decodes the rest of the current track in the background after the initial portion has been loaded. Its decode map is attached to the audio engine, so it's kept until the engine stops playing the track, then cancelled before the audio buffer is freed.
+    private var decoder: ParallelDecoder?
     /// Indicator for whether an asynchronous load of an audio file is in progress.
     private var asyncLoadInProgress: Bool = false
-    
-    /// Volume multiplier used when fading out.
-    private var fadeMultiplier: Double = 1
+
+    /// Tracks that shuffling is predicted to move to next, soonest first.
+    private var upcomingTracks: [MPMediaItem] = []
+    /// Upcoming tracks decoded in the background while the current track plays. Its memory budget is set from the settings each time tracks are prefetched.
+    private let prefetchCache: PrefetchCache = PrefetchCache(maxBytes: 0, freeAudioData: MusicPlayer.freeAudioData)
+    /// Preloaded track that has been queued in the audio engine, waiting for playback to be handed off to it.
+    private var queuedTrack: PreloadedTrack?
+    /// Indicator for whether an upcoming track is being prefetched.
+    private var prefetchInProgress: Bool = false
+    /// Wakes the main thread to handle notifications posted by the audio engine. The audio thread only merges data into it, which never allocates or blocks.
+    private let engineNotificationSource: DispatchSourceUserDataAdd = DispatchSource.makeUserDataAddSource(queue: DispatchQueue.main)
     
     /// Audio data necessary for the loop finder.
     var audioData: AudioData {
         get {
-            return AudioData(audioBuffer: audioBuffer!, numSamples: Int32(numSamples), sampleRate: sampleRate)
+            return AudioData(audioBuffer: audioBuffer!, numSamples: Int32(numSamples), sampleRate: sampleRate, sampleFormat: sampleFormat)
         }
     }
     
+    /// Time spent in each phase of the most recent track load.
+    private(set) var lastLoadTimings: LoadTimings = LoadTimings()
+    /// Integrated loudness of the current track measured while it was decoded, and the number of frames from the start of the track it covers.
+    private var decodedLoudness: (loudness: Double, numFrames: Int)?
+    
     /// True if the player has a track loaded in it.
     var trackLoaded: Bool {
         get {
@@ -89,10 +117,20 @@ class MusicPlayer {
         }
     }
     
-    /// The current playback time in seconds.
+    /// The index of the sample being heard right now. Lags behind sampleCounter by the audio queued for playback.
+    var audibleSampleCounter: Int {
+        get {
+            /// Position of the audio being heard.
+            var position: PlaybackPosition = PlaybackPosition()
+            getPlaybackPosition(&position)
+            return Int(position.sampleCounter)
+        }
+    }
+
+    /// The current playback time in seconds, as heard.
     var playbackTimeSeconds: Double {
         get {
-            return convertSamplesToSeconds(sampleCounter)
+            return convertSamplesToSeconds(audibleSampleCounter)
         }
         set {
             sampleCounter = convertSecondsToSamples(newValue)
@@ -189,31 +227,162 @@ class MusicPlayer {
     /// Sets up audio playback.
     func initialize() throws {
         try enableBackgroundAudio()
+        // Render at the device's rate, so tracks are converted once in the engine rather than again by the system.
+        setOutputFormat(AVAudioSession.sharedInstance().sampleRate, 2)
+        updateBufferGeometry(background: false)
+        engineNotificationSource.setEventHandler { [unowned self] in
+            self.handleEngineNotifications()
+        }
+        engineNotificationSource.resume()
+        setNotificationCallback({ userData in
+            /// The player that owns the audio engine.
+            let player: MusicPlayer = Unmanaged<MusicPlayer>.fromOpaque(userData!).takeUnretainedValue()
+            player.engineNotificationSource.merge(data: 1)
+        }, Unmanaged.passUnretained(self).toOpaque())
     }
     
     /// Loads a track into the music player.
     /// - parameter mediaItem: The audio track to play.
     /// - parameter updateHistory: Whether or not to record the loaded track in the player's history (including updating the history index). Defaults to true.
     func loadTrack(mediaItem: MPMediaItem, updateHistory: Bool = true) throws {
+        /// Time spent in each phase of the load.
+        let timings: LoadTimings = LoadTimings()
         try stopTrack()
         
-        // Unload the buffer for the previous track.
-        bufferLock.wait()
+        discardQueuedTrack()
+        
+        // Unload the buffer for the previous track once nothing is decoding into it.
+        stopDecoding()
         if let audioBuffer: AudioBuffer = audioBuffer {
-            free(audioBuffer.mData!)
+            MusicPlayer.freeAudioData(audioBuffer)
         }
-        trackUuid = UUID()
-        bufferLock.signal()
+        timings.endPhase(\.stop)
         
         currentTrack = try MusicData.data.loadTrack(mediaItem: mediaItem)
+        timings.endPhase(\.lookup)
+        if let prefetched: PreloadedTrack = prefetchCache.take(mediaItem) {
+            // The track was decoded ahead of time, so only its audio needs to be swapped in.
+            try loadPrefetchedAudio(prefetched)
+            timings.endPhase(\.engineLoad)
+        } else {
+            try loadAudioFile(url: currentTrack.url, timings: timings)
+        }
+        consumeUpcomingTrack(mediaItem)
+
+        // Update track history queue if specified.
+        if updateHistory {
+            // Only add to the history if the loaded track is not already the most recent in history.
+            if trackHistory.last == nil || mediaItem != trackHistory.last! {
+                rememberTrack(track: mediaItem)
+            }
+            trackHistoryIndex = trackHistory.count - 1
+        }
+
+        if currentTrack.loopEnd == 0 {
+            currentTrack.loopEnd = durationSeconds
+        }
+        updateLoopPoints()
+        loadAudioAsync()
         
+        try playTrack()
+        timings.endPhase(\.start)
+        lastLoadTimings = timings
+        
+        NotificationCenter.default.post(name: .changeTrack, object: nil)
+    }
+    
+    /// Loads the current track's audio file into the audio engine, decoding enough to start playback and leaving the rest to decode in the background once loadAudioAsync is called. Decoded audio is mapped from the decoded audio cache instead if it's there.
+    /// - parameter url: URL of the audio file to load.
+    /// - parameter timings: Records the time spent in each phase of loading.
+    private func loadAudioFile(url: URL, timings: LoadTimings) throws {
+        /// Audio file containing the track to load, its length in frames, and the audio description of the decoded audio.
+        let (audioFile, audioLength, decodedAudioDesc): (ExtAudioFileRef, Int64, AudioStreamBasicDescription) = try MusicPlayer.openAudioFile(url: url, timings: timings)
+        defer {
+            ExtAudioFileDispose(audioFile)
+        }
+        /// Audio description of the decoded audio.
+        var convertedAudioDesc: AudioStreamBasicDescription = decodedAudioDesc
+        sampleRate = convertedAudioDesc.mSampleRate
+        if sampleFormatFromAudioDesc(&convertedAudioDesc, &sampleFormat) != 0 {
+            throw MessageError("Audio data is empty or not supported.")
+        }
+        /// Number of samples in the audio file across all channels.
+        let numSamples: Int64 = audioLength * Int64(convertedAudioDesc.mChannelsPerFrame)
+        
+        /// Size of the audio buffer in bytes.
+        let bufferSize: UInt32 = convertedAudioDesc.mBytesPerFrame * UInt32(audioLength)
+        // Cache files are keyed on the decoded format, the same as for preloaded tracks.
+        /// Decoded audio from an earlier load, if the track is in the decoded audio cache.
+        let cachedData: UnsafeMutableRawPointer? = PCMCache.cache.map(url: url, numFrames: audioLength, audioDesc: decodedAudioDesc)
+        // Otherwise decode into a new cache file, or into memory if the file can't be created.
+        let audioData: UnsafeMutableRawPointer = try cachedData ?? PCMCache.cache.create(url: url, numFrames: audioLength, audioDesc: decodedAudioDesc) ?? MusicPlayer.allocateAudioData(byteCount: Int(bufferSize))
+        audioBuffer = AudioBuffer(mNumberChannels: convertedAudioDesc.mChannelsPerFrame, mDataByteSize: bufferSize, mData: audioData)
+        timings.endPhase(\.allocate)
+        
+        /// Number of frames decoded before playback starts.
+        var numReadFrames: UInt32 = 0
+        /// Holds any errors from Core Audio API calls.
+        var error: OSStatus = noErr
+        if cachedData == nil {
+            // Decode the start of the track straight into the audio buffer so playback can start right away.
+            numReadFrames = UInt32(min(Int(audioLength), MusicPlayer.START_READ_SAMPLES))
+            let loadBuffer: UnsafeMutableAudioBufferListPointer = AudioBufferList.allocate(maximumBuffers: 1)
+            defer {
+                free(loadBuffer.unsafeMutablePointer)
+            }
+            loadBuffer[0] = AudioBuffer(mNumberChannels: convertedAudioDesc.mChannelsPerFrame, mDataByteSize: numReadFrames * convertedAudioDesc.mBytesPerFrame, mData: audioData)
+            
+            error = ExtAudioFileRead(audioFile, &numReadFrames, loadBuffer.unsafeMutablePointer)
+            if error != noErr {
+                throw MessageError("Failed to read audio file.", error)
+            }
+        }
+        timings.endPhase(\.initialRead)
+        
+        audioDesc = convertedAudioDesc
+        // Check for the data type of the audio and load it in the audio engine accordingly.
+        error = loadAudio(audioData, numSamples, convertedAudioDesc)
+        if error != noErr {
+            throw MessageError("Audio data is empty or not supported.", error)
+        }
+        
+        if cachedData == nil {
+            // Attach the decoder before loop points are set, so the audio around them is decoded first.
+            decoder = try ParallelDecoder(url: url, audioData: audioData, audioDesc: convertedAudioDesc, firstFrame: Int64(numReadFrames), numFrames: audioLength)
+            setDecodeProgress(decoder!.progress)
+        }
+        timings.endPhase(\.engineLoad)
+    }
+    
+    /// Loads a prefetched track's decoded audio into the audio engine.
+    /// - parameter prefetched: The prefetched track. Its audio becomes the current audio buffer.
+    private func loadPrefetchedAudio(_ prefetched: PreloadedTrack) throws {
+        audioBuffer = prefetched.audioBuffer
+        sampleRate = prefetched.audioDesc.mSampleRate
+        audioDesc = prefetched.audioDesc
+        if sampleFormatFromAudioDesc(&audioDesc, &sampleFormat) != 0 {
+            throw MessageError("Audio data is empty or not supported.")
+        }
+        /// Holds any errors from audio engine calls.
+        let error: OSStatus = loadAudio(prefetched.audioBuffer.mData!, prefetched.numSamples, audioDesc)
+        if error != noErr {
+            throw MessageError("Audio data is empty or not supported.", error)
+        }
+    }
+    
+    /// Opens an audio file for decoding, with priming frames included and the client format set to the interleaved PCM format the audio engine plays.
+    /// - parameter url: URL of the audio file to open.
+    /// - parameter timings: Records the time spent opening and setting up the file, if given.
+    /// - returns: The opened audio file, its length in frames, and the audio description of the decoded audio.
+    static func openAudioFile(url: URL, timings: LoadTimings? = nil) throws -> (ExtAudioFileRef, Int64, AudioStreamBasicDescription) {
         /// Audio file containing the track to load.
         var audioFileOptional: ExtAudioFileRef? = nil
         /// Holds any errors from Core Audio API calls.
-        var error: OSStatus = ExtAudioFileOpenURL(currentTrack.url as CFURL, &audioFileOptional)
+        var error: OSStatus = ExtAudioFileOpenURL(url as CFURL, &audioFileOptional)
         if error != noErr {
             throw MessageError("Failed to open audio file.", error)
         }
+        timings?.endPhase(\.open)
         
         /// Audio file containing the track to load.
         let audioFile: ExtAudioFileRef = audioFileOptional!
@@ -257,139 +426,120 @@ class MusicPlayer {
         if error != noErr {
             throw MessageError("Failed to get audio description.", error)
         }
-        sampleRate = origAudioDesc.mSampleRate
-        /// Number of samples in the audio file across all channels.
-        let numSamples: Int64 = audioLength * Int64(origAudioDesc.mChannelsPerFrame)
+        
+        /// Bit depth to store the decoded audio with.
+        let bitsPerSample: UInt32 = MusicPlayer.getStorageBitDepth(audioDesc: origAudioDesc)
         
         /// Audio description for the converted audio if non-interleaved is converted to interleaved.
         var convertedAudioDesc: AudioStreamBasicDescription = AudioStreamBasicDescription()
         convertedAudioDesc.mSampleRate = origAudioDesc.mSampleRate
         convertedAudioDesc.mFormatID = kAudioFormatLinearPCM
-        convertedAudioDesc.mBitsPerChannel = 32
+        convertedAudioDesc.mBitsPerChannel = bitsPerSample
         convertedAudioDesc.mChannelsPerFrame = origAudioDesc.mChannelsPerFrame
         convertedAudioDesc.mFramesPerPacket = 1
         convertedAudioDesc.mReserved = origAudioDesc.mReserved
-        convertedAudioDesc.mFormatFlags = kLinearPCMFormatFlagIsPacked | kAudioFormatFlagIsFloat
-        convertedAudioDesc.mBytesPerFrame = 4 * origAudioDesc.mChannelsPerFrame
+        convertedAudioDesc.mFormatFlags = kLinearPCMFormatFlagIsPacked | (bitsPerSample == 32 ? kAudioFormatFlagIsFloat : kLinearPCMFormatFlagIsSignedInteger)
+        convertedAudioDesc.mBytesPerFrame = bitsPerSample / 8 * origAudioDesc.mChannelsPerFrame
         convertedAudioDesc.mBytesPerPacket = convertedAudioDesc.mBytesPerFrame * convertedAudioDesc.mFramesPerPacket
         
         error = ExtAudioFileSetProperty(audioFile, kExtAudioFileProperty_ClientDataFormat, propertySize, &convertedAudioDesc)
         if error != noErr {
             throw MessageError("Failed to set audio description.", error)
         }
-        
-        /// Size of the audio buffer in bytes.
-        let bufferSize: UInt32 = convertedAudioDesc.mBytesPerFrame * UInt32(numSamples)
-        let audioBufferData: UnsafeMutableRawPointer = malloc(Int(bufferSize));
-        audioBufferData.initializeMemory(as: UInt8.self, repeating: 0, count: Int(bufferSize))
-        audioBuffer = AudioBuffer(mNumberChannels: convertedAudioDesc.mChannelsPerFrame, mDataByteSize: bufferSize, mData: audioBufferData)
-        
-        /// Size of the load buffer in bytes.
-        let loadBufferSize: Int = MusicPlayer.START_READ_SAMPLES * Int(convertedAudioDesc.mBytesPerFrame)
-        let loadBuffer: UnsafeMutableAudioBufferListPointer = AudioBufferList.allocate(maximumBuffers: 1)
-        let loadBufferData: UnsafeMutableRawPointer = malloc(loadBufferSize);
-        loadBufferData.initializeMemory(as: UInt8.self, repeating: 0, count: Int(loadBufferSize))
-        loadBuffer[0] = AudioBuffer(mNumberChannels: 2, mDataByteSize: UInt32(loadBufferSize), mData: loadBufferData)
-        
-        /// Initial number of samples to read.
-        var numReadSamples: UInt32 = UInt32(MusicPlayer.START_READ_SAMPLES)
-        
-        error = ExtAudioFileRead(audioFile, &numReadSamples, loadBuffer.unsafeMutablePointer)
-        if error != noErr {
-            throw MessageError("Failed to read audio file.", error)
-        }
-        
-        addToAudioBuffer(buffer: loadBuffer[0], offset: 0)
-        
-        let audioData: UnsafeMutableRawPointer = audioBuffer!.mData!
-        // Check for the data type of the audio and load it in the audio engine accordingly.
-        error = loadAudio(audioData, numSamples, convertedAudioDesc)
-        if error != noErr {
-            throw MessageError("Audio data is empty or not supported.", error)
-        }
-        
-        let startReadSamples: Int = min(Int(audioLength), MusicPlayer.START_READ_SAMPLES)
-        try loadAudioAsync(audioFile: audioFile, loadBuffer: loadBuffer, audioDesc: convertedAudioDesc, currentSamplesRead: startReadSamples, processUuid: trackUuid)
-
-        // Update track history queue if specified.
-        if updateHistory {
-            // Only add to the history if the loaded track is not already the most recent in history.
-            if trackHistory.last == nil || mediaItem != trackHistory.last! {
-                rememberTrack(track: mediaItem)
-            }
-            trackHistoryIndex = trackHistory.count - 1
-        }
-
-        if currentTrack.loopEnd == 0 {
-            currentTrack.loopEnd = durationSeconds
-        }
-        updateLoopPoints()
-        
-        try playTrack()
-        
-        NotificationCenter.default.post(name: .changeTrack, object: nil)
+        timings?.endPhase(\.fileSetup)
+        return (audioFile, audioLength, convertedAudioDesc)
     }
     
-    /// Transfers audio data from an audio buffer to the class-level audio buffer.
-    /// - parameter buffer: Audio buffer to transfer data from.
-    /// - parameter offset: Offset for inserting data into the class-level audio buffer.
-    private func addToAudioBuffer(buffer: AudioBuffer, offset: Int) {
-        /// Memory address to start copying audio data into the class-level buffer.
-        let dataOffset: UnsafeMutableRawPointer = audioBuffer!.mData! + offset
-        dataOffset.copyMemory(from: buffer.mData!, byteCount: Int(buffer.mDataByteSize))
+    /// Gets the bit depth to store decoded audio with. Integer PCM and Apple Lossless sources keep their native 16-bit or 24-bit depth, which the audio engine converts to float during playback. Everything else is decoded to 32-bit float.
+    /// - parameter audioDesc: Audio description of the audio file.
+    /// - returns: The number of bits per sample to decode to.
+    private static func getStorageBitDepth(audioDesc: AudioStreamBasicDescription) -> UInt32 {
+        if audioDesc.mFormatID == kAudioFormatLinearPCM {
+            if audioDesc.mFormatFlags & kAudioFormatFlagIsFloat == 0 && (audioDesc.mBitsPerChannel == 16 || audioDesc.mBitsPerChannel == 24) {
+                return audioDesc.mBitsPerChannel
+            }
+        } else if audioDesc.mFormatID == kAudioFormatAppleLossless {
+            if audioDesc.mFormatFlags == AudioFormatFlags(kAppleLosslessFormatFlag_16BitSourceData) {
+                return 16
+            } else if audioDesc.mFormatFlags == AudioFormatFlags(kAppleLosslessFormatFlag_24BitSourceData) {
+                return 24
+            }
+        }
+        return 32
     }
     
-    /// Loads the next portion of audio asynchronously from the main thread.
-    /// - parameter audioFile: The audio file being loaded.
-    /// - parameter loadBuffer: Audio buffer to load audio samples into.
-    /// - parameter audioDesc: Audio description of the audio file.
-    /// - parameter currentSamplesRead: The number of audio samples that have been read so far.
-    /// - parameter processUuid: The UUID of the audio track process. If the track changes, this will not match and the async task will cancel.
-    private func loadAudioAsync(audioFile: ExtAudioFileRef, loadBuffer: UnsafeMutableAudioBufferListPointer, audioDesc: AudioStreamBasicDescription, currentSamplesRead: Int, processUuid: UUID) throws {
+    /// Decodes the rest of the current track in the background. The audio engine holds playback until the audio it needs has been decoded, and asks for it to be decoded next.
+    private func loadAudioAsync() {
+        guard let decoder: ParallelDecoder = decoder else {
+            return
+        }
         self.asyncLoadInProgress = true
-        DispatchQueue.global(qos: DispatchQoS.background.qosClass).async {
-            do {
-                /// Number of samples to read in this iteration.
-                var numSamples: UInt32 = UInt32(MusicPlayer.SAMPLE_READ_INCREMENT)
-                
-                /// Holds any errors from Core Audio API calls.
-                let error: OSStatus = ExtAudioFileRead(audioFile, &numSamples, loadBuffer.unsafeMutablePointer)
-                if error != noErr {
-                    throw MessageError("Failed to read audio file.", error)
-                }
-
-                self.bufferLock.wait()
-                if processUuid == self.trackUuid && numSamples > 0 {
-                    self.addToAudioBuffer(buffer: loadBuffer[0], offset: currentSamplesRead * Int(audioDesc.mBytesPerFrame))
-                    self.bufferLock.signal()
-                    // Recursively load audio until the file is fully read.
-                    try self.loadAudioAsync(audioFile: audioFile, loadBuffer: loadBuffer, audioDesc: audioDesc, currentSamplesRead: currentSamplesRead + MusicPlayer.SAMPLE_READ_INCREMENT, processUuid: processUuid)
-                } else {
-                    self.asyncLoadInProgress = false
-                    self.bufferLock.signal()
-                    try self.disposeAudioFile(audioFile: audioFile, loadBuffer: loadBuffer)
+        // Measure loudness up to the loop end as the audio is decoded, so normalizing the volume doesn't need another pass over the track.
+        /// The number of frames measured for loudness.
+        let meteredFrames: Int = min(loopEnd, numSamples)
+        do {
+            try decoder.meterLoudness(numFrames: Int64(meteredFrames))
+        } catch {
+            print("Not measuring loudness while decoding.", error.localizedDescription)
+        }
+        // Decoded audio is needed by the loop finder and soon by playback, so decode at utility rather than background priority.
+        decoder.start(qos: DispatchQoS.utility) {
+            if decoder === self.decoder {
+                self.decodedLoudness = decoder.loudness.map { (loudness: $0, numFrames: meteredFrames) }
+                // Keep the decoded audio for later loads, unless decoding failed partway.
+                if (try? decoder.wait()) != nil, let audioData: UnsafeMutableRawPointer = self.audioBuffer?.mData {
+                    PCMCache.cache.commit(audioData)
                 }
-            } catch {
                 self.asyncLoadInProgress = false
-                print("Error loading audio asynchronously:", error.localizedDescription)
-                return
+                // The loop seam is skipped until the audio around the loop points has been decoded.
+                self.updateLoopPoints()
             }
         }
     }
     
-    private func disposeAudioFile(audioFile: ExtAudioFileRef, loadBuffer: UnsafeMutableAudioBufferListPointer) throws {
-        let error: OSStatus = ExtAudioFileDispose(audioFile)
-        if error != noErr {
-            throw MessageError("Failed to dispose audio file.", error)
+    /// Allocates zero-filled memory for decoded audio, for when it can't be decoded into the decoded audio cache. The memory is mapped anonymously, so pages are only zeroed by the system as they're first touched, rather than all before the first read.
+    /// - parameter byteCount: Size of the memory in bytes.
+    /// - returns: The allocated memory, to be freed with freeAudioData.
+    private static func allocateAudioData(byteCount: Int) throws -> UnsafeMutableRawPointer {
+        guard let audioData: UnsafeMutableRawPointer = mmap(nil, max(byteCount, 1), PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0), audioData != MAP_FAILED else {
+            throw MessageError("Failed to allocate audio buffer.", errno)
         }
-        free(loadBuffer[0].mData!)
-        free(loadBuffer.unsafeMutablePointer)
+        return audioData
+    }
+    
+    /// Frees decoded audio, whether it was mapped from the decoded audio cache or allocated in memory.
+    /// - parameter audioBuffer: The decoded audio to free.
+    private static func freeAudioData(_ audioBuffer: AudioBuffer) {
+        if !PCMCache.cache.unmap(audioBuffer.mData!) {
+            munmap(audioBuffer.mData!, max(Int(audioBuffer.mDataByteSize), 1))
+        }
+    }
+    
+    /// Stops any background decoding of the current track, waiting for it to stop writing to the audio buffer. The audio engine must no longer be playing the track.
+    private func stopDecoding() {
+        decoder?.cancel()
+        decoder = nil
+        decodedLoudness = nil
+        asyncLoadInProgress = false
+    }
+    
+    /// Gets the integrated loudness of the start of the current track, if it was measured while the track was decoded.
+    /// - parameter numFrames: The number of frames from the start of the track to get the loudness of.
+    /// - returns: The integrated loudness in LUFS, or nil if those frames weren't measured.
+    func getDecodedLoudness(numFrames: Int) -> Double? {
+        guard let decodedLoudness: (loudness: Double, numFrames: Int) = decodedLoudness, decodedLoudness.numFrames == numFrames else {
+            return nil
+        }
+        return decodedLoudness.loudness
     }
     
     /// Starts playing the currently loaded track (or resumes it, if paused).
     func playTrack() throws {
         if !playing {
-            resetFadeVolume()
+            // Resuming from a pause keeps a fade in progress, along with the rest of the shuffle schedule.
+            if shuffleFrame == nil {
+                resetFadeVolume()
+            }
             playing = true
             paused = false
             interrupted = false
@@ -398,7 +548,7 @@ class MusicPlayer {
             if playStatus != 0 {
                 throw MessageError("Failed to play audio.", playStatus)
             }
-            startShuffleTimer()
+            scheduleShuffle()
         }
     }
     
@@ -409,7 +559,6 @@ class MusicPlayer {
             playing = false
             paused = true
             self.interrupted = interrupted
-            pauseShuffleTimer()
             /// Status code for pausing audio.
             let pauseStatus: OSStatus = pauseAudio()
             if pauseStatus != 0 {
@@ -424,7 +573,7 @@ class MusicPlayer {
             playing = false
             paused = false
             interrupted = false
-            stopShuffleTimer()
+            cancelShuffle()
             /// Status code for stopping audio.
             let stopStatus: OSStatus = stopAudio()
             if stopStatus != 0 {
@@ -433,14 +582,54 @@ class MusicPlayer {
         }
     }
     
+    /// Renders the intro, a number of loops and a fade-out of the current track to a WAV file, without playing it.
+    /// - parameter url: URL of the file to write.
+    /// - parameter loopCount: Number of times to play the loop after the intro.
+    /// - parameter fadeOutSeconds: Duration of the fade-out after the last loop.
+    /// - returns: The render speed as a multiple of real time.
+    func exportLoopedTrack(url: URL, loopCount: Int, fadeOutSeconds: Double) throws -> Double {
+        if !trackFullyLoaded {
+            throw MessageError("The track must be fully loaded before exporting.")
+        }
+        guard let engine: OpaquePointer = createAudioEngine(false) else {
+            throw MessageError("Failed to create an audio engine for exporting.")
+        }
+        defer {
+            disposeAudioEngine(engine)
+        }
+        /// Holds any errors from audio engine calls.
+        var error: OSStatus = engineLoadAudio(engine, audioBuffer!.mData!, Int64(numSamples) * Int64(audioDesc.mChannelsPerFrame), audioDesc)
+        if error != noErr {
+            throw MessageError("Audio data is empty or not supported.", error)
+        }
+        engineSetVolumeMultiplier(engine, currentTrack.volumeMultiplier * MusicSettings.settings.masterVolume)
+        engineSetLoopCrossfadeLength(engine, Int64(convertSecondsToSamples(MusicSettings.settings.loopCrossfadeDuration ?? 0)))
+        engineSetLoopPoints(engine, Int64(loopStart), Int64(loopEnd))
+        
+        /// Render speed as a multiple of real time.
+        var realtimeMultiple: Double = 0
+        error = exportLoopedAudio(engine, url.path, Int64(loopCount), Int64(convertSecondsToSamples(fadeOutSeconds)), &realtimeMultiple)
+        if error != noErr {
+            throw MessageError("Failed to export audio.", error)
+        }
+        return realtimeMultiple
+    }
+    
+    /// Updates the audio engine's buffer geometry for the app's state. In the foreground, buffers adapt for low latency; in the background, they stay large.
+    /// - parameter background: True if the app is in the background.
+    func updateBufferGeometry(background: Bool) {
+        setBufferGeometry(MusicPlayer.NUM_BUFFERS, background ? MusicPlayer.MAX_BUFFER_FRAMES : MusicPlayer.MIN_FOREGROUND_BUFFER_FRAMES, MusicPlayer.MAX_BUFFER_FRAMES)
+    }
+    
     /// Updates the loop start/end within the audio engine.
-    private func updateLoopPoints() {
+    func updateLoopPoints() {
+        setLoopCrossfadeLength(Int64(convertSecondsToSamples(MusicSettings.settings.loopCrossfadeDuration ?? 0)))
         setLoopPoints((Int64) (convertSecondsToSamples(currentTrack.loopStart)), (Int64) (convertSecondsToSamples(currentTrack.loopEnd)))
     }
     
     /// Updates the volume multiplier within the audio engine.
     func updateVolume() {
-        setVolumeMultiplier(currentTrack.volumeMultiplier * MusicSettings.settings.masterVolume * fadeMultiplier)
+        setVolumeMultiplier(currentTrack.volumeMultiplier * MusicSettings.settings.masterVolume)
     }
     
     /// Saves the currently configured track settings to the database.
@@ -471,29 +660,98 @@ class MusicPlayer {
         pruneTrackHistory()
     }
 
-    /// Chooses a random track from the current playlist and starts playing it.
+    /// Chooses a random track from the current playlist and starts playing it. If a random track was already predicted, and possibly prefetched, it is used as long as it could still be chosen.
     func randomizeTrack() throws {
+        /// The predicted random track, used if it could still be chosen.
+        var mediaItem: MPMediaItem? = upcomingTracks.first
+        if let upcomingTrack: MPMediaItem = mediaItem, !MusicPlayer.getRandomTrackChoices(tracks: MediaPlayerUtils.getTracksInPlaylist(), history: trackHistory).contains(upcomingTrack) {
+            mediaItem = nil
+        }
+        try loadTrack(mediaItem: try mediaItem ?? chooseRandomTrack(history: trackHistory))
+        try playTrack()
+    }
+
+    /// Chooses a random track from the current playlist, avoiding recently played tracks if possible.
+    /// - parameter history: Track history to avoid repeats from.
+    /// - returns: The chosen track.
+    private func chooseRandomTrack(history: [MPMediaItem]) throws -> MPMediaItem {
         /// Tracks list to randomly choose from.
-        var tracks: [MPMediaItem] = MediaPlayerUtils.getTracksInPlaylist()
+        let tracks: [MPMediaItem] = MusicPlayer.getRandomTrackChoices(tracks: MediaPlayerUtils.getTracksInPlaylist(), history: history)
+        if tracks.count == 0 {
+            throw MessageError("No compatible tracks found.")
+        }
+        
+        return tracks.randomElement()!
+    }
+    
+    /// Gets the tracks a random track is chosen from, avoiding recently played tracks if possible.
+    /// - parameter tracks: Tracks in the current playlist.
+    /// - parameter history: Track history to avoid repeats from.
+    /// - returns: The tracks to choose from.
+    private static func getRandomTrackChoices(tracks: [MPMediaItem], history: [MPMediaItem]) -> [MPMediaItem] {
         /// Tracks that haven't been played recently.
-        let newTracks: [MPMediaItem] = tracks.filter { !trackHistory.contains($0) }
+        let newTracks: [MPMediaItem] = tracks.filter { !history.contains($0) }
         
         /// Pick from new tracks if possible, otherwise fall back to the full track list.
         if newTracks.count > 0 {
-            tracks = newTracks
-        } else if tracks.count > 1 && trackHistory.count > 0 {
+            return newTracks
+        } else if tracks.count > 1 && history.count > 0 {
             // If possible, at least try to avoid an immediate repeat.
-            tracks = tracks.filter { $0 != trackHistory.last! }
+            return tracks.filter { $0 != history.last! }
         }
-        if tracks.count == 0 {
-            throw MessageError("No compatible tracks found.")
+        return tracks
+    }
+    
+    /// Predicts the tracks that shuffling will move to next, following the track history if moving forward through it and otherwise choosing random tracks the same way randomizeTrack does. Earlier predictions are kept while they could still be chosen, so tracks already prefetched stay useful.
+    private func predictUpcomingTracks() {
+        /// Tracks in the current playlist.
+        let tracks: [MPMediaItem] = MediaPlayerUtils.getTracksInPlaylist()
+        /// Track history as it will be once the predicted tracks have played.
+        var history: [MPMediaItem] = trackHistory
+        /// Index in the predicted track history of the track before the next prediction.
+        var historyIndex: Int = trackHistoryIndex
+        /// Maximum length of the track history.
+        let historyLength: Int = max(0, MusicSettings.settings.shuffleHistoryLength ?? 0)
+        /// The new predictions.
+        var predicted: [MPMediaItem] = []
+        /// True while the earlier predictions still match the new ones.
+        var keepingPredictions: Bool = true
+        while predicted.count < MusicPlayer.PREFETCH_DEPTH {
+            /// The next predicted track.
+            let mediaItem: MPMediaItem
+            if historyIndex >= 0 && historyIndex < history.count - 1 {
+                historyIndex += 1
+                mediaItem = history[historyIndex]
+            } else {
+                /// Tracks the next random track could be chosen from.
+                let choices: [MPMediaItem] = MusicPlayer.getRandomTrackChoices(tracks: tracks, history: history)
+                if keepingPredictions && predicted.count < upcomingTracks.count && choices.contains(upcomingTracks[predicted.count]) {
+                    mediaItem = upcomingTracks[predicted.count]
+                } else if let choice: MPMediaItem = choices.randomElement() {
+                    mediaItem = choice
+                } else {
+                    break
+                }
+                if historyLength > 0 {
+                    history.append(mediaItem)
+                    history.removeFirst(max(0, history.count - historyLength))
+                }
+                historyIndex = history.count - 1
+            }
+            keepingPredictions = keepingPredictions && predicted.count < upcomingTracks.count && upcomingTracks[predicted.count] == mediaItem
+            predicted.append(mediaItem)
+        }
+        upcomingTracks = predicted
+    }
+    
+    /// Moves the predictions forward once a track has been loaded, or drops them if a different track was loaded than predicted.
+    /// - parameter mediaItem: The track that was loaded.
+    private func consumeUpcomingTrack(_ mediaItem: MPMediaItem) {
+        if upcomingTracks.first == mediaItem {
+            upcomingTracks.removeFirst()
+        } else {
+            upcomingTracks.removeAll()
         }
-        
-        /// Randomly chosen track to play.
-        let randomTrack: MPMediaItem = tracks.randomElement()!
-
-        try loadTrack(mediaItem: randomTrack)
-        try playTrack()
     }
 
     /// Loads the next track in recent memory. If there is no next track, picks a random one.
@@ -567,66 +825,258 @@ class MusicPlayer {
         }
     }
     
-    /// Starts the timer used to shuffle tracks (or resumes it, if paused).
-    func startShuffleTimer() {
-        if shuffleTimer != nil {
-            rawStopShuffleTimer()
+    /// Schedules shuffling away from the current track once it has played for its shuffle time, if shuffling is enabled. Does nothing if a shuffle is already scheduled, so resuming playback keeps the original schedule.
+    func scheduleShuffle() {
+        if shuffleFrame != nil {
+            return
+        }
+        guard let shuffleTime: Double = MusicSettings.settings.calculateShuffleTime(track: currentTrack) else {
+            return
+        }
+        scheduledShuffleFrame = getRenderedFrames() + Int64(convertSecondsToOutputFrames(shuffleTime))
+        shuffleHeldFrames = getHeldFrames()
+        predictUpcomingTracks()
+        queuePreloadedTrack()
+        scheduleShuffleEvents()
+        prefetchUpcomingTracks()
+    }
+
+    /// Cancels any scheduled shuffle, including a fade-out already in progress.
+    func cancelShuffle() {
+        scheduledShuffleFrame = nil
+        cancelEvents()
+        if playing {
+            resetFadeVolume()
         }
-        if let shuffleTime: Double = shuffleTimeRemaining ?? MusicSettings.settings.calculateShuffleTime(track: currentTrack) {
-            shuffleTimer = Timer.scheduledTimer(withTimeInterval: shuffleTime, repeats: false) { [weak self] _ in
+    }
+
+    /// Schedules the audio engine events that shuffle away from the current track at the shuffle frame. If a preloaded track is queued, the engine hands playback off to it; otherwise the current track fades out and the next track is loaded once the fade finishes.
+    private func scheduleShuffleEvents() {
+        guard let shuffleFrame: Int64 = shuffleFrame else {
+            return
+        }
+        cancelEvents()
+        /// Fade duration in output frames.
+        let fadeFrames: Int64 = shuffleFadeFrames
+        if queuedTrack != nil {
+            // Without a fade, the engine switches at the first loop wrap after the shuffle frame.
+            scheduleEvent(EngineEvent(trigger: EventTriggerRenderedFrames, position: shuffleFrame, action: EventActionHandoff, targetGain: 0, numFrames: fadeFrames, tag: MusicPlayer.SHUFFLE_EVENT_TAG))
+            return
+        }
+        if fadeFrames > 0 {
+            scheduleEvent(EngineEvent(trigger: EventTriggerRenderedFrames, position: shuffleFrame, action: EventActionRampGain, targetGain: 0, numFrames: fadeFrames, tag: MusicPlayer.SHUFFLE_EVENT_TAG))
+        }
+        scheduleEvent(EngineEvent(trigger: EventTriggerRenderedFrames, position: shuffleFrame + fadeFrames, action: EventActionNotify, targetGain: 0, numFrames: 0, tag: MusicPlayer.LOAD_NEXT_EVENT_TAG))
+    }
+
+    /// Duration of the fade-out before shuffling, in output frames.
+    private var shuffleFadeFrames: Int64 {
+        return Int64(convertSecondsToOutputFrames(max(0, MusicSettings.settings.fadeDuration ?? 0)))
+    }
+
+    /// Handles notifications posted by the audio engine while rendering.
+    private func handleEngineNotifications() {
+        /// Notification read from the audio engine.
+        var notification: EngineNotification = EngineNotification()
+        while pollNotification(&notification) {
+            if notification.type == NotificationTrackChanged {
+                completeHandoff()
+            } else if notification.tag == MusicPlayer.LOAD_NEXT_EVENT_TAG {
+                // Ignore events from a shuffle that was cancelled or replaced after they fired.
+                guard let shuffleFrame: Int64 = shuffleFrame, notification.renderedFrames >= shuffleFrame else {
+                    continue
+                }
                 do {
-                    if let fadeDuration: Double = MusicSettings.settings.fadeDuration {
-                        if fadeDuration > 0 && self?.currentTrack.loopInShuffle != nil {
-                            self?.fadeTimer = Timer.scheduledTimer(withTimeInterval: MusicPlayer.FADE_DECREMENT_TIME, repeats: true) { [weak self] _ in
-                                do {
-                                    guard let self = self else { return }
-                                    self.fadeMultiplier = max(0, self.fadeMultiplier - MusicPlayer.FADE_DECREMENT_TIME / fadeDuration)
-                                    self.updateVolume()
-                                    if self.fadeMultiplier <= 0 {
-                                        try self.loadNextTrack()
-                                    }
-                                } catch {
-                                    print("Error loading next track:", error.localizedDescription)
-                                }
-                            }
-                            return
-                        }
-                    }
-                    try self?.loadNextTrack()
+                    try loadNextTrack()
                 } catch {
                     print("Error loading next track:", error.localizedDescription)
                 }
             }
         }
+        if takeNotificationsDropped() {
+            recoverDroppedNotifications()
+        }
+    }
+
+    /// Catches up on notifications the audio engine dropped because they weren't read in time, by checking the state they would have reported.
+    private func recoverDroppedNotifications() {
+        // Only completes if playback has switched to the queued track.
+        completeHandoff()
+        // Without a queued track, the shuffle loads the next track once the fade-out has finished.
+        guard queuedTrack == nil, let shuffleFrame: Int64 = shuffleFrame, getRenderedFrames() >= shuffleFrame + shuffleFadeFrames else {
+            return
+        }
+        do {
+            try loadNextTrack()
+        } catch {
+            print("Error loading next track:", error.localizedDescription)
+        }
+    }
+    
+    /// Starts decoding the next upcoming track that isn't decoded yet, if the prefetch memory budget allows. Each prefetched track starts the next, until every upcoming track is decoded or the budget is full.
+    private func prefetchUpcomingTracks() {
+        if prefetchInProgress {
+            return
+        }
+        prefetchCache.maxBytes = Int64(MusicSettings.settings.prefetchMemoryLimit * 1048576)
+        if prefetchCache.maxBytes <= 0 {
+            return
+        }
+        /// Track to prefetch.
+        guard let mediaItem: MPMediaItem = upcomingTracks.first(where: { !prefetchCache.contains($0) && $0 != queuedTrack?.mediaItem }) else {
+            return
+        }
+        /// Track settings for the track to prefetch.
+        let track: MusicTrack
+        do {
+            track = try MusicData.data.loadTrack(mediaItem: mediaItem)
+        } catch {
+            print("Error prefetching track:", error.localizedDescription)
+            return
+        }
+
+        prefetchInProgress = true
+        DispatchQueue.global(qos: DispatchQoS.background.qosClass).async {
+            /// The decoded track, or nil if decoding failed.
+            var prefetched: PreloadedTrack? = nil
+            do {
+                let (audioBuffer, audioDesc, numSamples) = try MusicPlayer.decodeAudioFile(url: track.url)
+                prefetched = PreloadedTrack(mediaItem: mediaItem, track: track, audioBuffer: audioBuffer, audioDesc: audioDesc, numSamples: numSamples)
+            } catch {
+                print("Error prefetching track:", error.localizedDescription)
+            }
+            DispatchQueue.main.async {
+                self.prefetchInProgress = false
+                // Decoded tracks are cached even if the predictions changed meanwhile, in case the track comes up later.
+                guard let prefetched: PreloadedTrack = prefetched, self.prefetchCache.insert(prefetched, keeping: self.upcomingTracks) else {
+                    return
+                }
+                self.switchShuffleToHandoff()
+                self.prefetchUpcomingTracks()
+            }
+        }
     }
     
-    /// Stops the timer used to shuffle tracks without clearing the shuffleTimeRemaining field.
-    private func rawStopShuffleTimer() {
-        shuffleTimer?.invalidate()
-        shuffleTimer = nil
-        fadeTimer?.invalidate()
-        fadeTimer = nil
-        if playing {
-            resetFadeVolume()
+    /// Decodes an entire audio file into memory.
+    /// - parameter url: URL of the audio file to decode.
+    /// - returns: The decoded audio data, its audio description, and the number of samples in it across all channels.
+    private static func decodeAudioFile(url: URL) throws -> (AudioBuffer, AudioStreamBasicDescription, Int64) {
+        let (audioFile, audioLength, audioDesc): (ExtAudioFileRef, Int64, AudioStreamBasicDescription) = try openAudioFile(url: url)
+        // Workers open their own files, so this one is only needed for the length and format.
+        ExtAudioFileDispose(audioFile)
+        
+        /// Size of the audio buffer in bytes.
+        let bufferSize: UInt32 = audioDesc.mBytesPerFrame * UInt32(audioLength)
+        if let cachedData: UnsafeMutableRawPointer = PCMCache.cache.map(url: url, numFrames: audioLength, audioDesc: audioDesc) {
+            return (AudioBuffer(mNumberChannels: audioDesc.mChannelsPerFrame, mDataByteSize: bufferSize, mData: cachedData), audioDesc, audioLength * Int64(audioDesc.mChannelsPerFrame))
         }
+        let audioBufferData: UnsafeMutableRawPointer = try PCMCache.cache.create(url: url, numFrames: audioLength, audioDesc: audioDesc) ?? allocateAudioData(byteCount: Int(bufferSize))
+        /// Buffer the track is decoded into.
+        let audioBuffer: AudioBuffer = AudioBuffer(mNumberChannels: audioDesc.mChannelsPerFrame, mDataByteSize: bufferSize, mData: audioBufferData)
+        
+        // Decode straight into the audio buffer, split across several workers. This is already off the main thread, so wait for them here.
+        /// Decoder for the whole track.
+        let decoder: ParallelDecoder
+        do {
+            decoder = try ParallelDecoder(url: url, audioData: audioBufferData, audioDesc: audioDesc, firstFrame: 0, numFrames: audioLength)
+            decoder.start(qos: DispatchQoS.background) {}
+            try decoder.wait()
+        } catch {
+            freeAudioData(audioBuffer)
+            throw error
+        }
+        PCMCache.cache.commit(audioBufferData)
+        
+        return (audioBuffer, audioDesc, audioLength * Int64(audioDesc.mChannelsPerFrame))
     }
     
-    /// Stops the timer used to shuffle tracks.
-    func stopShuffleTimer() {
-        rawStopShuffleTimer()
-        shuffleTimeRemaining = nil
+    /// Queues the preloaded track in the audio engine, so shuffling can hand playback off to it without a gap.
+    /// - returns: True if a track is queued, or false if there is no compatible preloaded track and the next track must be loaded normally.
+    @discardableResult private func queuePreloadedTrack() -> Bool {
+        if !playing && !paused {
+            return false
+        }
+        // A track that was queued before playback stopped can be queued again.
+        guard let preloaded: PreloadedTrack = queuedTrack ?? upcomingTracks.first.flatMap({ prefetchCache.take($0) }) else {
+            return false
+        }
+        /// Sample rate of the preloaded track, which loop points are given in.
+        let preloadedSampleRate: Double = preloaded.audioDesc.mSampleRate
+        /// Loop end of the preloaded track in seconds, defaulting to the end of the track.
+        let loopEnd: Double = preloaded.track.loopEnd == 0 ? Double(preloaded.numSamples) / Double(preloaded.audioDesc.mChannelsPerFrame) / preloadedSampleRate : preloaded.track.loopEnd
+        /// Status code for queueing the preloaded audio.
+        let queueStatus: OSStatus = queueAudio(preloaded.audioBuffer.mData!, preloaded.numSamples, preloaded.audioDesc, 0, Int64(round(preloaded.track.loopStart * preloadedSampleRate)), Int64(round(loopEnd * preloadedSampleRate)))
+        if queueStatus != noErr {
+            // The engine can't convert the audio, so it has to be loaded normally.
+            MusicPlayer.freeAudioData(preloaded.audioBuffer)
+            queuedTrack = nil
+            return false
+        }
+        queuedTrack = preloaded
+        return true
     }
-
-    /// Pauses the timer used to shuffle tracks.
-    func pauseShuffleTimer() {
-        // Record the remaining time before invalidating the timer.
-        if let timeRemaining = shuffleTimer?.fireDate.timeIntervalSinceNow {
-            // Max with 0 just in case...
-            shuffleTimeRemaining = max(0, timeRemaining)
+    
+    /// Switches a scheduled shuffle to hand off to a track that just finished prefetching. Only done while the shuffle is at least a second away, so a fade that might already have started isn't cut short.
+    private func switchShuffleToHandoff() {
+        guard let shuffleFrame: Int64 = shuffleFrame, shuffleFrame - getRenderedFrames() > Int64(convertSecondsToOutputFrames(1)) else {
+            return
+        }
+        if queuePreloadedTrack() {
+            scheduleShuffleEvents()
         }
-        rawStopShuffleTimer()
     }
+    
+    /// Makes the queued track the current track once the audio engine has handed playback off to it.
+    private func completeHandoff() {
+        guard let queued: PreloadedTrack = queuedTrack, finishHandoff() else {
+            return
+        }
+        queuedTrack = nil
+        consumeUpcomingTrack(queued.mediaItem)
+
+        // Unload the buffer for the previous track, which is no longer being played, once nothing is decoding into it.
+        stopDecoding()
+        if let audioBuffer: AudioBuffer = audioBuffer {
+            MusicPlayer.freeAudioData(audioBuffer)
+        }
+        audioBuffer = queued.audioBuffer
+
+        currentTrack = queued.track
+        sampleRate = queued.audioDesc.mSampleRate
+        audioDesc = queued.audioDesc
+        _ = sampleFormatFromAudioDesc(&audioDesc, &sampleFormat)
+        if currentTrack.loopEnd == 0 {
+            currentTrack.loopEnd = durationSeconds
+        }
+
+        // Update track history, moving forward through it if the handoff followed it.
+        if trackHistoryIndex >= 0 && trackHistoryIndex < trackHistory.count - 1 && trackHistory[trackHistoryIndex + 1] == queued.mediaItem {
+            trackHistoryIndex += 1
+        } else {
+            if trackHistory.last == nil || queued.mediaItem != trackHistory.last! {
+                rememberTrack(track: queued.mediaItem)
+            }
+            trackHistoryIndex = trackHistory.count - 1
+        }
+
+        updateLoopPoints()
+        scheduledShuffleFrame = nil
+        resetFadeVolume()
+        if playing || paused {
+            scheduleShuffle()
+        }
 
+        NotificationCenter.default.post(name: .changeTrack, object: nil)
+    }
+    
+    /// Frees any queued track. Must only be called while the audio engine isn't playing a queued track.
+    private func discardQueuedTrack() {
+        if let queued: PreloadedTrack = queuedTrack {
+            MusicPlayer.freeAudioData(queued.audioBuffer)
+        }
+        queuedTrack = nil
+    }
+    
     /// Converts a sample number into seconds using the current sample rate.
     /// - parameter samples: The number of samples to convert.
     /// - returns: The given samples converted to seconds.
@@ -641,9 +1091,16 @@ class MusicPlayer {
         return Int(round(seconds * sampleRate))
     }
 
+    /// Converts a seconds value into a number of frames rendered by the audio engine, which may play at a different sample rate than the current track.
+    /// - parameter seconds: The seconds value to convert.
+    /// - returns: The given seconds converted to output frames.
+    func convertSecondsToOutputFrames(_ seconds: Double) -> Int {
+        return Int(round(seconds * engineGetSampleRate(getDefaultAudioEngine())))
+    }
+
     /// Resets the fade effect.
     private func resetFadeVolume() {
-        fadeMultiplier = 1
+        rampGain(1, 0)
         updateVolume()
     }
 }
@@ -5,6 +5,8 @@ class MusicSettings {
     
     /// File to write settings to.
     static let SETTINGS_FILE: String = "Settings.plist"
+    /// The default memory (megabytes) for upcoming shuffle tracks decoded ahead of time.
+    static let DEFAULT_PREFETCH_MEMORY_LIMIT: Double = 256
     
     /// Singleton instance.
     static let settings: MusicSettings = MusicSettings()
@@ -27,6 +29,8 @@ class MusicSettings {
     var defaultRelativeVolume: Double = MusicTrack.DEFAULT_VOLUME_MULTIPLIER
     /// Volume in LUFS for automatic relative volume normalization.
     var volumeNormalizationLevel: Double?
+    /// Duration (seconds) of the crossfade from the loop end into the loop start. If nil, loops are played without a crossfade.
+    var loopCrossfadeDuration: Double?
     
     /// Setting for the time between shuffling tracks.
     var shuffleSetting: ShuffleSetting = ShuffleSetting.none
@@ -34,6 +38,8 @@ class MusicSettings {
     var fadeDuration: Double?
     /// Number of tracks to store in history for recalling old tracks and for avoiding repeats when shuffling.
     var shuffleHistoryLength: Int?
+    /// Memory (megabytes) for upcoming shuffle tracks decoded ahead of time, so shuffling to them doesn't wait on decoding. 0 disables prefetching, for devices short on memory.
+    var prefetchMemoryLimit: Double = DEFAULT_PREFETCH_MEMORY_LIMIT
     
     /// For time shuffle, the base amount of time (minutes) to shuffle tracks at.
     var shuffleTime: Double?
@@ -77,6 +83,8 @@ class MusicSettings {
     var useMonoAudio: Bool = false
     /// Controls how to reduce the framerate of the audio data before loop-finding. Usually gives a speedup factor equal to the reduction value, but may be less accurate. Values of 7+ may cause algorithm instability.
     var frameRateReduction: Int = 0
+    /// Controls whether to low-pass filter the audio data when reducing its frame rate, so frequencies above the reduced Nyquist frequency don't alias. Slower to reduce, but may allow higher frame rate reductions without losing accuracy.
+    var antiAliasFrameRateReduction: Bool = false
     /// Limit of frame rate reduction when the loop finder downsamples.
     var frameRateReductionLimit: Double = 0
     /// Proportional to the frame rate reduction limit.
@@ -108,9 +116,11 @@ class MusicSettings {
             masterVolume = settingsFile.masterVolume
             defaultRelativeVolume = settingsFile.defaultRelativeVolume
             volumeNormalizationLevel = settingsFile.volumeNormalizationLevel
+            loopCrossfadeDuration = settingsFile.loopCrossfadeDuration
             shuffleSetting = ShuffleSetting(rawValue: settingsFile.shuffleSetting ?? "") ?? ShuffleSetting.none
             fadeDuration = settingsFile.fadeDuration
             shuffleHistoryLength = settingsFile.shuffleHistoryLength
+            prefetchMemoryLimit = settingsFile.prefetchMemoryLimit ?? MusicSettings.DEFAULT_PREFETCH_MEMORY_LIMIT
             shuffleTime = settingsFile.shuffleTime
             shuffleTimeVariance = settingsFile.shuffleTimeVariance
             minShuffleRepeats = settingsFile.minShuffleRepeats
@@ -135,6 +145,7 @@ class MusicSettings {
             spectrogramOverlapPercentage = settingsFile.spectrogramOverlapPercentage
             useMonoAudio = settingsFile.useMonoAudio
             frameRateReduction = settingsFile.frameRateReduction
+            antiAliasFrameRateReduction = settingsFile.antiAliasFrameRateReduction ?? false
             frameRateReductionLimit = settingsFile.frameRateReductionLimit
             trackLengthLimit = settingsFile.trackLengthLimit
             durationValues = settingsFile.durationValues
@@ -161,10 +172,12 @@ class MusicSettings {
             settingsFile.masterVolume = masterVolume
             settingsFile.defaultRelativeVolume = defaultRelativeVolume
             settingsFile.volumeNormalizationLevel = volumeNormalizationLevel
+            settingsFile.loopCrossfadeDuration = loopCrossfadeDuration
             settingsFile.shuffleSetting = shuffleSetting.rawValue
             settingsFile.shuffleTime = shuffleTime
             settingsFile.fadeDuration = fadeDuration
             settingsFile.shuffleHistoryLength = shuffleHistoryLength
+            settingsFile.prefetchMemoryLimit = prefetchMemoryLimit
             settingsFile.shuffleTimeVariance = shuffleTimeVariance
             settingsFile.minShuffleRepeats = minShuffleRepeats
             settingsFile.maxShuffleRepeats = maxShuffleRepeats
@@ -188,6 +201,7 @@ class MusicSettings {
             settingsFile.spectrogramOverlapPercentage = spectrogramOverlapPercentage
             settingsFile.useMonoAudio = useMonoAudio
             settingsFile.frameRateReduction = frameRateReduction
+            settingsFile.antiAliasFrameRateReduction = antiAliasFrameRateReduction
             settingsFile.frameRateReductionLimit = frameRateReductionLimit
             settingsFile.trackLengthLimit = trackLengthLimit
             settingsFile.durationValues = durationValues
@@ -328,6 +342,7 @@ class MusicSettings {
         spectrogramOverlapPercentage = 50
         useMonoAudio = true
         frameRateReduction = 6
+        antiAliasFrameRateReduction = false
         frameRateReductionLimit = 10
         trackLengthLimit = Double(Int(1) << 22)
         durationValues = 12
@@ -355,6 +370,7 @@ class MusicSettings {
         let old_overlapPercent = loopFinder.overlapPercent
         let old_useMonoAudio = loopFinder.useMonoAudio
         let old_framerateReductionFactor = loopFinder.framerateReductionFactor
+        let old_decimationFilter = loopFinder.decimationFilter
         let old_framerateReductionLimit = loopFinder.framerateReductionLimit
         let old_lengthLimit = loopFinder.lengthLimit
         let old_nBestDurations = loopFinder.nBestDurations
@@ -377,6 +393,7 @@ class MusicSettings {
         loopFinder.overlapPercent = Float(spectrogramOverlapPercentage)
         loopFinder.useMonoAudio = useMonoAudio
         loopFinder.framerateReductionFactor = Int32(frameRateReduction)
+        loopFinder.decimationFilter = antiAliasFrameRateReduction ? DecimationFilterFIR : DecimationFilterBoxcar
         loopFinder.setFramerateReductionLimitFloat(Float(frameRateReductionLimit))
         loopFinder.setLengthLimitFloat(Float(trackLengthLimit))
         loopFinder.nBestDurations = durationValues
@@ -399,6 +416,7 @@ class MusicSettings {
         if loopFinder.overlapPercent != old_overlapPercent { return true }
         if loopFinder.useMonoAudio != old_useMonoAudio { return true }
         if loopFinder.framerateReductionFactor != old_framerateReductionFactor { return true }
+        if loopFinder.decimationFilter != old_decimationFilter { return true }
         if loopFinder.framerateReductionLimit != old_framerateReductionLimit { return true }
         if loopFinder.lengthLimit != old_lengthLimit { return true }
         if loopFinder.nBestDurations != old_nBestDurations { return true }
@@ -13,12 +13,16 @@ struct MusicSettingsCodable: Codable {
     var fadeDuration: Double?
     /// Number of tracks to store in history for recalling old tracks and for avoiding repeats when shuffling.
     var shuffleHistoryLength: Int?
+    /// Memory (megabytes) for upcoming shuffle tracks decoded ahead of time. If nil, the default is used.
+    var prefetchMemoryLimit: Double?
     /// Global volume multiplier for all tracks.
     var masterVolume: Double = 1
     /// Default relative volume for newly added tracks.
     var defaultRelativeVolume: Double = MusicTrack.DEFAULT_VOLUME_MULTIPLIER
     /// Volume in LUFS for automatic relative volume normalization.
     var volumeNormalizationLevel: Double?
+    /// Duration (seconds) of the crossfade from the loop end into the loop start. If nil, loops are played without a crossfade.
+    var loopCrossfadeDuration: Double?
     
     /// For time shuffle, the base amount of time (minutes) to shuffle tracks at.
     var shuffleTime: Double?
@@ -62,6 +66,8 @@ struct MusicSettingsCodable: Codable {
     var useMonoAudio: Bool = false
     /// Controls how to reduce the framerate of the audio data before loop-finding. Usually gives a speedup factor equal to the reduction value, but may be less accurate. Values of 7+ may cause algorithm instability.
     var frameRateReduction: Int = 0
+    /// Controls whether to low-pass filter the audio data when reducing its frame rate.
+    var antiAliasFrameRateReduction: Bool?
     /// Limit of frame rate reduction when the loop finder downsamples.
     var frameRateReductionLimit: Double = 0
     /// Proportional to the frame rate reduction limit.
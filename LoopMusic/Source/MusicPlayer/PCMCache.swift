@@ -0,0 +1,297 @@
+import AudioToolbox
+import Foundation
+
+/// On-disk cache of decoded audio, in the format the audio engine plays. Each track is cached in its own file holding a header and the decoded samples, which is memory-mapped so the samples are handed to the audio engine without a copy, and live in the page cache rather than the heap. Tracks are decoded straight into a new cache file, which only becomes usable once decoding finishes. Files are evicted least recently used first once the cache grows past its size limit.
+class PCMCache {
+
+    /// Identifies a cache file.
+    static let MAGIC: UInt32 = 0x4C4D5043
+    /// Version of the cache file layout. Files with another version are ignored.
+    static let VERSION: UInt32 = 1
+    /// Size of the header at the start of each cache file. A whole page, so the samples after it are page-aligned.
+    static let HEADER_SIZE: Int = 16384
+    /// Extension of cache files.
+    static let FILE_EXTENSION: String = "pcm"
+    /// The default most bytes the cache can hold before the least recently used files are evicted.
+    static let DEFAULT_MAX_BYTES: Int64 = 1 << 30
+
+    /// Byte offsets of fields in the header.
+    private static let MAGIC_OFFSET: Int = 0
+    private static let VERSION_OFFSET: Int = 4
+    /// Nonzero once decoding into the file has finished.
+    private static let COMPLETE_OFFSET: Int = 8
+    private static let NUM_FRAMES_OFFSET: Int = 16
+    /// Modification date of the source file, as seconds since the reference date. 0 if unknown.
+    private static let SOURCE_MODIFIED_OFFSET: Int = 24
+    private static let AUDIO_DESC_OFFSET: Int = 32
+    /// Length of the source URL in bytes, followed by the URL itself.
+    private static let URL_LENGTH_OFFSET: Int = 80
+    private static let URL_OFFSET: Int = 84
+
+    /// Singleton instance, stored in the app's caches directory.
+    static let cache: PCMCache = PCMCache(directory: FileManager.default.urls(for: .cachesDirectory, in: .userDomainMask)[0].appendingPathComponent("DecodedAudio"), maxBytes: DEFAULT_MAX_BYTES)
+
+    /// A cache file mapped into memory.
+    private struct Mapping {
+        /// Start of the mapped file, at its header.
+        let base: UnsafeMutableRawPointer
+        /// Size of the mapped file in bytes.
+        let size: Int
+        /// The cache file.
+        let fileUrl: URL
+        /// True if the file is still being decoded into, so it's deleted if unmapped before it's committed.
+        var writable: Bool
+    }
+
+    /// Directory holding the cache files.
+    let directory: URL
+    /// The most bytes the cache can hold before the least recently used files are evicted.
+    var maxBytes: Int64
+
+    /// Mapped cache files, keyed by the start of their samples. Guarded by mappingLock, since tracks are preloaded in the background.
+    private var mappings: [UnsafeMutableRawPointer: Mapping] = [:]
+    /// Guards mappings.
+    private let mappingLock: NSLock = NSLock()
+
+    /// Creates a cache stored in the given directory.
+    /// - parameter directory: Directory to hold the cache files. Created if it doesn't exist.
+    /// - parameter maxBytes: The most bytes the cache can hold before the least recently used files are evicted.
+    init(directory: URL, maxBytes: Int64) {
+        self.directory = directory
+        self.maxBytes = maxBytes
+        try? FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true, attributes: nil)
+    }
+
+    /// Maps the cached audio of a track, if the cache holds a complete copy decoded from the same source.
+    /// - parameter url: URL of the source audio file.
+    /// - parameter numFrames: The number of frames in the source audio file.
+    /// - parameter audioDesc: Audio description the source audio is decoded to.
+    /// - returns: The cached samples, to be released with unmap, or nil if the track isn't cached.
+    func map(url: URL, numFrames: Int64, audioDesc: AudioStreamBasicDescription) -> UnsafeMutableRawPointer? {
+        /// The track's cache file.
+        let fileUrl: URL = cacheFileUrl(url: url)
+        /// Expected size of the cache file.
+        let size: Int = PCMCache.HEADER_SIZE + Int(numFrames) * Int(audioDesc.mBytesPerFrame)
+        /// Descriptor of the cache file.
+        let fd: Int32 = open(fileUrl.path, O_RDONLY)
+        if fd < 0 {
+            return nil
+        }
+        defer {
+            close(fd)
+        }
+        /// Status of the cache file.
+        var fileStat: stat = stat()
+        if fstat(fd, &fileStat) != 0 || Int(fileStat.st_size) != size {
+            return nil
+        }
+        // Read-only and private, so the samples can never be written through by mistake.
+        guard let base: UnsafeMutableRawPointer = mmap(nil, size, PROT_READ, MAP_PRIVATE, fd, 0), base != MAP_FAILED else {
+            return nil
+        }
+        if !isHeaderValid(base: base, url: url, numFrames: numFrames, audioDesc: audioDesc) {
+            munmap(base, size)
+            return nil
+        }
+        // Mark the file as recently used for eviction.
+        try? FileManager.default.setAttributes([.modificationDate: Date()], ofItemAtPath: fileUrl.path)
+        return addMapping(Mapping(base: base, size: size, fileUrl: fileUrl, writable: false))
+    }
+
+    /// Creates a cache file for a track and maps it for decoding into. The file is zero-filled, and only becomes usable by map once committed.
+    /// - parameter url: URL of the source audio file.
+    /// - parameter numFrames: The number of frames in the source audio file.
+    /// - parameter audioDesc: Audio description the source audio is decoded to.
+    /// - returns: Memory for the samples, to be released with unmap, or nil if the cache file can't be created.
+    func create(url: URL, numFrames: Int64, audioDesc: AudioStreamBasicDescription) -> UnsafeMutableRawPointer? {
+        /// The track's cache file.
+        let fileUrl: URL = cacheFileUrl(url: url)
+        /// Size of the cache file.
+        let size: Int = PCMCache.HEADER_SIZE + Int(numFrames) * Int(audioDesc.mBytesPerFrame)
+        if Int64(size) > maxBytes {
+            return nil
+        }
+        evict(neededBytes: Int64(size))
+        // Replace any stale copy, which may still be mapped by a player that hasn't unmapped it yet.
+        unlink(fileUrl.path)
+        /// Descriptor of the cache file.
+        let fd: Int32 = open(fileUrl.path, O_RDWR | O_CREAT | O_EXCL, 0o644)
+        if fd < 0 {
+            return nil
+        }
+        defer {
+            close(fd)
+        }
+        // Extending the file leaves a hole, so pages are only allocated as they're decoded into.
+        if ftruncate(fd, off_t(size)) != 0 {
+            unlink(fileUrl.path)
+            return nil
+        }
+        guard let base: UnsafeMutableRawPointer = mmap(nil, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0), base != MAP_FAILED else {
+            unlink(fileUrl.path)
+            return nil
+        }
+        writeHeader(base: base, url: url, numFrames: numFrames, audioDesc: audioDesc)
+        return addMapping(Mapping(base: base, size: size, fileUrl: fileUrl, writable: true))
+    }
+
+    /// Marks a cache file created with create as fully decoded, so it's used by later loads. Must be called by the owner of the samples, not while they might be unmapped.
+    /// - parameter data: Samples returned by create.
+    func commit(_ data: UnsafeMutableRawPointer) {
+        mappingLock.lock()
+        guard var mapping: Mapping = mappings[data], mapping.writable else {
+            mappingLock.unlock()
+            return
+        }
+        mapping.writable = false
+        mappings[data] = mapping
+        mappingLock.unlock()
+
+        // The samples are already in the page cache, so they're written back in the background rather than waited on.
+        mapping.base.storeBytes(of: 1, toByteOffset: PCMCache.COMPLETE_OFFSET, as: UInt32.self)
+        msync(mapping.base, mapping.size, MS_ASYNC)
+    }
+
+    /// Unmaps samples returned by map or create. Files that were created but never committed are deleted.
+    /// - parameter data: The samples to unmap.
+    /// - returns: True if the samples were mapped by the cache, or false if they belong to something else.
+    @discardableResult func unmap(_ data: UnsafeMutableRawPointer) -> Bool {
+        mappingLock.lock()
+        guard let mapping: Mapping = mappings.removeValue(forKey: data) else {
+            mappingLock.unlock()
+            return false
+        }
+        mappingLock.unlock()
+        munmap(mapping.base, mapping.size)
+        if mapping.writable {
+            unlink(mapping.fileUrl.path)
+        }
+        return true
+    }
+
+    /// Deletes every cache file. Files that are still mapped stay readable until unmapped.
+    func clear() {
+        for file in cacheFiles() {
+            unlink(file.url.path)
+        }
+    }
+
+    /// Gets the total size of the cache files in bytes.
+    var totalBytes: Int64 {
+        get {
+            return cacheFiles().reduce(0) { $0 + $1.size }
+        }
+    }
+
+    /// Records a mapping.
+    /// - parameter mapping: The mapping to record.
+    /// - returns: The start of the mapping's samples.
+    private func addMapping(_ mapping: Mapping) -> UnsafeMutableRawPointer {
+        /// Start of the samples after the header.
+        let data: UnsafeMutableRawPointer = mapping.base + PCMCache.HEADER_SIZE
+        mappingLock.lock()
+        mappings[data] = mapping
+        mappingLock.unlock()
+        return data
+    }
+
+    /// Deletes the least recently used cache files until there's room for the given number of bytes.
+    /// - parameter neededBytes: The number of bytes about to be added to the cache.
+    private func evict(neededBytes: Int64) {
+        /// Cache files, least recently used first.
+        let files: [(url: URL, size: Int64, modified: Date)] = cacheFiles().sorted { $0.modified < $1.modified }
+        /// Total size of the cache files that are kept.
+        var totalBytes: Int64 = files.reduce(0) { $0 + $1.size }
+        for file in files {
+            if totalBytes + neededBytes <= maxBytes {
+                break
+            }
+            // Files that are still mapped stay readable until unmapped.
+            unlink(file.url.path)
+            totalBytes -= file.size
+        }
+    }
+
+    /// Lists the cache files.
+    /// - returns: Each cache file with its size and when it was last used.
+    private func cacheFiles() -> [(url: URL, size: Int64, modified: Date)] {
+        /// Every file in the cache directory.
+        let urls: [URL] = (try? FileManager.default.contentsOfDirectory(at: directory, includingPropertiesForKeys: [.fileSizeKey, .contentModificationDateKey], options: [])) ?? []
+        return urls.filter { $0.pathExtension == PCMCache.FILE_EXTENSION }.map { url in
+            /// Size and modification date of the file.
+            let values: URLResourceValues? = try? url.resourceValues(forKeys: [.fileSizeKey, .contentModificationDateKey])
+            return (url: url, size: Int64(values?.fileSize ?? 0), modified: values?.contentModificationDate ?? Date.distantPast)
+        }
+    }
+
+    /// Gets the cache file for a track. The file is named after a stable hash of the source URL, and the URL itself is checked against the header to rule out collisions.
+    /// - parameter url: URL of the source audio file.
+    /// - returns: URL of the cache file.
+    private func cacheFileUrl(url: URL) -> URL {
+        // FNV-1a, since Swift's own hashes change between launches.
+        /// Hash of the source URL.
+        var hash: UInt64 = 0xcbf29ce484222325
+        for byte in url.absoluteString.utf8 {
+            hash = (hash ^ UInt64(byte)) &* 0x100000001b3
+        }
+        return directory.appendingPathComponent(String(format: "%016llx", hash)).appendingPathExtension(PCMCache.FILE_EXTENSION)
+    }
+
+    /// Gets the modification date of a source audio file, so a cached copy is invalidated when the source changes.
+    /// - parameter url: URL of the source audio file.
+    /// - returns: The modification date as seconds since the reference date, or 0 if it isn't known, such as for media library items.
+    private static func sourceModified(url: URL) -> Double {
+        if !url.isFileURL {
+            return 0
+        }
+        /// Attributes of the source file.
+        let attributes: [FileAttributeKey: Any]? = try? FileManager.default.attributesOfItem(atPath: url.path)
+        return (attributes?[.modificationDate] as? Date)?.timeIntervalSinceReferenceDate ?? 0
+    }
+
+    /// Writes the header of a new cache file, marked incomplete.
+    /// - parameter base: Start of the mapped file.
+    /// - parameter url: URL of the source audio file.
+    /// - parameter numFrames: The number of frames in the source audio file.
+    /// - parameter audioDesc: Audio description the source audio is decoded to.
+    private func writeHeader(base: UnsafeMutableRawPointer, url: URL, numFrames: Int64, audioDesc: AudioStreamBasicDescription) {
+        /// The source URL, truncated to fit in the header.
+        let urlBytes: [UInt8] = Array(url.absoluteString.utf8.prefix(PCMCache.HEADER_SIZE - PCMCache.URL_OFFSET))
+        base.storeBytes(of: PCMCache.MAGIC, toByteOffset: PCMCache.MAGIC_OFFSET, as: UInt32.self)
+        base.storeBytes(of: PCMCache.VERSION, toByteOffset: PCMCache.VERSION_OFFSET, as: UInt32.self)
+        base.storeBytes(of: 0, toByteOffset: PCMCache.COMPLETE_OFFSET, as: UInt32.self)
+        base.storeBytes(of: numFrames, toByteOffset: PCMCache.NUM_FRAMES_OFFSET, as: Int64.self)
+        base.storeBytes(of: PCMCache.sourceModified(url: url), toByteOffset: PCMCache.SOURCE_MODIFIED_OFFSET, as: Double.self)
+        base.storeBytes(of: audioDesc, toByteOffset: PCMCache.AUDIO_DESC_OFFSET, as: AudioStreamBasicDescription.self)
+        base.storeBytes(of: UInt32(urlBytes.count), toByteOffset: PCMCache.URL_LENGTH_OFFSET, as: UInt32.self)
+        (base + PCMCache.URL_OFFSET).copyMemory(from: urlBytes, byteCount: urlBytes.count)
+    }
+
+    /// Checks whether a mapped cache file is complete and was decoded from the given source.
+    /// - parameter base: Start of the mapped file.
+    /// - parameter url: URL of the source audio file.
+    /// - parameter numFrames: The number of frames in the source audio file.
+    /// - parameter audioDesc: Audio description the source audio is decoded to.
+    /// - returns: True if the cached samples can be used.
+    private func isHeaderValid(base: UnsafeMutableRawPointer, url: URL, numFrames: Int64, audioDesc: AudioStreamBasicDescription) -> Bool {
+        /// Audio description the cached samples were decoded to.
+        let cachedAudioDesc: AudioStreamBasicDescription = base.load(fromByteOffset: PCMCache.AUDIO_DESC_OFFSET, as: AudioStreamBasicDescription.self)
+        /// The source URL, truncated to fit in the header.
+        let urlBytes: [UInt8] = Array(url.absoluteString.utf8.prefix(PCMCache.HEADER_SIZE - PCMCache.URL_OFFSET))
+        /// Length of the cached source URL in bytes.
+        let cachedUrlLength: Int = Int(base.load(fromByteOffset: PCMCache.URL_LENGTH_OFFSET, as: UInt32.self))
+        return base.load(fromByteOffset: PCMCache.MAGIC_OFFSET, as: UInt32.self) == PCMCache.MAGIC
+            && base.load(fromByteOffset: PCMCache.VERSION_OFFSET, as: UInt32.self) == PCMCache.VERSION
+            && base.load(fromByteOffset: PCMCache.COMPLETE_OFFSET, as: UInt32.self) != 0
+            && base.load(fromByteOffset: PCMCache.NUM_FRAMES_OFFSET, as: Int64.self) == numFrames
+            && base.load(fromByteOffset: PCMCache.SOURCE_MODIFIED_OFFSET, as: Double.self) == PCMCache.sourceModified(url: url)
+            && cachedAudioDesc.mSampleRate == audioDesc.mSampleRate
+            && cachedAudioDesc.mFormatID == audioDesc.mFormatID
+            && cachedAudioDesc.mFormatFlags == audioDesc.mFormatFlags
+            && cachedAudioDesc.mBytesPerFrame == audioDesc.mBytesPerFrame
+            && cachedAudioDesc.mChannelsPerFrame == audioDesc.mChannelsPerFrame
+            && cachedAudioDesc.mBitsPerChannel == audioDesc.mBitsPerChannel
+            && cachedUrlLength == urlBytes.count
+            && memcmp(base + PCMCache.URL_OFFSET, urlBytes, urlBytes.count) == 0
+    }
+}
@@ -0,0 +1,254 @@
+import AudioToolbox
+import Foundation
+
+/// Decodes an audio file into memory on several threads at once. The frames to decode are split into chunks, tracked in a DecodeProgress map that the audio engine can also read. Each worker has its own handle on the file and claims chunks one at a time, decoding each straight into its own slice of the audio buffer, so workers never wait on each other. Chunks requested by the audio engine, such as around the loop points or a seek target, are decoded first.
+class ParallelDecoder {
+
+    /// The fewest frames decoded by each worker. Short tracks use fewer workers, since opening the file has a cost of its own.
+    static let MIN_WORKER_FRAMES: Int = 524288
+
+    /// Map of decoded chunks, readable from any thread while decoding.
+    let progress: OpaquePointer
+
+    /// URL of the audio file to decode.
+    private let url: URL
+    /// Buffer the decoded audio is written into, holding at least the frames being decoded.
+    private let audioData: UnsafeMutableRawPointer
+    /// Audio description of the decoded audio.
+    private let audioDesc: AudioStreamBasicDescription
+    /// The number of workers decoding at once.
+    private let numWorkers: Int
+    /// Tracks when every worker has finished.
+    private let group: DispatchGroup = DispatchGroup()
+    /// Guards the first error hit by any worker. Only taken when a worker fails.
+    private let errorLock: NSLock = NSLock()
+    /// The first error hit by any worker, if any.
+    private var error: Error?
+
+    /// Measures the loudness of the decoded audio from the start of the track, if requested. Only used on the meter queue.
+    private var loudnessMeter: OpaquePointer?
+    /// Serial queue the loudness meter is fed on as chunks finish, so workers never wait on it.
+    private let meterQueue: DispatchQueue = DispatchQueue(label: "ParallelDecoder.meter", qos: DispatchQoS.utility)
+    /// The frame the loudness meter has measured up to.
+    private var meterFrame: Int64 = 0
+    /// The frame the loudness meter stops at.
+    private var meterEndFrame: Int64 = 0
+    /// Integrated loudness in LUFS of the metered frames, once every one of them has been decoded and measured. Nil if loudness isn't being metered or measuring failed.
+    private(set) var loudness: Double?
+
+    /// True once every chunk has been decoded, whether or not decoding succeeded.
+    var finished: Bool {
+        get {
+            return isDecodeFinished(progress)
+        }
+    }
+
+    /// Prepares to decode part of an audio file.
+    /// - parameter url: URL of the audio file to decode.
+    /// - parameter audioData: Buffer to decode into.
+    /// - parameter audioDesc: Audio description of the decoded audio, as returned by MusicPlayer.openAudioFile.
+    /// - parameter firstFrame: The first frame to decode. Frames before this are expected to be decoded already.
+    /// - parameter numFrames: The number of frames in the audio file.
+    init(url: URL, audioData: UnsafeMutableRawPointer, audioDesc: AudioStreamBasicDescription, firstFrame: Int64, numFrames: Int64) throws {
+        self.url = url
+        self.audioData = audioData
+        self.audioDesc = audioDesc
+
+        /// The number of frames left to decode.
+        let framesToDecode: Int = max(Int(numFrames - firstFrame), 0)
+        /// Enough workers to keep every core busy, but none with less than the minimum to decode.
+        numWorkers = max(1, min(ProcessInfo.processInfo.activeProcessorCount, framesToDecode / ParallelDecoder.MIN_WORKER_FRAMES))
+        guard let progress: OpaquePointer = createDecodeProgress(firstFrame, numFrames, Int64(MusicPlayer.SAMPLE_READ_INCREMENT)) else {
+            throw MessageError("Failed to allocate decode progress.")
+        }
+        self.progress = progress
+    }
+
+    deinit {
+        cancel()
+        disposeDecodeProgress(progress)
+        if let loudnessMeter: OpaquePointer = loudnessMeter {
+            disposeLoudnessMeter(loudnessMeter)
+        }
+    }
+
+    /// Measures the integrated loudness of the start of the track as it's decoded, without a copy of the audio. Frames are measured in order, each contiguous run as soon as it's decoded, so the loudness is ready when decoding finishes. Must be called before start.
+    /// - parameter numFrames: The number of frames from the start of the track to measure.
+    func meterLoudness(numFrames: Int64) throws {
+        /// Audio description of the decoded audio.
+        var audioDesc: AudioStreamBasicDescription = self.audioDesc
+        /// Format of the decoded samples.
+        var sampleFormat: SampleFormat = SampleFormatFloat32
+        if sampleFormatFromAudioDesc(&audioDesc, &sampleFormat) != 0 {
+            throw MessageError("Audio data is empty or not supported.")
+        }
+        guard let loudnessMeter: OpaquePointer = createLoudnessMeter(audioDesc.mChannelsPerFrame, audioDesc.mSampleRate, sampleFormat) else {
+            throw MessageError("Failed to allocate loudness meter.")
+        }
+        self.loudnessMeter = loudnessMeter
+        meterEndFrame = numFrames
+    }
+
+    /// Starts the workers.
+    /// - parameter qos: Quality of service to decode with.
+    /// - parameter completion: Called on the main thread once every worker has finished, unless decoding was cancelled.
+    func start(qos: DispatchQoS, completion: @escaping () -> Void) {
+        if loudnessMeter != nil {
+            // Frames decoded before starting are measured right away.
+            meterQueue.async(group: group) {
+                self.meterDecodedFrames()
+            }
+        }
+        for _ in 0..<numWorkers {
+            DispatchQueue.global(qos: qos.qosClass).async(group: group) {
+                self.decodeChunks()
+            }
+        }
+        group.notify(queue: DispatchQueue.main) {
+            if !isDecodeCancelled(self.progress) {
+                completion()
+            }
+        }
+    }
+
+    /// Waits for every worker to finish.
+    /// - throws: The first error hit by any worker.
+    func wait() throws {
+        group.wait()
+        if let error: Error = error {
+            throw error
+        }
+    }
+
+    /// Stops every worker and waits for them to finish, so the audio buffer can be freed.
+    func cancel() {
+        cancelDecode(progress)
+        group.wait()
+    }
+
+    /// Claims and decodes chunks until none are left. Runs on each worker.
+    private func decodeChunks() {
+        // Each worker needs its own file, since a file can only be read from one position at a time.
+        /// The worker's handle on the audio file, or nil if it couldn't be opened.
+        var audioFile: ExtAudioFileRef? = nil
+        do {
+            (audioFile, _, _) = try MusicPlayer.openAudioFile(url: url)
+        } catch {
+            recordError(error)
+        }
+        defer {
+            if let audioFile: ExtAudioFileRef = audioFile {
+                ExtAudioFileDispose(audioFile)
+            }
+        }
+
+        let loadBuffer: UnsafeMutableAudioBufferListPointer = AudioBufferList.allocate(maximumBuffers: 1)
+        defer {
+            free(loadBuffer.unsafeMutablePointer)
+        }
+        /// The frame the file is positioned at, so contiguous chunks are read without seeking.
+        var fileFrame: Int64 = -1
+        /// The chunk being decoded.
+        var chunk: UInt32 = 0
+        while claimDecodeChunk(progress, &chunk) {
+            // Chunks are still claimed and finished if the file couldn't be opened, so the audio engine never waits on them.
+            if let audioFile: ExtAudioFileRef = audioFile {
+                do {
+                    fileFrame = try decodeChunk(chunk, audioFile: audioFile, loadBuffer: loadBuffer, fileFrame: fileFrame)
+                } catch {
+                    recordError(error)
+                    fileFrame = -1
+                }
+            }
+            finishDecodeChunk(progress, chunk)
+            if loudnessMeter != nil {
+                meterQueue.async(group: group) {
+                    self.meterDecodedFrames()
+                }
+            }
+        }
+    }
+
+    /// Feeds the loudness meter every decoded frame following those already measured. Runs on the meter queue after each chunk finishes, so the last run sees every chunk.
+    private func meterDecodedFrames() {
+        guard let loudnessMeter: OpaquePointer = loudnessMeter, meterFrame < meterEndFrame, !isDecodeCancelled(progress) else {
+            return
+        }
+        /// Frame just past the decoded run following the measured frames.
+        var endFrame: Int64 = meterFrame
+        while endFrame < meterEndFrame {
+            /// Frame just past the next span to check.
+            let nextFrame: Int64 = min(endFrame + Int64(MusicPlayer.SAMPLE_READ_INCREMENT), meterEndFrame)
+            if !isFrameRangeDecoded(progress, endFrame, nextFrame) {
+                break
+            }
+            endFrame = nextFrame
+        }
+        if endFrame == meterFrame {
+            return
+        }
+        if addLoudnessMeterFrames(loudnessMeter, audioData + Int(meterFrame) * Int(audioDesc.mBytesPerFrame), Int(endFrame - meterFrame)) != 0 {
+            // Stop measuring, leaving the loudness unknown.
+            meterEndFrame = meterFrame
+            return
+        }
+        meterFrame = endFrame
+        if meterFrame == meterEndFrame {
+            /// Integrated loudness of every metered frame.
+            var loudness: Double = 0
+            if getLoudnessMeterLoudness(loudnessMeter, &loudness) == 0 {
+                self.loudness = loudness
+            }
+        }
+    }
+
+    /// Decodes one chunk into its slice of the audio buffer.
+    /// - parameter chunk: Index of the chunk to decode.
+    /// - parameter audioFile: The worker's handle on the audio file.
+    /// - parameter loadBuffer: Buffer list to point at the slice being decoded into.
+    /// - parameter fileFrame: The frame the file is positioned at, or -1 if unknown.
+    /// - returns: The frame the file is positioned at afterwards.
+    private func decodeChunk(_ chunk: UInt32, audioFile: ExtAudioFileRef, loadBuffer: UnsafeMutableAudioBufferListPointer, fileFrame: Int64) throws -> Int64 {
+        /// First frame of the chunk.
+        let startFrame: Int64 = getDecodeChunkStart(progress, chunk)
+        /// Frame just past the end of the chunk.
+        let endFrame: Int64 = getDecodeChunkEnd(progress, chunk)
+        if startFrame != fileFrame {
+            /// Holds any errors from Core Audio API calls.
+            let error: OSStatus = ExtAudioFileSeek(audioFile, startFrame)
+            if error != noErr {
+                throw MessageError("Failed to seek audio file.", error)
+            }
+        }
+
+        /// The frame the next read starts at.
+        var frame: Int64 = startFrame
+        while frame < endFrame {
+            /// Number of frames to read in this iteration.
+            var numFrames: UInt32 = UInt32(endFrame - frame)
+            loadBuffer[0] = AudioBuffer(mNumberChannels: audioDesc.mChannelsPerFrame, mDataByteSize: numFrames * audioDesc.mBytesPerFrame, mData: audioData + Int(frame) * Int(audioDesc.mBytesPerFrame))
+            /// Holds any errors from Core Audio API calls.
+            let error: OSStatus = ExtAudioFileRead(audioFile, &numFrames, loadBuffer.unsafeMutablePointer)
+            if error != noErr {
+                throw MessageError("Failed to read audio file.", error)
+            }
+            if numFrames == 0 {
+                // The file is shorter than its reported length.
+                return -1
+            }
+            frame += Int64(numFrames)
+        }
+        return frame
+    }
+
+    /// Keeps the first error hit by any worker, to be thrown by wait.
+    /// - parameter error: The error hit by a worker.
+    private func recordError(_ error: Error) {
+        errorLock.lock()
+        if self.error == nil {
+            self.error = error
+        }
+        errorLock.unlock()
+        print("Error decoding audio:", error.localizedDescription)
+    }
+}
@@ -0,0 +1,124 @@
+import CoreAudio
+import MediaPlayer
+
+/// A track decoded ahead of time so playback can be handed off to it without a gap.
+struct PreloadedTrack {
+    /// The media item the track was loaded from.
+    let mediaItem: MPMediaItem
+    /// Track settings loaded from the database.
+    let track: MusicTrack
+    /// Fully decoded audio data for the track.
+    let audioBuffer: AudioBuffer
+    /// Audio description of the decoded audio data.
+    let audioDesc: AudioStreamBasicDescription
+    /// Number of samples in the decoded audio data across all channels.
+    let numSamples: Int64
+}
+
+/// Decoded tracks kept in memory ahead of shuffling to them, so switching to one only swaps in its audio. Holds at most a fixed number of bytes of decoded audio, evicting the least recently used tracks first. Only used from the main thread.
+class PrefetchCache {
+
+    /// Cached tracks, least recently used first.
+    private var tracks: [PreloadedTrack] = []
+    /// Frees the decoded audio of tracks evicted from the cache.
+    private let freeAudioData: (AudioBuffer) -> Void
+
+    /// The most bytes of decoded audio the cache can hold. 0 disables the cache. Lowering it evicts tracks right away.
+    var maxBytes: Int64 {
+        didSet {
+            evict(neededBytes: 0, keeping: [])
+        }
+    }
+
+    /// The number of bytes of decoded audio in the cache.
+    private(set) var totalBytes: Int64 = 0
+
+    /// The number of tracks in the cache.
+    var count: Int {
+        get {
+            return tracks.count
+        }
+    }
+
+    /// Creates an empty cache.
+    /// - parameter maxBytes: The most bytes of decoded audio the cache can hold.
+    /// - parameter freeAudioData: Frees the decoded audio of tracks evicted from the cache.
+    init(maxBytes: Int64, freeAudioData: @escaping (AudioBuffer) -> Void) {
+        self.maxBytes = maxBytes
+        self.freeAudioData = freeAudioData
+    }
+
+    deinit {
+        removeAll()
+    }
+
+    /// Checks whether a track is in the cache, without counting as a use.
+    /// - parameter mediaItem: The track to look for.
+    /// - returns: True if the track is in the cache.
+    func contains(_ mediaItem: MPMediaItem) -> Bool {
+        return tracks.contains { $0.mediaItem == mediaItem }
+    }
+
+    /// Adds a decoded track to the cache, evicting the least recently used tracks to make room. If it doesn't fit, its audio is freed instead.
+    /// - parameter track: The decoded track. The cache takes ownership of its audio.
+    /// - parameter keeping: Tracks that are not evicted to make room, such as the other upcoming tracks.
+    /// - returns: True if the track was added.
+    @discardableResult func insert(_ track: PreloadedTrack, keeping: [MPMediaItem]) -> Bool {
+        /// Size of the decoded audio in bytes.
+        let size: Int64 = Int64(track.audioBuffer.mDataByteSize)
+        if contains(track.mediaItem) || !evict(neededBytes: size, keeping: keeping) {
+            freeAudioData(track.audioBuffer)
+            return false
+        }
+        tracks.append(track)
+        totalBytes += size
+        return true
+    }
+
+    /// Removes a track from the cache, handing ownership of its audio to the caller.
+    /// - parameter mediaItem: The track to remove.
+    /// - returns: The decoded track, or nil if it isn't in the cache.
+    func take(_ mediaItem: MPMediaItem) -> PreloadedTrack? {
+        guard let index: Int = tracks.firstIndex(where: { $0.mediaItem == mediaItem }) else {
+            return nil
+        }
+        /// The removed track.
+        let track: PreloadedTrack = tracks.remove(at: index)
+        totalBytes -= Int64(track.audioBuffer.mDataByteSize)
+        return track
+    }
+
+    /// Frees every track in the cache.
+    func removeAll() {
+        for track in tracks {
+            freeAudioData(track.audioBuffer)
+        }
+        tracks.removeAll()
+        totalBytes = 0
+    }
+
+    /// Evicts the least recently used tracks until there is room for the given number of bytes.
+    /// - parameter neededBytes: The number of bytes to make room for.
+    /// - parameter keeping: Tracks that are not evicted.
+    /// - returns: True if there is room, or false if there can't be without evicting a kept track. Nothing is evicted if there can't be room.
+    @discardableResult private func evict(neededBytes: Int64, keeping: [MPMediaItem]) -> Bool {
+        /// Bytes held by tracks that can't be evicted.
+        let keptBytes: Int64 = tracks.filter { keeping.contains($0.mediaItem) }.reduce(0) { $0 + Int64($1.audioBuffer.mDataByteSize) }
+        if neededBytes > 0 && keptBytes + neededBytes > maxBytes {
+            return false
+        }
+        /// Index of the next track to consider evicting.
+        var index: Int = 0
+        while totalBytes + neededBytes > maxBytes && index < tracks.count {
+            if keeping.contains(tracks[index].mediaItem) {
+                index += 1
+                continue
+            }
+            /// The evicted track.
+            let track: PreloadedTrack = tracks.remove(at: index)
+            totalBytes -= Int64(track.audioBuffer.mDataByteSize)
+            freeAudioData(track.audioBuffer)
+        }
+        return true
+    }
+}
@@ -1,10 +1,27 @@
 #include "AudioUtils.h"
 #include "ebur128.h"
+#include <dispatch/dispatch.h>
+#include <unistd.h>
 
 const float DB_REFERENCE_POWER = 1e-12;
 // LUFS of a mono-channel, 997 Hz sine wave with a power of DB_REFERENCE_POWER (amplitude = sqrt(2)*1e-6). According to the standard, a three-channel, 997 Hz sine wave at 0 dB FS (max amplitude) should have a loudness of exactly -3.01 LUFS, which means that a mono-channel signal should have a loudness of (-3.01 - 10*log10(3)) LUFS. With an amplitude multiplier of sqrt(2)*1e-6, this becomes (-3.01 - 120 + 10*log10(2/3)) = -124.77 LUFS. Note that since LUFS is a frequency-dependent measurement, this is sort of an arbitrary reference point, but it's low enough to be reasonable.
 const float DB_REFERENCE_LUFS = -124.77;
 
+/// The most input frames of one channel converted at a time by audioFormatToFloatFormat, so each block stays in cache between conversion and averaging.
+#define CONVERT_BLOCK_FRAMES 8192
+/// Transition band of a Blackman-windowed FIR filter, as a multiple of the input framerate divided by the number of taps.
+#define FIR_BLACKMAN_TRANSITION 5.5f
+/// The narrowest FIR transition band allowed, as a fraction of the reduced framerate, to bound the number of taps.
+#define FIR_MIN_TRANSITION_WIDTH 0.05f
+/// The most frames converted at a time by a loudness meter.
+#define LOUDNESS_METER_BLOCK_FRAMES 4096
+/// Length of a loudness gating block, in 100 ms hops.
+#define LOUDNESS_HOPS_PER_BLOCK 4
+/// Audio measured before each parallel loudness segment so its K-weighting filter state matches a serial measurement, in 100 ms hops. The filters settle within a few milliseconds, so this is far more than enough.
+#define LOUDNESS_WARMUP_HOPS 10
+/// The fewest 100 ms hops in each parallel loudness segment, so warming up stays a small part of the work.
+#define LOUDNESS_MIN_SEGMENT_HOPS 300
+
 // Internal helpers
 long max(long a, long b) {
     return a > b ? a : b;
@@ -13,6 +30,78 @@ long min(long a, long b) {
     return a < b ? a : b;
 }
 
+int sampleFormatFromAudioDesc(const AudioStreamBasicDescription *audioDesc, SampleFormat *sampleFormat)
+{
+    if (audioDesc->mFormatID != kAudioFormatLinearPCM || (audioDesc->mFormatFlags & kAudioFormatFlagIsBigEndian))
+    {
+        return -1;
+    }
+    if (audioDesc->mFormatFlags & kAudioFormatFlagIsFloat)
+    {
+        if (audioDesc->mBitsPerChannel != 32)
+        {
+            return -1;
+        }
+        *sampleFormat = SampleFormatFloat32;
+        return 0;
+    }
+    switch (audioDesc->mBitsPerChannel)
+    {
+        case 16:
+            *sampleFormat = SampleFormatInt16;
+            return 0;
+        case 24:
+            *sampleFormat = SampleFormatInt24;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+UInt32 bytesPerSample(SampleFormat sampleFormat)
+{
+    switch (sampleFormat)
+    {
+        case SampleFormatInt16:
+            return 2;
+        case SampleFormatInt24:
+            return 3;
+        default:
+            return 4;
+    }
+}
+
+void convertSamplesToFloat(const void *src, vDSP_Stride srcStride, SampleFormat sampleFormat, float gain, float *dst, vDSP_Stride dstStride, vDSP_Length n)
+{
+    switch (sampleFormat)
+    {
+        case SampleFormatInt16:
+        {
+            // Convert into the output buffer, then normalize it in place to [-1, 1).
+            float scale = gain / 32768;
+            vDSP_vflt16(src, srcStride, dst, dstStride, n);
+            vDSP_vsmul(dst, dstStride, &scale, dst, dstStride, n);
+            break;
+        }
+        case SampleFormatInt24:
+        {
+            // vDSP has no 24-bit conversion. Placing the three bytes at the top of a 32-bit integer sign-extends the sample, and the scale accounts for the extra 8 bits. Written as a simple loop so it auto-vectorizes for contiguous samples.
+            const float scale = gain / 2147483648.0f;
+            const UInt8 *bytes = src;
+            for (vDSP_Length i = 0; i < n; i++)
+            {
+                const UInt8 *sample = bytes + 3 * i * srcStride;
+                const SInt32 value = (SInt32)((UInt32)sample[0] << 8 | (UInt32)sample[1] << 16 | (UInt32)sample[2] << 24);
+                dst[i * dstStride] = value * scale;
+            }
+            break;
+        }
+        default:
+            vDSP_vsmul(src, srcStride, &gain, dst, dstStride, n);
+            break;
+    }
+}
+
 float powToDB(float power)
 {
     return 10 * log10(power / DB_REFERENCE_POWER);
@@ -34,58 +123,176 @@ float calcAvgVolume(const AudioDataFloat *audioFloat)
     return powToDB(calcAvgPow(audioFloat));
 }
 
-// Returns 0 on success, -1 on failure.
-int calcIntegratedLoudness(const AudioData_ebur128 *processedAudio, double *loudness)
+struct LoudnessMeter
 {
-    ebur128_state *state = ebur128_init(processedAudio->numChannels, processedAudio->framerate, EBUR128_MODE_I);
-    if (!state)
+    /// libebur128 state holding the measurement so far.
+    ebur128_state *state;
+    /// The number of interleaved channels.
+    UInt32 numChannels;
+    /// The format of added samples.
+    SampleFormat sampleFormat;
+    /// Buffer integer samples are converted into before measuring, holding LOUDNESS_METER_BLOCK_FRAMES frames. NULL for float samples, which are measured in place.
+    float *block;
+};
+LoudnessMeter *createLoudnessMeter(UInt32 numChannels, double sampleRate, SampleFormat sampleFormat)
+{
+    LoudnessMeter *meter = calloc(1, sizeof(LoudnessMeter));
+    if (!meter)
     {
-        return -1;
+        return NULL;
+    }
+    meter->numChannels = numChannels;
+    meter->sampleFormat = sampleFormat;
+    meter->state = ebur128_init(numChannels, round(sampleRate), EBUR128_MODE_I);
+    if (sampleFormat != SampleFormatFloat32)
+    {
+        meter->block = malloc(LOUDNESS_METER_BLOCK_FRAMES * numChannels * sizeof(float));
+    }
+    if (!meter->state || (sampleFormat != SampleFormatFloat32 && !meter->block))
+    {
+        disposeLoudnessMeter(meter);
+        return NULL;
+    }
+    return meter;
+}
+void disposeLoudnessMeter(LoudnessMeter *meter)
+{
+    if (meter->state)
+    {
+        ebur128_destroy(&meter->state);
+    }
+    free(meter->block);
+    free(meter);
+}
+int addLoudnessMeterFrames(LoudnessMeter *meter, const void *frames, long numFrames)
+{
+    if (!meter->block)
+    {
+        return ebur128_add_frames_float(meter->state, frames, numFrames) == EBUR128_SUCCESS ? 0 : -1;
     }
+    // Interleaved frames are converted as one run of samples, a block at a time.
+    const UInt8 *src = frames;
+    const UInt32 frameSize = meter->numChannels * bytesPerSample(meter->sampleFormat);
+    for (long start = 0; start < numFrames; start += LOUDNESS_METER_BLOCK_FRAMES)
+    {
+        long n = min(LOUDNESS_METER_BLOCK_FRAMES, numFrames - start);
+        convertSamplesToFloat(src + start * frameSize, 1, meter->sampleFormat, 1, meter->block, 1, n * meter->numChannels);
+        if (ebur128_add_frames_float(meter->state, meter->block, n) != EBUR128_SUCCESS)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+int getLoudnessMeterLoudness(LoudnessMeter *meter, double *loudness)
+{
+    return ebur128_loudness_global(meter->state, loudness) == EBUR128_SUCCESS ? 0 : -1;
+}
 
+/// A segment of a track measured by calcIntegratedLoudnessInParallel.
+typedef struct LoudnessSegment
+{
+    /// Meter the segment is measured with.
+    LoudnessMeter *meter;
+    /// First frame measured, including the warm-up.
+    long startFrame;
+    /// First frame of the segment's first gating block. Blocks starting before this are discarded.
+    long blockStartFrame;
+    /// Frame just past the last frame measured. Includes the rest of the segment's last gating block.
+    long endFrame;
+    /// Return code of measuring the segment.
+    int rc;
+} LoudnessSegment;
+/// Context shared by every segment measured by calcIntegratedLoudnessInParallel.
+typedef struct LoudnessSegments
+{
+    /// The track being measured.
+    const AudioData *audio;
+    /// Frames in each 100 ms hop between gating blocks.
+    long hop;
+    /// The segments.
+    LoudnessSegment *segments;
+} LoudnessSegments;
+static void measureLoudnessSegment(void *context, size_t i)
+{
+    const LoudnessSegments *segments = context;
+    LoudnessSegment *segment = &segments->segments[i];
+    const UInt8 *src = segments->audio->audioBuffer.mData;
+    const long frameSize = segments->audio->audioBuffer.mNumberChannels * bytesPerSample(segments->audio->sampleFormat);
+    // Warm up through every gating block starting before the segment without keeping those blocks. The filters and block timing keep running, so the segment's own blocks are measured as in a serial pass.
+    const long warmupEndFrame = segment->startFrame == segment->blockStartFrame ? segment->startFrame : min(segment->blockStartFrame + (LOUDNESS_HOPS_PER_BLOCK - 1) * segments->hop, segment->endFrame);
+    ebur128_set_store_blocks(segment->meter->state, 0);
+    segment->rc = addLoudnessMeterFrames(segment->meter, src + segment->startFrame * frameSize, warmupEndFrame - segment->startFrame);
+    ebur128_set_store_blocks(segment->meter->state, 1);
+    if (segment->rc == 0)
+    {
+        segment->rc = addLoudnessMeterFrames(segment->meter, src + warmupEndFrame * frameSize, segment->endFrame - warmupEndFrame);
+    }
+}
+int calcIntegratedLoudnessInParallel(const AudioData *audio, long numFrames, double *loudness)
+{
+    if (numFrames > audio->numSamples)
+    {
+        return -1;
+    }
+    
+    // Segments are split on the 100 ms hops gating blocks start on, matching a serial measurement from the first frame.
+    const long hop = ((long)round(audio->sampleRate) + 5) / 10;
+    const long numHops = numFrames / hop;
+    const long numSegments = max(1, min(sysconf(_SC_NPROCESSORS_ONLN), numHops / LOUDNESS_MIN_SEGMENT_HOPS));
+    const long segmentHops = (numHops + numSegments - 1) / numSegments;
+    LoudnessSegment *segments = calloc(numSegments, sizeof(LoudnessSegment));
+    ebur128_state **states = malloc(numSegments * sizeof(ebur128_state *));
     int rc = -1;
-    if (ebur128_add_frames_float(state, processedAudio->data, processedAudio->numFrames) != EBUR128_SUCCESS)
+    if (!segments || !states)
     {
         goto out;
     }
-    if (ebur128_loudness_global(state, loudness) != EBUR128_SUCCESS)
+    for (long i = 0; i < numSegments; i++)
+    {
+        LoudnessSegment *segment = &segments[i];
+        segment->meter = createLoudnessMeter(audio->audioBuffer.mNumberChannels, audio->sampleRate, audio->sampleFormat);
+        if (!segment->meter)
+        {
+            goto out;
+        }
+        states[i] = segment->meter->state;
+        segment->blockStartFrame = i * segmentHops * hop;
+        segment->startFrame = i == 0 ? 0 : segment->blockStartFrame - LOUDNESS_WARMUP_HOPS * hop;
+        // The last segment runs to the end. Others run until their last gating block ends, overlapping the next segment.
+        segment->endFrame = i == numSegments - 1 ? numFrames : min((i + 1) * segmentHops * hop + (LOUDNESS_HOPS_PER_BLOCK - 1) * hop, numFrames);
+    }
+    
+    LoudnessSegments context = {audio, hop, segments};
+    dispatch_apply_f(numSegments, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), &context, measureLoudnessSegment);
+    for (long i = 0; i < numSegments; i++)
+    {
+        if (segments[i].rc != 0)
+        {
+            goto out;
+        }
+    }
+    // Gate the blocks of every segment together, as if measured by one meter.
+    if (ebur128_loudness_global_multiple(states, numSegments, loudness) != EBUR128_SUCCESS)
     {
         goto out;
     }
     rc = 0;
 out:
-    ebur128_destroy(&state);
-    return rc;
-}
-
-int calcIntegratedLoudnessFromBufferFormat(const AudioData *audio, long numSamples, long framerateReductionLimit, long lengthLimit, double *loudness)
-{
-    if (numSamples > audio->numSamples) {
-        return -1;
-    }
-
-    // Convert audio to 32-bit floating point audio, reducing framerate and truncating if necessary.
-    AudioData_ebur128 processedAudio;
-    processedAudio.numChannels = audio->audioBuffer.mNumberChannels;
-    processedAudio.numFrames = calcFrameLimit(numSamples, framerateReductionLimit, lengthLimit);
-    long framerateReductionFactor = calcFramerateReductionFactor(1, processedAudio.numFrames, framerateReductionLimit, lengthLimit);
-    processedAudio.framerate = round(audio->sampleRate / framerateReductionFactor);
-    // This is an interleaved and potentially downsampled data buffer. Integer division will floor.
-    processedAudio.data = malloc(processedAudio.numChannels * processedAudio.numFrames / framerateReductionFactor * sizeof(float));
-    if (!processedAudio.data)
+    if (segments)
     {
-        return -1;
+        for (long i = 0; i < numSegments; i++)
+        {
+            if (segments[i].meter)
+            {
+                disposeLoudnessMeter(segments[i].meter);
+            }
+        }
     }
-
-    prepareAudioForLoudnessCalc(audio, &processedAudio, framerateReductionFactor);
-
-    int rc = calcIntegratedLoudness(&processedAudio, loudness);
-
-    free(processedAudio.data);
-
+    free(segments);
+    free(states);
     return rc;
 }
-
 long calcFrameLimit(long numFrames, long framerateReductionLimit, long lengthLimit)
 {
     // Integer truncation is important here, so we can't just use min.
@@ -105,78 +312,117 @@ long calcFramerateReductionFactor(long framerateReductionFactor, long numFrames,
     return framerateReductionFactor;
 }
 
-void reduceFramerate(float *dataFloat, vDSP_Stride inputStride, vDSP_Length n, long framerateReductionFactor, float *reducedData, vDSP_Stride outputStride)
+Decimator *createDecimator(DecimationFilter filter, long framerateReductionFactor, float transitionWidth)
 {
-    // reducedData should have a length of at least
-    // outputStride*floor(n/framerateReductionFactor) - (outputStride - 1)
-    // in order to fit floor(n/framerateReductionFactor) averaged windows strided
-    // by outputStride within reducedData
-    
-    // No reducing to be done if the factor is 1
-    if (framerateReductionFactor == 1)
+    Decimator *decimator = malloc(sizeof(Decimator));
+    if (!decimator)
     {
-        if (inputStride == 1 && outputStride == 1)
-        {
-            // Common case in which a simple memcpy suffices
-            memcpy(reducedData, dataFloat, n*sizeof(float));
-        }
-        else
+        return NULL;
+    }
+    decimator->factor = framerateReductionFactor;
+    if (filter == DecimationFilterBoxcar || framerateReductionFactor == 1)
+    {
+        // Averaging filter, so decimating by the factor averages each window.
+        decimator->numTaps = framerateReductionFactor;
+        decimator->taps = malloc(decimator->numTaps * sizeof(float));
+        if (!decimator->taps)
         {
-            // Need to use vDSP to handle strided input/output
-            float zero = 0;
-            vDSP_vsadd(dataFloat, inputStride, &zero, reducedData, outputStride, n);
+            free(decimator);
+            return NULL;
         }
-        return;
+        float weight = 1.0f / framerateReductionFactor;
+        vDSP_vfill(&weight, decimator->taps, 1, decimator->numTaps);
+        return decimator;
     }
-
-    vDSP_Length nWindows = max(0, (long)n - framerateReductionFactor + 1);
-    if (nWindows == 0)  // Nothing to be done
-        return;
-    
-    float *slidingSum = malloc(nWindows * sizeof(float));
-    vDSP_vswsum(dataFloat, inputStride, slidingSum, 1, nWindows, framerateReductionFactor);
     
-    float divisor = (float)framerateReductionFactor;
-    vDSP_vsdiv(slidingSum, framerateReductionFactor, &divisor, reducedData, outputStride, n / framerateReductionFactor);   // Integer division will floor n/framerateReductionFactor
+    // A Blackman window has a transition band of about FIR_BLACKMAN_TRANSITION / numTaps of the input framerate. Round up to an odd number of windows so the filter stays centered on the window being reduced, like the boxcar filter.
+    transitionWidth = fminf(fmaxf(transitionWidth, FIR_MIN_TRANSITION_WIDTH), 0.5f);
+    long numWindows = ceilf(FIR_BLACKMAN_TRANSITION / transitionWidth);
+    numWindows += 1 - numWindows % 2;
+    decimator->numTaps = numWindows * framerateReductionFactor;
+    decimator->taps = malloc(decimator->numTaps * sizeof(float));
+    if (!decimator->taps)
+    {
+        free(decimator);
+        return NULL;
+    }
     
-    free(slidingSum);
+    // Put the cutoff in the middle of the transition band, so the stopband starts at the reduced Nyquist frequency.
+    double cutoff = (0.5 - transitionWidth / 2) / framerateReductionFactor;
+    double center = (decimator->numTaps - 1) / 2.0;
+    for (vDSP_Length i = 0; i < decimator->numTaps; i++)
+    {
+        double t = i - center;
+        double sinc = t == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * t) / (M_PI * t);
+        double phase = 2 * M_PI * (i + 0.5) / decimator->numTaps;
+        double window = 0.42 - 0.5 * cos(phase) + 0.08 * cos(2 * phase);
+        decimator->taps[i] = sinc * window;
+    }
+    // Normalize to unit gain at DC.
+    float sum;
+    vDSP_sve(decimator->taps, 1, &sum, decimator->numTaps);
+    vDSP_vsdiv(decimator->taps, 1, &sum, decimator->taps, 1, decimator->numTaps);
+    return decimator;
 }
-void audioFormatToFloatFormat(const AudioData *audio, AudioDataFloat *audioFloat, long framerateReductionFactor)
+void disposeDecimator(Decimator *decimator)
 {
-    vDSP_Stride stride = 1;
-    int numChannels = audio->audioBuffer.mNumberChannels;
-    
-    // Convert audio data to float if not already.
-    float *workArray = audio->audioBuffer.mData;
-    
-    // Convert to non-interleaved audio to populate channels.
-    float* channel0 = malloc(audioFloat->numFrames * sizeof(float));
-    float zero = 0;
-    vDSP_vsadd(workArray, numChannels, &zero, channel0, stride, audioFloat->numFrames);
-    reduceFramerate(channel0, stride, audioFloat->numFrames, framerateReductionFactor, audioFloat->channel0, stride);
-    free(channel0);
-    
-    float* channel1 = malloc(audioFloat->numFrames * sizeof(float));
-    vDSP_vsadd(workArray + 1, numChannels, &zero, channel1, stride, audioFloat->numFrames);
-    reduceFramerate(channel1, stride, audioFloat->numFrames, framerateReductionFactor, audioFloat->channel1, stride);
-    free(channel1);
-    
-    audioFloat->numFrames /= framerateReductionFactor;  // Integer division will floor.
+    free(decimator->taps);
+    free(decimator);
 }
-void prepareAudioForLoudnessCalc(const AudioData *audio, AudioData_ebur128 *audioOut, long framerateReductionFactor)
+void audioFormatToFloatFormat(const AudioData *audio, AudioDataFloat *audioFloat, const Decimator *decimator)
 {
-    // Convert audio data to float if not already.
-    float *src = audio->audioBuffer.mData;
-
-    // The audio data is already interleaved, but we might want to reduce the framerate, so
-    // we need to work with each channel separately via strided operations
-    for (UInt32 i = 0; i < audio->audioBuffer.mNumberChannels; i++)
+    const UInt32 numChannels = audio->audioBuffer.mNumberChannels;
+    const UInt8 *src = audio->audioBuffer.mData;
+    const UInt32 sampleSize = bytesPerSample(audio->sampleFormat);
+    const long factor = decimator->factor;
+    const long numFrames = audioFloat->numFrames;
+    // Only whole windows are kept. Integer division will floor.
+    const vDSP_Length numReducedFrames = numFrames / factor;
+    // Frames of context the filter reads before and after each window.
+    const long padding = (decimator->numTaps - factor) / 2;
+    
+    // Work through the audio in blocks of whole windows, reading the interleaved samples once. Each channel of a block is converted into a scratch buffer small enough to stay in cache, then filtered down straight into its planar output.
+    const vDSP_Length blockWindows = max(1, CONVERT_BLOCK_FRAMES / factor);
+    float *block = NULL;
+    if (decimator->numTaps > 1)
     {
-        vDSP_Stride stride = audio->audioBuffer.mNumberChannels;
-        // Reduce framerate while keeping the audio data interleaved
-        reduceFramerate(src + i, stride, audioOut->numFrames, framerateReductionFactor, audioOut->data + i, stride);
+        block = malloc((blockWindows * factor + 2 * padding) * sizeof(float));
     }
-    audioOut->numFrames /= framerateReductionFactor;  // Integer division will floor.
+    float *channels[2] = {audioFloat->channel0, audioFloat->channel1};
+    for (vDSP_Length blockStart = 0; blockStart < numReducedFrames; blockStart += blockWindows)
+    {
+        const vDSP_Length n = min(blockWindows, numReducedFrames - blockStart);
+        // Input frames read by the filter for this block, which may extend past either end of the audio.
+        const long inputStart = (long)blockStart * factor - padding;
+        const long inputEnd = (long)(blockStart + n) * factor + padding;
+        const long readStart = max(inputStart, 0);
+        const long readEnd = min(inputEnd, numFrames);
+        for (UInt32 c = 0; c < 2; c++)
+        {
+            // Mono audio fills both channels.
+            const UInt8 *channelSrc = src + (readStart * numChannels + min(c, numChannels - 1)) * sampleSize;
+            if (block)
+            {
+                vDSP_vclr(block, 1, readStart - inputStart);
+                convertSamplesToFloat(channelSrc, numChannels, audio->sampleFormat, 1, block + (readStart - inputStart), 1, readEnd - readStart);
+                vDSP_vclr(block + (readEnd - inputStart), 1, inputEnd - readEnd);
+                vDSP_desamp(block, factor, decimator->taps, channels[c] + blockStart, n, decimator->numTaps);
+            }
+            else
+            {
+                convertSamplesToFloat(channelSrc, numChannels, audio->sampleFormat, 1, channels[c] + blockStart, 1, n);
+            }
+        }
+        if (audioFloat->mono)
+        {
+            // Mix the block while both channels are still in cache.
+            float half = 0.5;
+            vDSP_vasm(channels[0] + blockStart, 1, channels[1] + blockStart, 1, &half, audioFloat->mono + blockStart, 1, n);
+        }
+    }
+    free(block);
+    
+    audioFloat->numFrames = (UInt32)numReducedFrames;
 }
 void fillMonoSignalData(AudioDataFloat *audioFloat)
 {
@@ -9,6 +9,17 @@
 extern const float DB_REFERENCE_POWER;
 extern const float DB_REFERENCE_LUFS;
 
+/// Storage formats for interleaved audio samples.
+typedef enum SampleFormat
+{
+    /// 32-bit floating point, with sample values between -1 and 1.
+    SampleFormatFloat32,
+    /// 16-bit signed integer.
+    SampleFormatInt16,
+    /// 24-bit signed integer, packed into 3 little-endian bytes.
+    SampleFormatInt24
+} SampleFormat;
+
 /// Contains data for an audio track.
 typedef struct AudioData
 {
@@ -18,6 +29,8 @@ typedef struct AudioData
     int numSamples;
     /// The sample rate of the track.
     double sampleRate;
+    /// The format of the samples in audioBuffer.
+    SampleFormat sampleFormat;
 } AudioData;
 
 /// Contains 32-bit floating-point data for a stereo audio track, with sample values between -1 and 1.
@@ -33,18 +46,52 @@ typedef struct AudioDataFloat
     float *mono;
 } AudioDataFloat;
 
-/// Contains 32-bit floating-point data for calculating a track's loudness via libebur128
-typedef struct AudioData_ebur128
+/// Filters applied when reducing the framerate of audio.
+typedef enum DecimationFilter
 {
-    /// The number of channels in the audio.
-    unsigned int numChannels;
-    /// The framerate.
-    unsigned long framerate;
-    /// The number of relevant frames in the track.
-    UInt32 numFrames;
-    /// The interleaved channel data.
-    float *data;
-} AudioData_ebur128;
+    /// Averages each window of frames. Cheap, but lets frequencies above the reduced Nyquist frequency alias into the reduced audio.
+    DecimationFilterBoxcar,
+    /// Windowed-sinc low-pass FIR, evaluated only at the kept frames. Removes frequencies above the reduced Nyquist frequency before they alias, at the cost of more taps.
+    DecimationFilterFIR
+} DecimationFilter;
+
+/// A precomputed filter for reducing the framerate of audio by a fixed factor.
+typedef struct Decimator
+{
+    /// The factor by which the framerate is reduced.
+    long factor;
+    /// The number of filter taps. Always an odd number of windows of factor frames, centered on the window being reduced.
+    vDSP_Length numTaps;
+    /// The filter taps, which sum to 1.
+    float *taps;
+} Decimator;
+
+/*!
+ * Gets the sample format matching a linear PCM audio description.
+ * @param audioDesc The audio description. Must be packed, interleaved linear PCM.
+ * @param sampleFormat On output, the matching sample format.
+ * @return Return code. 0 on success, -1 if the description has no matching sample format.
+ */
+int sampleFormatFromAudioDesc(const AudioStreamBasicDescription *audioDesc, SampleFormat *sampleFormat);
+
+/*!
+ * Gets the number of bytes used to store one sample in a sample format.
+ * @param sampleFormat The sample format.
+ * @return The size of one sample in bytes.
+ */
+UInt32 bytesPerSample(SampleFormat sampleFormat);
+
+/*!
+ * Converts samples to 32-bit floating point between -1 and 1, applying a gain at the same time.
+ * @param src The input samples.
+ * @param srcStride The distance between consecutive input samples, in samples.
+ * @param sampleFormat The format of the input samples.
+ * @param gain The multiplier to apply to the converted samples.
+ * @param dst On output, the converted samples.
+ * @param dstStride The distance between consecutive output samples, in samples.
+ * @param n The number of samples to convert.
+ */
+void convertSamplesToFloat(const void *src, vDSP_Stride srcStride, SampleFormat sampleFormat, float gain, float *dst, vDSP_Stride dstStride, vDSP_Length n);
 
 /*!
  * Converts a power value to a decibel level.
@@ -68,15 +115,48 @@ float calcAvgPow(const AudioDataFloat *audioFloat);
 float calcAvgVolume(const AudioDataFloat *audioFloat);
 
 /*!
- * Computes the integrated loudness in LUFS of an audio track, in accordance with EBU R 128 (a.k.a. ITU-R BS.1770): https://www.itu.int/dms_pubrec/itu-r/rec/bs/R-REC-BS.1770-4-201510-I!!PDF-E.pdf
+ * Computes the integrated loudness in LUFS of an audio track, in accordance with EBU R 128 (a.k.a. ITU-R BS.1770): https://www.itu.int/dms_pubrec/itu-r/rec/bs/R-REC-BS.1770-4-201510-I!!PDF-E.pdf. Measures segments of the track at its full framerate on every core at once. Each segment warms up its K-weighting filters on the audio before it, and the gating blocks of every segment are gated together, so the result matches measuring the track in one pass. Reads the track in place without copying it.
  * @param audio The input audio track in buffer format.
- * @param numSamples The number of samples within audio to use for the loudness calculation. Must not exceed audio->numSamples.
- * @param framerateReductionLimit The highest allowable framerate reduction factor before resorting to truncation.
- * @param lengthLimit The highest allowable number of frames.
- * @param loudness The average loudness of the track in decibels when represented in floating-point format (normalized between -1 and 1).
+ * @param numFrames The number of frames from the start of the track to measure. Must not exceed audio->numSamples.
+ * @param loudness On output, the integrated loudness of the track.
+ * @return Return code. 0 on success, -1 on failure.
+*/
+int calcIntegratedLoudnessInParallel(const AudioData *audio, long numFrames, double *loudness);
+
+/// Measures the integrated loudness of a track incrementally, as its frames become available in order. Only holds the libebur128 state and a small conversion buffer, never a copy of the track.
+typedef struct LoudnessMeter LoudnessMeter;
+
+/*!
+ * Creates an incremental loudness meter.
+ * @param numChannels The number of interleaved channels in the audio.
+ * @param sampleRate The sample rate of the audio.
+ * @param sampleFormat The format of the samples.
+ * @return The meter, or NULL on failure. Must be freed with disposeLoudnessMeter.
+*/
+LoudnessMeter *createLoudnessMeter(UInt32 numChannels, double sampleRate, SampleFormat sampleFormat);
+
+/*!
+ * Frees a loudness meter.
+ * @param meter The meter to free.
+*/
+void disposeLoudnessMeter(LoudnessMeter *meter);
+
+/*!
+ * Measures the next frames of the audio. Frames must be added in order, and from one thread at a time.
+ * @param meter The meter.
+ * @param frames The interleaved frames, in the meter's sample format.
+ * @param numFrames The number of frames.
+ * @return Return code. 0 on success, -1 on failure.
+*/
+int addLoudnessMeterFrames(LoudnessMeter *meter, const void *frames, long numFrames);
+
+/*!
+ * Computes the integrated loudness in LUFS of the frames added so far, as calcIntegratedLoudnessInParallel does for a whole track.
+ * @param meter The meter.
+ * @param loudness On output, the integrated loudness.
  * @return Return code. 0 on success, -1 on failure.
 */
-int calcIntegratedLoudnessFromBufferFormat(const AudioData *audio, long numSamples, long framerateReductionLimit, long lengthLimit, double *loudness);
+int getLoudnessMeterLoudness(LoudnessMeter *meter, double *loudness);
 
 /*!
  * Calculates the absolute limit on frames based on specified parameters.
@@ -98,20 +178,27 @@ long calcFrameLimit(long numFrames, long framerateReductionLimit, long lengthLim
 long calcFramerateReductionFactor(long framerateReductionFactor, long numFrames, long framerateReductionLimit, long lengthLimit);
 
 /*!
- * Converts audio data to a 32-bit floating point format between -1 and 1. If audioFloat->numFrames < audio->numSamples, just convert the first audioFloat->numFrames.
- * @param audio The input audio track in buffer format.
- * @param audioFloat On output, the audio track in floating point format.
- * @param framerateReductionFactor The factor by which to reduce the audio framerate during conversion.
+ * Creates a filter for reducing the framerate of audio.
+ * @param filter The kind of filter.
+ * @param framerateReductionFactor The factor by which to reduce the framerate.
+ * @param transitionWidth Width of the FIR filter's transition band, as a fraction of the reduced framerate, between 0 and 0.5. The band ends at the reduced Nyquist frequency. Narrower bands keep more of the spectrum but need more taps. Ignored by the boxcar filter.
+ * @return The filter, or NULL on failure. Must be freed with disposeDecimator.
+*/
+Decimator *createDecimator(DecimationFilter filter, long framerateReductionFactor, float transitionWidth);
+
+/*!
+ * Frees a filter created by createDecimator.
+ * @param decimator The filter to free.
 */
-void audioFormatToFloatFormat(const AudioData *audio, AudioDataFloat *audioFloat, long framerateReductionFactor);
+void disposeDecimator(Decimator *decimator);
 
 /*!
- * Converts audio data to a 32-bit floating point format for loudness calculation by libebur128. If audioOut->numFrames < audio->numSamples, just convert the first audioOut->numFrames.
+ * Converts audio data to a 32-bit floating point format between -1 and 1, in a single pass over the interleaved input. If audioFloat->numFrames < audio->numSamples, just convert the first audioFloat->numFrames. Each channel is reduced by the decimator, treating audio outside the converted frames as silence. If audioFloat->mono is not NULL, the mono signal is filled at the same time.
  * @param audio The input audio track in buffer format.
- * @param audioOut On output, the audio track in the format libebur128 expects.
- * @param framerateReductionFactor The factor by which to reduce the audio framerate during conversion.
+ * @param audioFloat On output, the audio track in floating point format. channel0, channel1 and mono (if not NULL) must hold audioFloat->numFrames / decimator->factor frames.
+ * @param decimator The filter by which to reduce the audio framerate during conversion.
 */
-void prepareAudioForLoudnessCalc(const AudioData *audio, AudioData_ebur128 *audioOut, long framerateReductionFactor);
+void audioFormatToFloatFormat(const AudioData *audio, AudioDataFloat *audioFloat, const Decimator *decimator);
 
 /*!
  * Computes the mono audio field of the input audio track from its stereo data.
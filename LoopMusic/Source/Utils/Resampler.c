@@ -0,0 +1,131 @@
+#include "Resampler.h"
+#include <math.h>
+#include <stdlib.h>
+
+// Shape parameter of the Kaiser window. Attenuates the stopband by about 80 dB.
+static const double KAISER_BETA = 8;
+// Width of the filter's transition band as a fraction of the input Nyquist frequency, for the Kaiser window's length and shape.
+static const double TRANSITION_WIDTH = 0.16;
+
+/// The most output frames computed in one block.
+#define BLOCK_FRAMES 32
+/// The most input frames one block of output frames is computed from.
+#define BLOCK_SPAN_FRAMES 1024
+
+/// Zeroth-order modified Bessel function of the first kind, summed from its power series.
+static double besselI0(double x)
+{
+    double sum = 1;
+    double term = 1;
+    for (int k = 1; k < 32; k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/// Kaiser window over [-RESAMPLER_TAPS / 2, RESAMPLER_TAPS / 2].
+static double kaiserWindow(double x)
+{
+    const double r = 2 * x / RESAMPLER_TAPS;
+    if (r * r >= 1)
+    {
+        return 0;
+    }
+    return besselI0(KAISER_BETA * sqrt(1 - r * r)) / besselI0(KAISER_BETA);
+}
+
+ResampleFilter *createResampleFilter(double inputRate, double outputRate)
+{
+    ResampleFilter *filter = malloc(sizeof(ResampleFilter));
+    if (!filter)
+    {
+        return NULL;
+    }
+    filter->inputRate = inputRate;
+    filter->outputRate = outputRate;
+    filter->step = (uint64_t)llround(inputRate / outputRate * 4294967296.0);
+
+    // Center the transition band below the lower Nyquist frequency, so the stopband starts right at it.
+    const double nyquist = fmin(1, outputRate / inputRate);
+    const double cutoff = fmax(nyquist - TRANSITION_WIDTH / 2, nyquist / 2);
+    for (int phase = 0; phase <= RESAMPLER_PHASES; phase++)
+    {
+        const double offset = (double)phase / RESAMPLER_PHASES;
+        double sum = 0;
+        for (int tap = 0; tap < RESAMPLER_TAPS; tap++)
+        {
+            // Distance from the tap to the interpolated point, which lies between taps RESAMPLER_TAPS / 2 - 1 and RESAMPLER_TAPS / 2.
+            const double x = tap - (RESAMPLER_TAPS / 2 - 1) - offset;
+            const double sinc = x == 0 ? 1 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            const double coefficient = cutoff * sinc * kaiserWindow(x);
+            filter->coefficients[phase][tap] = coefficient;
+            sum += coefficient;
+        }
+        // Normalize each phase separately so a constant signal keeps its level at every position.
+        for (int tap = 0; tap < RESAMPLER_TAPS; tap++)
+        {
+            filter->coefficients[phase][tap] /= sum;
+        }
+    }
+    return filter;
+}
+
+int64_t resampleFrames(const ResampleFilter *filter, const float *input, int64_t inputFrames, UInt32 inputChannels, uint64_t *position, float *output, UInt32 outputChannels, int64_t maxOutputFrames)
+{
+    const UInt32 filteredChannels = inputChannels < outputChannels ? inputChannels : outputChannels;
+    // Interpolated coefficients and input offsets of each output frame in the block.
+    float coefficients[BLOCK_FRAMES][RESAMPLER_TAPS];
+    int64_t offsets[BLOCK_FRAMES];
+    // One input channel of the block, deinterleaved so each output frame is a contiguous dot product.
+    float channelInput[BLOCK_SPAN_FRAMES];
+
+    uint64_t currentPosition = *position;
+    int64_t outputFrames = 0;
+    while (outputFrames < maxOutputFrames)
+    {
+        const int64_t firstFrame = currentPosition >> 32;
+        int64_t blockFrames = 0;
+        int64_t spanFrames = 0;
+        while (blockFrames < BLOCK_FRAMES && outputFrames + blockFrames < maxOutputFrames)
+        {
+            const int64_t frame = currentPosition >> 32;
+            if (frame + RESAMPLER_TAPS > inputFrames || frame - firstFrame + RESAMPLER_TAPS > BLOCK_SPAN_FRAMES)
+            {
+                break;
+            }
+            // Interpolate between the phases on either side of the fractional position.
+            const uint32_t fraction = (uint32_t)currentPosition;
+            const uint32_t phase = fraction >> 24;
+            const float weight = (float)(fraction & 0xFFFFFF) / 16777216.0f;
+            vDSP_vintb(filter->coefficients[phase], 1, filter->coefficients[phase + 1], 1, &weight, coefficients[blockFrames], 1, RESAMPLER_TAPS);
+            offsets[blockFrames] = frame - firstFrame;
+            spanFrames = offsets[blockFrames] + RESAMPLER_TAPS;
+            currentPosition += filter->step;
+            blockFrames++;
+        }
+        if (blockFrames == 0)
+        {
+            break;
+        }
+
+        float *outputBlock = output + outputFrames * outputChannels;
+        for (UInt32 c = 0; c < filteredChannels; c++)
+        {
+            cblas_scopy((int)spanFrames, input + firstFrame * inputChannels + c, (int)inputChannels, channelInput, 1);
+            for (int64_t i = 0; i < blockFrames; i++)
+            {
+                vDSP_dotpr(channelInput + offsets[i], 1, coefficients[i], 1, outputBlock + i * outputChannels + c, RESAMPLER_TAPS);
+            }
+        }
+        // Output channels beyond the input's channels repeat the last input channel.
+        for (UInt32 c = filteredChannels; c < outputChannels; c++)
+        {
+            cblas_scopy((int)blockFrames, outputBlock + filteredChannels - 1, (int)outputChannels, outputBlock + c, (int)outputChannels);
+        }
+        outputFrames += blockFrames;
+    }
+    *position = currentPosition;
+    return outputFrames;
+}
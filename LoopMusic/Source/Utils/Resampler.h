@@ -0,0 +1,47 @@
+#ifndef Resampler_h
+#define Resampler_h
+
+#import <CoreAudioTypes/CoreAudioTypes.h>
+#import <Accelerate/Accelerate.h>
+
+/// The number of input frames each output frame is computed from.
+#define RESAMPLER_TAPS 64
+/// The number of fractional positions between input frames that filter coefficients are computed for.
+#define RESAMPLER_PHASES 256
+
+/// Polyphase windowed-sinc lowpass filter for converting audio from one sample rate to another.
+typedef struct ResampleFilter
+{
+    /// The sample rate of the input audio.
+    double inputRate;
+    /// The sample rate of the output audio.
+    double outputRate;
+    /// The distance between consecutive output frames in input frames, as 32.32 fixed point.
+    uint64_t step;
+    /// Filter coefficients for each phase. The extra phase is the first phase shifted by a whole frame, so interpolating between neighbouring phases never wraps.
+    float coefficients[RESAMPLER_PHASES + 1][RESAMPLER_TAPS];
+} ResampleFilter;
+
+/*!
+ * Creates a filter for converting between two sample rates. The filter is a Kaiser-windowed sinc whose stopband starts at the lower of the two Nyquist frequencies, so downsampling doesn't alias.
+ * @param inputRate The sample rate of the input audio.
+ * @param outputRate The sample rate of the output audio.
+ * @return The filter, to be freed with free(). NULL if memory can't be allocated.
+ */
+ResampleFilter *createResampleFilter(double inputRate, double outputRate);
+
+/*!
+ * Computes interleaved output frames from interleaved input frames, interpolating the filter coefficients between the two phases nearest each output frame's position. Output frames are computed in blocks that share one deinterleaved copy of each input channel. Stops when the next output frame would need input past the end of the input. Each output frame is centered RESAMPLER_TAPS / 2 - 1 frames after its position, so streaming callers should start with that many frames of silence. Output channels beyond the input's channels repeat the last input channel, and extra input channels are dropped.
+ * @param filter The filter for the input and output sample rates.
+ * @param input The input frames.
+ * @param inputFrames The number of input frames.
+ * @param inputChannels The number of channels in the input.
+ * @param position On input, the position of the first output frame in input frames, as 32.32 fixed point. On output, the position of the next output frame.
+ * @param output The output frames.
+ * @param outputChannels The number of channels in the output.
+ * @param maxOutputFrames The maximum number of output frames to compute.
+ * @return The number of output frames computed.
+ */
+int64_t resampleFrames(const ResampleFilter *filter, const float *input, int64_t inputFrames, UInt32 inputChannels, uint64_t *position, float *output, UInt32 outputChannels, int64_t maxOutputFrames);
+
+#endif /* Resampler_h */
@@ -7,9 +7,7 @@
 #include <math.h> /* You may have to define _USE_MATH_DEFINES if you use MSVC */
 #include <stdio.h>
 #include <stdlib.h>
-
-/* This can be replaced by any BSD-like queue implementation. */
-#include <sys/queue.h>
+#include <string.h>
 
 #define CHECK_ERROR(condition, errorcode, goto_point)                          \
   if ((condition)) {                                                           \
@@ -30,12 +28,119 @@ static int safe_size_mul(size_t nmemb, size_t size, size_t* result) {
   return 0;
 }
 
-STAILQ_HEAD(ebur128_double_queue, ebur128_dq_entry);
-struct ebur128_dq_entry {
-  double z;
-  STAILQ_ENTRY(ebur128_dq_entry) entries;
+/** Block energies, oldest first, stored contiguously as a ring buffer. The
+ *  buffer grows geometrically until it holds max blocks, after which each new
+ *  block replaces the oldest one. */
+struct ebur128_block_history {
+  /** Block energies. Has capacity elements. */
+  double* z;
+  size_t capacity;
+  /** Index of the oldest block. */
+  size_t start;
+  size_t size;
+  size_t max;
 };
 
+#define BLOCK_HISTORY_MIN_CAPACITY 256
+
+static void block_history_init(struct ebur128_block_history* h, size_t max) {
+  h->z = NULL;
+  h->capacity = 0;
+  h->start = 0;
+  h->size = 0;
+  h->max = max;
+}
+
+static void block_history_destroy(struct ebur128_block_history* h) {
+  free(h->z);
+  h->z = NULL;
+  h->capacity = 0;
+  h->start = 0;
+  h->size = 0;
+}
+
+/* Gets the blocks as at most two runs, oldest first. Returns the number of
+ * runs. */
+static int block_history_runs(const struct ebur128_block_history* h,
+                              const double* runs[2],
+                              size_t run_sizes[2]) {
+  size_t first_size;
+  if (!h->size) {
+    return 0;
+  }
+  first_size = h->capacity - h->start;
+  if (first_size >= h->size) {
+    runs[0] = h->z + h->start;
+    run_sizes[0] = h->size;
+    return 1;
+  }
+  runs[0] = h->z + h->start;
+  run_sizes[0] = first_size;
+  runs[1] = h->z;
+  run_sizes[1] = h->size - first_size;
+  return 2;
+}
+
+static void block_history_set_max(struct ebur128_block_history* h,
+                                  size_t max) {
+  h->max = max;
+  if (h->size > max) {
+    /* drop the oldest blocks */
+    h->start = (h->start + h->size - max) % h->capacity;
+    h->size = max;
+  }
+}
+
+static int block_history_push(struct ebur128_block_history* h, double z) {
+  if (!h->max) {
+    return EBUR128_SUCCESS;
+  }
+  if (h->size == h->max) {
+    /* replace the oldest block */
+    h->start = (h->start + 1) % h->capacity;
+    h->size--;
+  }
+  if (h->size == h->capacity) {
+    const double* runs[2];
+    size_t run_sizes[2];
+    size_t new_capacity, new_bytes;
+    double* new_z;
+    int num_runs, i;
+
+    if (!h->capacity) {
+      new_capacity = BLOCK_HISTORY_MIN_CAPACITY;
+    } else if (h->capacity < h->max / 2) {
+      new_capacity = h->capacity * 2;
+    } else {
+      new_capacity = h->max;
+    }
+    if (new_capacity > h->max) {
+      new_capacity = h->max;
+    }
+    if (safe_size_mul(new_capacity, sizeof(double), &new_bytes) != 0) {
+      return EBUR128_ERROR_NOMEM;
+    }
+    new_z = (double*) malloc(new_bytes);
+    if (!new_z) {
+      return EBUR128_ERROR_NOMEM;
+    }
+    /* unwrap the blocks to the start of the new buffer */
+    num_runs = block_history_runs(h, runs, run_sizes);
+    h->size = 0;
+    for (i = 0; i < num_runs; ++i) {
+      memcpy(new_z + h->size, runs[i], run_sizes[i] * sizeof(double));
+      h->size += run_sizes[i];
+    }
+    free(h->z);
+    h->z = new_z;
+    h->capacity = new_capacity;
+    h->start = 0;
+  }
+  h->z[(h->start + h->size) % h->capacity] = z;
+  h->size++;
+  return EBUR128_SUCCESS;
+}
+
 #define ALMOST_ZERO 0.000001
 #define FILTER_STATE_SIZE 5
 
@@ -79,14 +184,10 @@ struct ebur128_state_internal {
   double a[5];
   /** one filter_state per channel. */
   filter_state* v;
-  /** Linked list of block energies. */
-  struct ebur128_double_queue block_list;
-  unsigned long block_list_max;
-  unsigned long block_list_size;
-  /** Linked list of 3s-block energies, used to calculate LRA. */
-  struct ebur128_double_queue short_term_block_list;
-  unsigned long st_block_list_max;
-  unsigned long st_block_list_size;
+  /** History of block energies. */
+  struct ebur128_block_history block_list;
+  /** History of 3s-block energies, used to calculate LRA. */
+  struct ebur128_block_history short_term_block_list;
   int use_histogram;
   unsigned long* block_energy_histogram;
   unsigned long* short_term_block_energy_histogram;
@@ -106,6 +207,8 @@ struct ebur128_state_internal {
   /** The maximum window duration in ms. */
   unsigned long window;
   unsigned long history;
+  /** Whether gating blocks are stored. */
+  int store_blocks;
 };
 
 static double relative_gate = -10.0;
@@ -445,6 +548,7 @@ ebur128_init(unsigned int channels, unsigned long samplerate, int mode) {
 
   st->d->use_histogram = mode & EBUR128_MODE_HISTOGRAM ? 1 : 0;
   st->d->history = ULONG_MAX;
+  st->d->store_blocks = 1;
   st->samplerate = samplerate;
   st->d->samples_in_100ms = (st->samplerate + 5) / 10;
   st->mode = mode;
@@ -493,12 +597,8 @@ ebur128_init(unsigned int channels, unsigned long samplerate, int mode) {
   } else {
     st->d->short_term_block_energy_histogram = NULL;
   }
-  STAILQ_INIT(&st->d->block_list);
-  st->d->block_list_size = 0;
-  st->d->block_list_max = st->d->history / 100;
-  STAILQ_INIT(&st->d->short_term_block_list);
-  st->d->st_block_list_size = 0;
-  st->d->st_block_list_max = st->d->history / 3000;
+  block_history_init(&st->d->block_list, st->d->history / 100);
+  block_history_init(&st->d->short_term_block_list, st->d->history / 3000);
   st->d->short_term_frame_counter = 0;
 
   result = ebur128_init_resampler(st);
@@ -553,7 +653,6 @@ exit:
 }
 
 void ebur128_destroy(ebur128_state** st) {
-  struct ebur128_dq_entry* entry;
   free((*st)->d->short_term_block_energy_histogram);
   free((*st)->d->block_energy_histogram);
   free((*st)->d->v);
@@ -563,16 +662,8 @@ void ebur128_destroy(ebur128_state** st) {
   free((*st)->d->prev_sample_peak);
   free((*st)->d->true_peak);
   free((*st)->d->prev_true_peak);
-  while (!STAILQ_EMPTY(&(*st)->d->block_list)) {
-    entry = STAILQ_FIRST(&(*st)->d->block_list);
-    STAILQ_REMOVE_HEAD(&(*st)->d->block_list, entries);
-    free(entry);
-  }
-  while (!STAILQ_EMPTY(&(*st)->d->short_term_block_list)) {
-    entry = STAILQ_FIRST(&(*st)->d->short_term_block_list);
-    STAILQ_REMOVE_HEAD(&(*st)->d->short_term_block_list, entries);
-    free(entry);
-  }
+  block_history_destroy(&(*st)->d->block_list);
+  block_history_destroy(&(*st)->d->short_term_block_list);
   ebur128_destroy_resampler(*st);
   free((*st)->d);
   free(*st);
@@ -754,24 +845,11 @@ static int ebur128_calc_gating_block(ebur128_state* st,
     return EBUR128_SUCCESS;
   }
 
-  if (sum >= histogram_energy_boundaries[0]) {
+  if (st->d->store_blocks && sum >= histogram_energy_boundaries[0]) {
     if (st->d->use_histogram) {
       ++st->d->block_energy_histogram[find_histogram_index(sum)];
     } else {
-      struct ebur128_dq_entry* block;
-      if (st->d->block_list_size == st->d->block_list_max) {
-        block = STAILQ_FIRST(&st->d->block_list);
-        STAILQ_REMOVE_HEAD(&st->d->block_list, entries);
-      } else {
-        block =
-            (struct ebur128_dq_entry*) malloc(sizeof(struct ebur128_dq_entry));
-        if (!block) {
-          return EBUR128_ERROR_NOMEM;
-        }
-        st->d->block_list_size++;
-      }
-      block->z = sum;
-      STAILQ_INSERT_TAIL(&st->d->block_list, block, entries);
+      return block_history_push(&st->d->block_list, sum);
     }
   }
 
@@ -955,24 +1033,15 @@ int ebur128_set_max_history(ebur128_state* st, unsigned long history) {
     return EBUR128_ERROR_NO_CHANGE;
   }
   st->d->history = history;
-  st->d->block_list_max = st->d->history / 100;
-  st->d->st_block_list_max = st->d->history / 3000;
-  while (st->d->block_list_size > st->d->block_list_max) {
-    struct ebur128_dq_entry* block = STAILQ_FIRST(&st->d->block_list);
-    STAILQ_REMOVE_HEAD(&st->d->block_list, entries);
-    free(block);
-    st->d->block_list_size--;
-  }
-  while (st->d->st_block_list_size > st->d->st_block_list_max) {
-    struct ebur128_dq_entry* block =
-        STAILQ_FIRST(&st->d->short_term_block_list);
-    STAILQ_REMOVE_HEAD(&st->d->short_term_block_list, entries);
-    free(block);
-    st->d->st_block_list_size--;
-  }
+  block_history_set_max(&st->d->block_list, st->d->history / 100);
+  block_history_set_max(&st->d->short_term_block_list, st->d->history / 3000);
   return EBUR128_SUCCESS;
 }
 
+void ebur128_set_store_blocks(ebur128_state* st, int store_blocks) {
+  st->d->store_blocks = store_blocks;
+}
+
 static int ebur128_energy_shortterm(ebur128_state* st, double* out);
 #define EBUR128_ADD_FRAMES(type)                                               \
   int ebur128_add_frames_##type(ebur128_state* st, const type* src,            \
@@ -1000,28 +1069,16 @@ static int ebur128_energy_shortterm(ebur128_state* st, double* out);
           st->d->short_term_frame_counter += st->d->needed_frames;             \
           if (st->d->short_term_frame_counter ==                               \
               st->d->samples_in_100ms * 30) {                                  \
-            struct ebur128_dq_entry* block;                                    \
             double st_energy;                                                  \
-            if (ebur128_energy_shortterm(st, &st_energy) == EBUR128_SUCCESS && \
+            if (st->d->store_blocks &&                                         \
+                ebur128_energy_shortterm(st, &st_energy) == EBUR128_SUCCESS && \
                 st_energy >= histogram_energy_boundaries[0]) {                 \
               if (st->d->use_histogram) {                                      \
                 ++st->d->short_term_block_energy_histogram                     \
                       [find_histogram_index(st_energy)];                       \
-              } else {                                                         \
-                if (st->d->st_block_list_size == st->d->st_block_list_max) {   \
-                  block = STAILQ_FIRST(&st->d->short_term_block_list);         \
-                  STAILQ_REMOVE_HEAD(&st->d->short_term_block_list, entries);  \
-                } else {                                                       \
-                  block = (struct ebur128_dq_entry*) malloc(                   \
-                      sizeof(struct ebur128_dq_entry));                        \
-                  if (!block) {                                                \
-                    return EBUR128_ERROR_NOMEM;                                \
-                  }                                                            \
-                  st->d->st_block_list_size++;                                 \
-                }                                                              \
-                block->z = st_energy;                                          \
-                STAILQ_INSERT_TAIL(&st->d->short_term_block_list, block,       \
-                                   entries);                                   \
+              } else if (block_history_push(&st->d->short_term_block_list,    \
+                                            st_energy)) {                      \
+                return EBUR128_ERROR_NOMEM;                                    \
               }                                                                \
             }                                                                  \
             st->d->short_term_frame_counter = st->d->samples_in_100ms * 20;    \
@@ -1063,7 +1120,9 @@ EBUR128_ADD_FRAMES(double)
 static int ebur128_calc_relative_threshold(ebur128_state* st,
                                            size_t* above_thresh_counter,
                                            double* relative_threshold) {
-  struct ebur128_dq_entry* it;
+  const double* runs[2];
+  size_t run_sizes[2];
+  int num_runs, r;
   size_t i;
 
   if (st->d->use_histogram) {
@@ -1073,9 +1132,12 @@ static int ebur128_calc_relative_threshold(ebur128_state* st,
       *above_thresh_counter += st->d->block_energy_histogram[i];
     }
   } else {
-    STAILQ_FOREACH(it, &st->d->block_list, entries) {
-      ++*above_thresh_counter;
-      *relative_threshold += it->z;
+    num_runs = block_history_runs(&st->d->block_list, runs, run_sizes);
+    for (r = 0; r < num_runs; ++r) {
+      for (i = 0; i < run_sizes[r]; ++i) {
+        *relative_threshold += runs[r][i];
+      }
+      *above_thresh_counter += run_sizes[r];
     }
   }
 
@@ -1084,7 +1146,9 @@ static int ebur128_calc_relative_threshold(ebur128_state* st,
 
 static int
 ebur128_gated_loudness(ebur128_state** sts, size_t size, double* out) {
-  struct ebur128_dq_entry* it;
+  const double* runs[2];
+  size_t run_sizes[2];
+  int num_runs, r;
   double gated_loudness = 0.0;
   double relative_threshold = 0.0;
   size_t above_thresh_counter = 0;
@@ -1131,10 +1195,13 @@ ebur128_gated_loudness(ebur128_state** sts, size_t size, double* out) {
         above_thresh_counter += sts[i]->d->block_energy_histogram[j];
       }
     } else {
-      STAILQ_FOREACH(it, &sts[i]->d->block_list, entries) {
-        if (it->z >= relative_threshold) {
-          ++above_thresh_counter;
-          gated_loudness += it->z;
+      num_runs = block_history_runs(&sts[i]->d->block_list, runs, run_sizes);
+      for (r = 0; r < num_runs; ++r) {
+        for (j = 0; j < run_sizes[r]; ++j) {
+          if (runs[r][j] >= relative_threshold) {
+            ++above_thresh_counter;
+            gated_loudness += runs[r][j];
+          }
         }
       }
     }
@@ -1268,7 +1335,9 @@ int ebur128_loudness_range_multiple(ebur128_state** sts,
                                     size_t size,
                                     double* out) {
   size_t i, j;
-  struct ebur128_dq_entry* it;
+  const double* runs[2];
+  size_t run_sizes[2];
+  int num_runs, r;
   double* stl_vector;
   size_t stl_size;
   double* stl_relgated;
@@ -1357,9 +1426,7 @@ int ebur128_loudness_range_multiple(ebur128_state** sts,
     if (!sts[i]) {
       continue;
     }
-    STAILQ_FOREACH(it, &sts[i]->d->short_term_block_list, entries) {
-      ++stl_size;
-    }
+    stl_size += sts[i]->d->short_term_block_list.size;
   }
   if (!stl_size) {
     *out = 0.0;
@@ -1375,9 +1442,11 @@ int ebur128_loudness_range_multiple(ebur128_state** sts,
     if (!sts[i]) {
       continue;
     }
-    STAILQ_FOREACH(it, &sts[i]->d->short_term_block_list, entries) {
-      stl_vector[j] = it->z;
-      ++j;
+    num_runs = block_history_runs(&sts[i]->d->short_term_block_list, runs,
+                                  run_sizes);
+    for (r = 0; r < num_runs; ++r) {
+      memcpy(stl_vector + j, runs[r], run_sizes[r] * sizeof(double));
+      j += run_sizes[r];
     }
   }
   qsort(stl_vector, stl_size, sizeof(double), ebur128_double_cmp);
@@ -205,6 +205,21 @@ int ebur128_set_max_window(ebur128_state* st, unsigned long window);
  */
 int ebur128_set_max_history(ebur128_state* st, unsigned long history);
 
+/** \brief Set whether gating blocks are stored.
+ *
+ *  While storing is off, frames still run through the filters and the block
+ *  timing advances, but no blocks are kept for ebur128_loudness_global() or
+ *  ebur128_loudness_range(). Turning storing off while adding the audio just
+ *  before a range to be measured warms the state up, so the range's first
+ *  blocks are measured as if the whole input had been added.
+ *
+ *  Default is on.
+ *
+ *  @param st library state.
+ *  @param store_blocks 1 to store blocks, 0 to discard them.
+ */
+void ebur128_set_store_blocks(ebur128_state* st, int store_blocks);
+
 /** \brief Add frames to be processed.
  *
  *  @param st library state.
@@ -127,7 +127,7 @@ class MusicPlayerViewController: UIViewController, LoopScrubberContainer, UIAdap
     
     override func prepare(for segue: UIStoryboardSegue, sender: Any?) {
         loopScrubber.unload()
-        MusicPlayer.player.stopShuffleTimer()
+        MusicPlayer.player.cancelShuffle()
         segue.destination.presentationController?.delegate = self
     }
     
@@ -147,7 +147,7 @@ class MusicPlayerViewController: UIViewController, LoopScrubberContainer, UIAdap
         loopScrubber.resume()
         loopScrubber.updateLoopBox()
         if MusicPlayer.player.playing {
-            MusicPlayer.player.startShuffleTimer()
+            MusicPlayer.player.scheduleShuffle()
         }
     }
     
@@ -23,13 +23,12 @@ class ShuffleSettingsViewController: BaseSettingsSectionViewController {
         MusicPlayer.player.pruneTrackHistory()
     }
     
-    /// Stops or starts the shuffle timer based on the new shuffle setting.
+    /// Cancels or reschedules shuffling based on the new shuffle setting.
     @IBAction func shuffleSettingChanged(sender: UISegmentedControl) {
         super.settingChanged(sender: sender)
-        if MusicSettings.settings.shuffleSetting == ShuffleSetting.none {
-            MusicPlayer.player.stopShuffleTimer()
-        } else if MusicPlayer.player.playing {
-            MusicPlayer.player.startShuffleTimer()
+        MusicPlayer.player.cancelShuffle()
+        if MusicSettings.settings.shuffleSetting != ShuffleSetting.none && MusicPlayer.player.playing {
+            MusicPlayer.player.scheduleShuffle()
         }
         tableView.reloadData()
     }
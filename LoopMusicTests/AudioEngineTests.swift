@@ -0,0 +1,550 @@
+import XCTest
+import AudioToolbox
+@testable import LoopMusic
+
+/// Tests the audio engine's render path.
+class AudioEngineTests: XCTestCase {
+
+    /// Sample rate of the test audio.
+    let SAMPLE_RATE: Double = 44100
+    /// Number of channels in the test audio.
+    let NUM_CHANNELS: UInt32 = 2
+    /// Number of frames in the test audio (one minute).
+    let NUM_FRAMES: Int = 44100 * 60
+    /// Size of the fake queue buffer in bytes. Matches the engine's buffer size.
+    let BUFFER_SIZE: UInt32 = 16384
+
+    /// Test audio data. Each sample holds its own index so rendered positions can be checked.
+    var audioData: UnsafeMutablePointer<Float>?
+    /// Standalone buffer rendered into without an audio queue.
+    var buffer: UnsafeMutablePointer<AudioQueueBuffer>?
+    /// Engine that renders without an audio queue, so tests don't share playback state.
+    var engine: OpaquePointer?
+
+    override func setUp() {
+        /// Number of samples in the test audio across all channels.
+        let numSamples: Int = NUM_FRAMES * Int(NUM_CHANNELS)
+        audioData = UnsafeMutablePointer<Float>.allocate(capacity: numSamples)
+        for i in 0..<numSamples {
+            audioData![i] = Float(i)
+        }
+
+        // Render in the test audio's format, so samples pass through unconverted.
+        engine = createAudioEngine(false)
+        XCTAssertEqual(noErr, engineLoadAudio(engine!, audioData!, Int64(numSamples), makeAudioDesc(sampleRate: SAMPLE_RATE, numChannels: NUM_CHANNELS)))
+
+        buffer = UnsafeMutablePointer<AudioQueueBuffer>.allocate(capacity: 1)
+        buffer!.initialize(to: AudioQueueBuffer(mAudioDataBytesCapacity: BUFFER_SIZE, mAudioData: malloc(Int(BUFFER_SIZE))!, mAudioDataByteSize: BUFFER_SIZE, mUserData: nil, mPacketDescriptionCapacity: 0, mPacketDescriptions: nil, mPacketDescriptionCount: 0))
+
+        engineSetVolumeMultiplier(engine!, 1)
+        engineSetLoopPoints(engine!, 0, Int64(NUM_FRAMES))
+    }
+
+    override func tearDown() {
+        disposeAudioEngine(engine!)
+        free(buffer!.pointee.mAudioData)
+        buffer!.deallocate()
+        audioData!.deallocate()
+    }
+
+    /// Tests that rendering wraps from the loop end to the loop start mid-buffer.
+    func testRenderWrapsAtLoopEnd() {
+        engineSetLoopPoints(engine!, 100, 1000)
+        engineSetSampleCounter(engine!, 990)
+        audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+
+        /// Rendered samples to assert on.
+        let rendered: UnsafeMutablePointer<Float> = buffer!.pointee.mAudioData.assumingMemoryBound(to: Float.self)
+        XCTAssertEqual(1980, rendered[0])
+        XCTAssertEqual(1999, rendered[19])
+        XCTAssertEqual(200, rendered[20])
+        XCTAssertEqual(201, rendered[21])
+    }
+
+    /// Tests that the end of the loop is replaced by a crossfade into the audio before the loop start.
+    func testRenderCrossfadesAtLoopSeam() {
+        engineSetLoopCrossfadeLength(engine!, 10)
+        engineSetLoopPoints(engine!, 100, 1000)
+        engineSetSampleCounter(engine!, 980)
+        audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+
+        /// Rendered samples to assert on.
+        let rendered: UnsafeMutablePointer<Float> = buffer!.pointee.mAudioData.assumingMemoryBound(to: Float.self)
+        // Audio before the seam is untouched.
+        XCTAssertEqual(1979, rendered[19])
+        for i in 0..<10 {
+            /// Crossfade position of the frame.
+            let angle: Float = Float.pi / 2 * (Float(i) + 0.5) / 10
+            XCTAssertEqual(Float(1980 + 2 * i) * cos(angle) + Float(180 + 2 * i) * sin(angle), rendered[20 + 2 * i], accuracy: 1e-2)
+        }
+        // Playback continues from the loop start after the seam.
+        XCTAssertEqual(200, rendered[40])
+    }
+
+    /// Tests that the volume multiplier is applied to rendered samples.
+    func testRenderAppliesVolume() {
+        engineSetVolumeMultiplier(engine!, 0.5)
+        engineSetSampleCounter(engine!, 10)
+        audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+
+        /// Rendered samples to assert on.
+        let rendered: UnsafeMutablePointer<Float> = buffer!.pointee.mAudioData.assumingMemoryBound(to: Float.self)
+        XCTAssertEqual(10, rendered[0])
+        XCTAssertEqual(10.5, rendered[1])
+    }
+
+    /// Tests that 16-bit integer samples are rendered as floats scaled to [-1, 1), with the volume applied.
+    func testRenderConvertsInt16() {
+        /// Interleaved stereo 16-bit samples.
+        let values: [Int16] = [0, 16384, -16384, 32767, -32768, 1]
+        /// Audio data holding the samples, which the engine reads while rendering.
+        let samples: UnsafeMutablePointer<Int16> = UnsafeMutablePointer<Int16>.allocate(capacity: values.count)
+        defer {
+            samples.deallocate()
+        }
+        samples.initialize(from: values, count: values.count)
+        XCTAssertEqual(noErr, engineLoadAudio(engine!, samples, Int64(values.count), makeAudioDesc(sampleRate: SAMPLE_RATE, numChannels: NUM_CHANNELS, bitsPerChannel: 16)))
+        engineSetLoopPoints(engine!, 0, Int64(values.count) / Int64(NUM_CHANNELS))
+        engineSetVolumeMultiplier(engine!, 0.5)
+
+        /// Rendered samples to assert on.
+        var rendered: [Float] = [Float](repeating: 0, count: values.count)
+        engineRender(engine!, &rendered, Int64(values.count) / Int64(NUM_CHANNELS))
+        XCTAssertEqual([0, 0.25, -0.25, 0.5 * 32767 / 32768, -0.5, 0.5 / 32768], rendered)
+    }
+
+    /// Tests that packed little-endian 24-bit integer samples are rendered as floats scaled to [-1, 1), with the volume applied.
+    func testRenderConvertsInt24() {
+        /// Interleaved stereo 24-bit samples, three bytes each: 2^22, -2^22, 2^23 - 1 and 1.
+        let bytes: [UInt8] = [0x00, 0x00, 0x40, 0x00, 0x00, 0xC0, 0xFF, 0xFF, 0x7F, 0x01, 0x00, 0x00]
+        /// Audio data holding the samples, which the engine reads while rendering.
+        let samples: UnsafeMutablePointer<UInt8> = UnsafeMutablePointer<UInt8>.allocate(capacity: bytes.count)
+        defer {
+            samples.deallocate()
+        }
+        samples.initialize(from: bytes, count: bytes.count)
+        /// Number of samples across all channels.
+        let numSamples: Int = bytes.count / 3
+        XCTAssertEqual(noErr, engineLoadAudio(engine!, samples, Int64(numSamples), makeAudioDesc(sampleRate: SAMPLE_RATE, numChannels: NUM_CHANNELS, bitsPerChannel: 24)))
+        engineSetLoopPoints(engine!, 0, Int64(numSamples) / Int64(NUM_CHANNELS))
+        engineSetVolumeMultiplier(engine!, 0.5)
+
+        /// Rendered samples to assert on.
+        var rendered: [Float] = [Float](repeating: 0, count: numSamples)
+        engineRender(engine!, &rendered, Int64(numSamples) / Int64(NUM_CHANNELS))
+        XCTAssertEqual(0.25, rendered[0])
+        XCTAssertEqual(-0.25, rendered[1])
+        XCTAssertEqual(0.5 * Float(8388607) / 8388608, rendered[2])
+        XCTAssertEqual(0.5 / 8388608, rendered[3])
+    }
+
+    /// Tests that a gain ramp is interpolated per frame and holds its target once finished.
+    func testRenderRampsGain() {
+        engineRampGain(engine!, 0, 1000)
+        engineSetSampleCounter(engine!, 1000)
+        audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+
+        /// Rendered samples to assert on.
+        let rendered: UnsafeMutablePointer<Float> = buffer!.pointee.mAudioData.assumingMemoryBound(to: Float.self)
+        XCTAssertEqual(2000, rendered[0])
+        XCTAssertEqual(3000 * 0.5, rendered[1000], accuracy: 1e-1)
+        XCTAssertEqual(0, rendered[2000])
+        XCTAssertEqual(0, rendered[4000])
+    }
+
+    /// Tests that playback switches to a queued track without a gap when the current track wraps.
+    func testHandoffAtLoopWrap() {
+        /// Number of samples in the queued track across all channels.
+        let numQueuedSamples: Int = 4000
+        /// Audio data for the queued track, offset so it can be told apart from the current track.
+        let queuedData: UnsafeMutablePointer<Float> = UnsafeMutablePointer<Float>.allocate(capacity: numQueuedSamples)
+        defer {
+            queuedData.deallocate()
+        }
+        for i in 0..<numQueuedSamples {
+            queuedData[i] = Float(100000 + i)
+        }
+
+        engineSetLoopPoints(engine!, 100, 1000)
+        engineSetSampleCounter(engine!, 990)
+        XCTAssertEqual(noErr, engineQueueAudio(engine!, queuedData, Int64(numQueuedSamples), makeAudioDesc(sampleRate: SAMPLE_RATE, numChannels: NUM_CHANNELS), 5, 0, 2000))
+        engineStartHandoff(engine!, 0)
+        XCTAssertFalse(engineFinishHandoff(engine!))
+        audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+
+        /// Rendered samples to assert on.
+        let rendered: UnsafeMutablePointer<Float> = buffer!.pointee.mAudioData.assumingMemoryBound(to: Float.self)
+        XCTAssertEqual(1999, rendered[19])
+        XCTAssertEqual(100010, rendered[20])
+        XCTAssertEqual(100011, rendered[21])
+        XCTAssertTrue(engineFinishHandoff(engine!))
+        XCTAssertEqual(2000, engineGetNumSamples(engine!))
+    }
+
+    /// Tests that a handoff between resampled tracks keeps the resampling filter running across the switch, so no frames are dropped or faded in from silence.
+    func testResampledHandoffAtLoopWrap() {
+        /// Number of frames in the current track, which loops over all of them.
+        let numCurrentFrames: Int = 2400
+        /// Number of frames in the queued track.
+        let numQueuedFrames: Int = 24000
+        /// Level added per input frame. The queued track continues the current track's ramp, so the switch should be inaudible.
+        let rampStep: Float = 1e-5
+        /// Stereo ramps for the current and queued tracks, at half the output rate.
+        let currentData: UnsafeMutablePointer<Float> = UnsafeMutablePointer<Float>.allocate(capacity: numCurrentFrames * 2)
+        let queuedData: UnsafeMutablePointer<Float> = UnsafeMutablePointer<Float>.allocate(capacity: numQueuedFrames * 2)
+        defer {
+            currentData.deallocate()
+            queuedData.deallocate()
+        }
+        for frame in 0..<numCurrentFrames {
+            currentData[2 * frame] = rampStep * Float(frame)
+            currentData[2 * frame + 1] = currentData[2 * frame]
+        }
+        for frame in 0..<numQueuedFrames {
+            queuedData[2 * frame] = rampStep * Float(numCurrentFrames + frame)
+            queuedData[2 * frame + 1] = queuedData[2 * frame]
+        }
+        engineSetOutputFormat(engine!, 48000, 2)
+        XCTAssertEqual(noErr, engineLoadAudio(engine!, currentData, Int64(numCurrentFrames * 2), makeAudioDesc(sampleRate: 24000, numChannels: 2)))
+        engineSetVolumeMultiplier(engine!, 1)
+        engineSetLoopPoints(engine!, 0, Int64(numCurrentFrames * 2))
+        XCTAssertEqual(noErr, engineQueueAudio(engine!, queuedData, Int64(numQueuedFrames * 2), makeAudioDesc(sampleRate: 24000, numChannels: 2), 0, 0, Int64(numQueuedFrames * 2)))
+        engineStartHandoff(engine!, 0)
+
+        /// Number of output frames to render, well past the switch at output frame 4800.
+        let numFrames: Int = 9600
+        /// Rendered samples to assert on.
+        let rendered: UnsafeMutablePointer<Float> = UnsafeMutablePointer<Float>.allocate(capacity: numFrames * 2)
+        defer {
+            rendered.deallocate()
+        }
+        engineRender(engine!, rendered, Int64(numFrames))
+        XCTAssertTrue(engineFinishHandoff(engine!))
+        // Past the current track's start, where the filter reads silence, the output ramps up evenly at half the input's step.
+        for frame in Int(RESAMPLER_TAPS)..<(numFrames - 1) {
+            XCTAssertEqual(rampStep / 2, rendered[2 * frame + 2] - rendered[2 * frame], accuracy: rampStep / 100, "Output frame \(frame)")
+        }
+    }
+
+    /// Tests that loading far more tracks than the command queue holds while stopped plays the last track loaded, even after the earlier tracks' audio data is freed.
+    func testManyLoadsWhileStoppedPlayLastTrack() {
+        /// Number of samples in each track across all channels.
+        let numTrackSamples: Int = 4000
+        /// Number of tracks to load, each sending several commands.
+        let numTracks: Int = 100
+        /// Audio data of the most recently loaded track.
+        var trackData: UnsafeMutablePointer<Float>? = nil
+        defer {
+            trackData?.deallocate()
+        }
+        for track in 0..<numTracks {
+            /// Audio data for the next track, offset so each track can be told apart.
+            let nextData: UnsafeMutablePointer<Float> = UnsafeMutablePointer<Float>.allocate(capacity: numTrackSamples)
+            for i in 0..<numTrackSamples {
+                nextData[i] = Float(track * 10000 + i)
+            }
+            XCTAssertEqual(noErr, engineLoadAudio(engine!, nextData, Int64(numTrackSamples), makeAudioDesc(sampleRate: SAMPLE_RATE, numChannels: NUM_CHANNELS)))
+            engineSetVolumeMultiplier(engine!, 1)
+            engineSetLoopPoints(engine!, 0, Int64(numTrackSamples) / Int64(NUM_CHANNELS))
+            engineSetSampleCounter(engine!, 10)
+            engineRampGain(engine!, 1, 0)
+            trackData?.deallocate()
+            trackData = nextData
+        }
+        XCTAssertEqual(10, engineGetSampleCounter(engine!))
+        audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+
+        /// Rendered samples to assert on.
+        let rendered: UnsafeMutablePointer<Float> = buffer!.pointee.mAudioData.assumingMemoryBound(to: Float.self)
+        XCTAssertEqual(Float((numTracks - 1) * 10000 + 20), rendered[0])
+        XCTAssertEqual(Float((numTracks - 1) * 10000 + 21), rendered[1])
+    }
+
+    /// Tests that a scheduled event fires on its exact rendered frame in the middle of a buffer, and posts a notification.
+    func testScheduledEventFiresOnExactFrame() {
+        /// Notification read from the engine.
+        var notification: EngineNotification = EngineNotification()
+        while enginePollNotification(engine!, &notification) {}
+        engineSetSampleCounter(engine!, 1000)
+        /// Rendered frame to fire the event at, partway into the next buffer.
+        let eventFrame: Int64 = engineGetRenderedFrames(engine!) + 100
+        XCTAssertTrue(engineScheduleEvent(engine!, EngineEvent(trigger: EventTriggerRenderedFrames, position: eventFrame, action: EventActionRampGain, targetGain: 0, numFrames: 0, tag: 7)))
+        audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+
+        /// Rendered samples to assert on.
+        let rendered: UnsafeMutablePointer<Float> = buffer!.pointee.mAudioData.assumingMemoryBound(to: Float.self)
+        XCTAssertEqual(2198, rendered[198])
+        XCTAssertEqual(0, rendered[200])
+        XCTAssertTrue(enginePollNotification(engine!, &notification))
+        XCTAssertEqual(NotificationEventFired, notification.type)
+        XCTAssertEqual(7, notification.tag)
+        XCTAssertEqual(eventFrame, notification.renderedFrames)
+        XCTAssertFalse(enginePollNotification(engine!, &notification))
+    }
+
+    /// Tests that notifications that don't fit in the notification queue are reported as dropped, once.
+    func testDroppedNotificationsAreReported() {
+        /// Notification read from the engine.
+        var notification: EngineNotification = EngineNotification()
+        while enginePollNotification(engine!, &notification) {}
+        /// Rendered samples, which aren't checked.
+        var rendered: [Float] = [Float](repeating: 0, count: 200)
+        for _ in 0..<5 {
+            XCTAssertFalse(engineTakeNotificationsDropped(engine!))
+            // Sixteen events fire in each render, so the fifth render overflows the 64 notifications that fit.
+            for i in 0..<16 {
+                XCTAssertTrue(engineScheduleEvent(engine!, EngineEvent(trigger: EventTriggerRenderedFrames, position: engineGetRenderedFrames(engine!) + Int64(i), action: EventActionNotify, targetGain: 0, numFrames: 0, tag: UInt32(i + 1))))
+            }
+            engineRender(engine!, &rendered, 100)
+        }
+        XCTAssertTrue(engineTakeNotificationsDropped(engine!))
+        XCTAssertFalse(engineTakeNotificationsDropped(engine!))
+    }
+
+    /// Tests that the playback position follows rendering and seeks while nothing is queued for playback.
+    func testPlaybackPositionWhileStopped() {
+        engineSetSampleCounter(engine!, 1234)
+        /// Position of the audio being heard.
+        var position: PlaybackPosition = PlaybackPosition()
+        engineGetPlaybackPosition(engine!, &position)
+        XCTAssertEqual(1234, position.sampleCounter)
+        audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+        engineGetPlaybackPosition(engine!, &position)
+        XCTAssertEqual(1234 + Int64(BUFFER_SIZE) / 4 / Int64(NUM_CHANNELS), position.sampleCounter)
+        XCTAssertEqual(engineGetRenderedFrames(engine!), position.renderedFrames)
+    }
+
+    /// Tests that a seek made while paused is heard as soon as playback resumes, with the buffers queued before the pause flushed and re-rendered once each.
+    func testSeekWhilePausedResumesFromSeek() {
+        /// Engine that plays through an audio queue, so pausing leaves buffers queued.
+        let playingEngine: OpaquePointer = createAudioEngine(true)!
+        defer {
+            engineStopAudio(playingEngine)
+            disposeAudioEngine(playingEngine)
+        }
+        /// Number of audio queue buffers, each long enough that none finishes playing during the test.
+        let numBuffers: UInt32 = 4
+        engineSetBufferGeometry(playingEngine, numBuffers, 16384, 16384)
+        XCTAssertEqual(noErr, engineLoadAudio(playingEngine, audioData!, Int64(NUM_FRAMES * Int(NUM_CHANNELS)), makeAudioDesc(sampleRate: SAMPLE_RATE, numChannels: NUM_CHANNELS)))
+        engineSetVolumeMultiplier(playingEngine, 1)
+        engineSetLoopPoints(playingEngine, 0, Int64(NUM_FRAMES))
+        XCTAssertEqual(noErr, enginePlayAudio(playingEngine))
+        XCTAssertEqual(noErr, enginePauseAudio(playingEngine))
+
+        /// Frame to seek to, far from where playback paused.
+        let seekFrame: Int64 = Int64(NUM_FRAMES) / 2
+        engineSetSampleCounter(playingEngine, seekFrame)
+        engineResetRenderTelemetry(playingEngine)
+        XCTAssertEqual(noErr, enginePlayAudio(playingEngine))
+        /// Timing statistics, which count every buffer rendered.
+        var telemetry: RenderTelemetry = RenderTelemetry()
+        engineGetRenderTelemetry(playingEngine, &telemetry)
+        // Buffers the flush returns through the audio callback aren't rendered there as well.
+        XCTAssertEqual(UInt64(numBuffers), telemetry.numCallbacks)
+        /// Position of the audio being heard right after resuming.
+        var position: PlaybackPosition = PlaybackPosition()
+        engineGetPlaybackPosition(playingEngine, &position)
+        XCTAssertGreaterThanOrEqual(position.sampleCounter, seekFrame)
+        XCTAssertLessThan(position.sampleCounter, seekFrame + Int64(SAMPLE_RATE))
+    }
+
+    /// Tests that callback timings are counted in the histogram and cleared by a reset.
+    func testRenderTelemetryCountsCallbacks() {
+        engineResetRenderTelemetry(engine!)
+        for _ in 0..<10 {
+            audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+        }
+
+        /// Timing statistics to assert on.
+        var telemetry: RenderTelemetry = RenderTelemetry()
+        engineGetRenderTelemetry(engine!, &telemetry)
+        XCTAssertEqual(10, telemetry.numCallbacks)
+        /// Callbacks counted across all histogram buckets.
+        let histogramTotal: UInt64 = withUnsafeBytes(of: telemetry.histogram) { $0.bindMemory(to: UInt64.self).reduce(0, +) }
+        XCTAssertEqual(10, histogramTotal)
+        XCTAssertGreaterThan(telemetry.maxRenderSeconds, 0)
+        XCTAssertLessThan(engineGetRenderHeadroom(engine!), 1)
+
+        engineResetRenderTelemetry(engine!)
+        engineGetRenderTelemetry(engine!, &telemetry)
+        XCTAssertEqual(0, telemetry.numCallbacks)
+        XCTAssertEqual(1, engineGetRenderHeadroom(engine!))
+    }
+
+    /// Tests that two engines render their own audio without affecting each other.
+    func testSeparateEngineRendersIndependently() {
+        /// Second engine that renders without an audio queue.
+        let otherEngine: OpaquePointer = createAudioEngine(false)!
+        defer {
+            disposeAudioEngine(otherEngine)
+        }
+        XCTAssertEqual(noErr, engineLoadAudio(otherEngine, audioData!, Int64(NUM_FRAMES * Int(NUM_CHANNELS)), makeAudioDesc(sampleRate: SAMPLE_RATE, numChannels: NUM_CHANNELS)))
+        engineSetVolumeMultiplier(otherEngine, 2)
+        engineSetSampleCounter(otherEngine, 100)
+        engineSetSampleCounter(engine!, 10)
+
+        /// Rendered samples to assert on.
+        let rendered: UnsafeMutablePointer<Float> = buffer!.pointee.mAudioData.assumingMemoryBound(to: Float.self)
+        audioCallback(UnsafeMutableRawPointer(otherEngine), nil, buffer!)
+        XCTAssertEqual(400, rendered[0])
+        audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+        XCTAssertEqual(20, rendered[0])
+        XCTAssertEqual(100 + Int64(BUFFER_SIZE) / 4 / Int64(NUM_CHANNELS), engineGetSampleCounter(otherEngine))
+    }
+
+    /// Tests that an engine with no audio loaded renders silence rather than failing.
+    func testRenderWithoutAudio() {
+        /// Engine with nothing loaded, so it has no output format yet.
+        let emptyEngine: OpaquePointer = createAudioEngine(false)!
+        defer {
+            disposeAudioEngine(emptyEngine)
+        }
+        /// Rendered samples to assert on.
+        let rendered: UnsafeMutablePointer<Float> = buffer!.pointee.mAudioData.assumingMemoryBound(to: Float.self)
+        rendered[0] = 1
+        engineRender(emptyEngine, rendered, 16)
+        audioCallback(UnsafeMutableRawPointer(emptyEngine), nil, buffer!)
+        XCTAssertEqual(0, rendered[0])
+    }
+
+    /// Tests that a track is resampled and channel-mapped to the output format while rendering.
+    func testRenderConvertsToOutputFormat() {
+        /// Number of frames in the mono track.
+        let numMonoFrames: Int = 24000
+        /// Mono track at half the output rate, holding a constant level.
+        let monoData: UnsafeMutablePointer<Float> = UnsafeMutablePointer<Float>.allocate(capacity: numMonoFrames)
+        defer {
+            monoData.deallocate()
+        }
+        monoData.initialize(repeating: 0.5, count: numMonoFrames)
+        engineSetOutputFormat(engine!, 48000, 2)
+        XCTAssertEqual(noErr, engineLoadAudio(engine!, monoData, Int64(numMonoFrames), makeAudioDesc(sampleRate: 24000, numChannels: 1)))
+        engineSetVolumeMultiplier(engine!, 1)
+        engineSetLoopPoints(engine!, 0, Int64(numMonoFrames))
+        XCTAssertEqual(48000, engineGetSampleRate(engine))
+        XCTAssertEqual(2, engineGetNumChannels(engine))
+
+        /// Number of output frames to render.
+        let numFrames: Int = 4800
+        /// Rendered samples to assert on.
+        let rendered: UnsafeMutablePointer<Float> = UnsafeMutablePointer<Float>.allocate(capacity: numFrames * 2)
+        defer {
+            rendered.deallocate()
+        }
+        engineRender(engine!, rendered, Int64(numFrames))
+        XCTAssertEqual(0.5, rendered[200], accuracy: 1e-4)
+        XCTAssertEqual(0.5, rendered[201], accuracy: 1e-4)
+        // The track advances at half the output rate, plus the few frames the filter reads ahead.
+        XCTAssertLessThanOrEqual(abs(engineGetSampleCounter(engine) - Int64(numFrames / 2)), Int64(RESAMPLER_TAPS))
+    }
+
+    /// Tests that playback holds at audio that hasn't been decoded yet, and asks for it to be decoded next.
+    func testRenderHoldsUntilDecoded() {
+        /// Map with everything after the first 1000 frames still to decode.
+        let progress: OpaquePointer = createDecodeProgress(1000, Int64(NUM_FRAMES), 4096)!
+        engineSetDecodeProgress(engine!, progress)
+        defer {
+            engineSetDecodeProgress(engine!, nil)
+            disposeDecodeProgress(progress)
+        }
+        /// Frames rendered into each buffer.
+        let bufferFrames: Int64 = Int64(BUFFER_SIZE) / 4 / Int64(NUM_CHANNELS)
+
+        audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+        /// Rendered samples of the buffer.
+        let samples: UnsafeMutablePointer<Float> = buffer!.pointee.mAudioData.assumingMemoryBound(to: Float.self)
+        XCTAssertEqual(0, engineGetSampleCounter(engine!))
+        XCTAssertEqual(0, samples[0])
+        XCTAssertEqual(0, samples[Int(bufferFrames * Int64(NUM_CHANNELS)) - 1])
+        /// The chunk decoded next.
+        var chunk: UInt32 = 0
+        XCTAssertTrue(claimDecodeChunk(progress, &chunk))
+        XCTAssertEqual(0, chunk)
+        finishDecodeChunk(progress, chunk)
+
+        audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+        XCTAssertEqual(bufferFrames, engineGetSampleCounter(engine!))
+        XCTAssertEqual(Float(bufferFrames * Int64(NUM_CHANNELS) - 1), samples[Int(bufferFrames * Int64(NUM_CHANNELS)) - 1])
+    }
+
+    /// Tests that an event keyed to rendered frames is pushed back by the frames held for audio to decode, so it fires after the same amount of playback.
+    func testHeldFramesDelayScheduledEvent() {
+        /// Map with everything after the first 1000 frames still to decode.
+        let progress: OpaquePointer = createDecodeProgress(1000, Int64(NUM_FRAMES), 4096)!
+        engineSetDecodeProgress(engine!, progress)
+        defer {
+            engineSetDecodeProgress(engine!, nil)
+            disposeDecodeProgress(progress)
+        }
+        /// Frames rendered into each buffer.
+        let bufferFrames: Int64 = Int64(BUFFER_SIZE) / 4 / Int64(NUM_CHANNELS)
+        /// Notification read from the engine.
+        var notification: EngineNotification = EngineNotification()
+        engineSetSampleCounter(engine!, 1000)
+        /// Rendered frame the event is scheduled for, within the buffer that is held.
+        let eventFrame: Int64 = engineGetRenderedFrames(engine!) + 100
+        XCTAssertTrue(engineScheduleEvent(engine!, EngineEvent(trigger: EventTriggerRenderedFrames, position: eventFrame, action: EventActionRampGain, targetGain: 0, numFrames: 0, tag: 7)))
+        audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+        XCTAssertFalse(enginePollNotification(engine!, &notification))
+        XCTAssertEqual(bufferFrames, engineGetHeldFrames(engine!))
+
+        /// The chunk decoded next.
+        var chunk: UInt32 = 0
+        while claimDecodeChunk(progress, &chunk) {
+            finishDecodeChunk(progress, chunk)
+        }
+        audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+        /// Rendered samples to assert on.
+        let rendered: UnsafeMutablePointer<Float> = buffer!.pointee.mAudioData.assumingMemoryBound(to: Float.self)
+        XCTAssertEqual(2198, rendered[198])
+        XCTAssertEqual(0, rendered[200])
+        XCTAssertTrue(enginePollNotification(engine!, &notification))
+        XCTAssertEqual(eventFrame + bufferFrames, notification.renderedFrames)
+    }
+
+    /// Tests that adaptive buffers double after a slow callback or an underrun, halve only after a run of calm callbacks, and stay within the frame range.
+    func testNextBufferFramesGrowsAndShrinks() {
+        /// Calm callbacks in a row, updated by each call.
+        var calmCallbacks: UInt32 = 0
+        // A callback taking over half its buffer's duration, or an underrun, doubles the buffer up to the maximum.
+        XCTAssertEqual(2048, nextBufferFrames(1024, 256, 4096, &calmCallbacks, 600, 1000, false))
+        XCTAssertEqual(2048, nextBufferFrames(1024, 256, 4096, &calmCallbacks, 0, 1000, true))
+        XCTAssertEqual(4096, nextBufferFrames(4096, 256, 4096, &calmCallbacks, 600, 1000, false))
+
+        /// Frames per buffer as it adapts.
+        var frames: UInt32 = 1024
+        for _ in 0..<63 {
+            frames = nextBufferFrames(frames, 256, 4096, &calmCallbacks, 100, 1000, false)
+        }
+        XCTAssertEqual(1024, frames)
+        frames = nextBufferFrames(frames, 256, 4096, &calmCallbacks, 100, 1000, false)
+        XCTAssertEqual(512, frames)
+        XCTAssertEqual(0, calmCallbacks)
+
+        // A callback that isn't calm, but isn't slow either, starts the run over without resizing.
+        for _ in 0..<40 {
+            frames = nextBufferFrames(frames, 256, 4096, &calmCallbacks, 100, 1000, false)
+        }
+        frames = nextBufferFrames(frames, 256, 4096, &calmCallbacks, 300, 1000, false)
+        XCTAssertEqual(512, frames)
+        XCTAssertEqual(0, calmCallbacks)
+
+        // Shrinking stops at the minimum.
+        for _ in 0..<(64 * 3) {
+            frames = nextBufferFrames(frames, 256, 4096, &calmCallbacks, 100, 1000, false)
+        }
+        XCTAssertEqual(256, frames)
+    }
+
+    /// Measures the time to render a minute of looped audio through the audio callback.
+    func testRenderPerformance() {
+        engineSetLoopPoints(engine!, Int64(NUM_FRAMES / 4), Int64(NUM_FRAMES / 2))
+        /// Number of buffers in a minute of audio.
+        let numBuffers: Int = NUM_FRAMES * Int(NUM_CHANNELS) * 4 / Int(BUFFER_SIZE)
+        measure {
+            for _ in 0..<numBuffers {
+                audioCallback(UnsafeMutableRawPointer(engine!), nil, buffer!)
+            }
+        }
+    }
+}
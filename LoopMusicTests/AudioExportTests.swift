@@ -0,0 +1,114 @@
+import XCTest
+import AudioToolbox
+@testable import LoopMusic
+
+/// Tests offline rendering of looped playback to a WAV file.
+class AudioExportTests: XCTestCase {
+
+    /// Sample rate of the test audio.
+    let SAMPLE_RATE: Double = 44100
+    /// Number of channels in the test audio.
+    let NUM_CHANNELS: UInt32 = 2
+    /// Number of frames in the test audio (one minute).
+    let NUM_FRAMES: Int = 44100 * 60
+    /// Loop start of the test audio in frames.
+    let LOOP_START: Int = 44100 * 10
+    /// Loop end of the test audio in frames.
+    let LOOP_END: Int = 44100 * 50
+
+    /// Test audio data. A sawtooth wave so loop seams are audible in exported files.
+    var audioData: UnsafeMutablePointer<Float>?
+    /// Engine that renders without an audio queue.
+    var engine: OpaquePointer?
+    /// File exported to.
+    var exportUrl: URL = FileManager.default.temporaryDirectory.appendingPathComponent("AudioExportTests.wav")
+
+    override func setUp() {
+        /// Number of samples in the test audio across all channels.
+        let numSamples: Int = NUM_FRAMES * Int(NUM_CHANNELS)
+        audioData = UnsafeMutablePointer<Float>.allocate(capacity: numSamples)
+        for i in 0..<numSamples {
+            audioData![i] = Float(i % 1000) / 1000
+        }
+
+        engine = createAudioEngine(false)
+        XCTAssertEqual(noErr, engineLoadAudio(engine!, audioData!, Int64(numSamples), makeAudioDesc(sampleRate: SAMPLE_RATE, numChannels: NUM_CHANNELS)))
+        engineSetVolumeMultiplier(engine!, 1)
+        engineSetLoopPoints(engine!, Int64(LOOP_START), Int64(LOOP_END))
+    }
+
+    /// Reads a frame of an exported file.
+    /// - parameter data: Contents of the file.
+    /// - parameter frame: Index of the frame.
+    /// - returns: The samples of the frame.
+    func readFrame(_ data: Data, _ frame: Int) -> [Float] {
+        return data.withUnsafeBytes { bytes in
+            (0..<Int(NUM_CHANNELS)).map { bytes.load(fromByteOffset: 44 + (frame * Int(NUM_CHANNELS) + $0) * 4, as: Float.self) }
+        }
+    }
+
+    override func tearDown() {
+        disposeAudioEngine(engine!)
+        audioData!.deallocate()
+        try? FileManager.default.removeItem(at: exportUrl)
+    }
+
+    /// Tests that the exported file holds the intro, every loop and the fade-out, and that the fade-out ends in silence.
+    func testExportLength() throws {
+        /// Number of frames to fade out over.
+        let fadeOutFrames: Int = 44100
+        XCTAssertEqual(noErr, exportLoopedAudio(engine!, exportUrl.path, 3, Int64(fadeOutFrames), nil))
+
+        /// Contents of the exported file.
+        let data: Data = try Data(contentsOf: exportUrl)
+        /// Number of frames expected in the file.
+        let numFrames: Int = LOOP_START + 3 * (LOOP_END - LOOP_START) + fadeOutFrames
+        XCTAssertEqual(44 + numFrames * Int(NUM_CHANNELS) * 4, data.count)
+        XCTAssertEqual("RIFF", String(data: data[0..<4], encoding: .ascii))
+        // Playback wraps seamlessly, so the frame after the intro and one loop is the frame at the loop start.
+        XCTAssertEqual(readFrame(data, LOOP_START), readFrame(data, LOOP_END))
+        /// Last sample in the file.
+        let lastSample: Float = data.withUnsafeBytes { $0.load(fromByteOffset: data.count - 4, as: Float.self) }
+        XCTAssertLessThan(abs(lastSample), 1e-4)
+    }
+
+    /// Tests that the exported loops are as long as playback makes them when the loop end is past the end of the audio.
+    func testExportLengthWithLoopEndPastData() throws {
+        engineSetLoopPoints(engine!, Int64(LOOP_START), Int64(NUM_FRAMES + 44100))
+        XCTAssertEqual(noErr, exportLoopedAudio(engine!, exportUrl.path, 3, 0, nil))
+
+        /// Contents of the exported file.
+        let data: Data = try Data(contentsOf: exportUrl)
+        /// Number of frames expected in the file, with each loop ending at the end of the audio.
+        let numFrames: Int = LOOP_START + 3 * (NUM_FRAMES - LOOP_START)
+        XCTAssertEqual(44 + numFrames * Int(NUM_CHANNELS) * 4, data.count)
+        XCTAssertEqual(readFrame(data, LOOP_START), readFrame(data, NUM_FRAMES))
+    }
+
+    /// Tests that the exported file is sized in frames of the engine's output rate when it differs from the track's sample rate.
+    func testExportLengthAtOutputRate() throws {
+        engineSetOutputFormat(engine!, 48000, NUM_CHANNELS)
+        XCTAssertEqual(noErr, engineLoadAudio(engine!, audioData!, Int64(NUM_FRAMES * Int(NUM_CHANNELS)), makeAudioDesc(sampleRate: SAMPLE_RATE, numChannels: NUM_CHANNELS)))
+        engineSetLoopPoints(engine!, Int64(LOOP_START), Int64(LOOP_END))
+        XCTAssertEqual(noErr, exportLoopedAudio(engine!, exportUrl.path, 3, 44100, nil))
+
+        /// Contents of the exported file.
+        let data: Data = try Data(contentsOf: exportUrl)
+        /// Number of frames expected in the file: the intro, three loops and a second of fade-out, at 48 kHz.
+        let numFrames: Int = 48000 * (10 + 3 * 40 + 1)
+        XCTAssertEqual(44 + numFrames * Int(NUM_CHANNELS) * 4, data.count)
+        /// Sample rate in the file's format chunk.
+        let sampleRate: UInt32 = data.withUnsafeBytes { $0.load(fromByteOffset: 24, as: UInt32.self) }
+        XCTAssertEqual(48000, sampleRate)
+    }
+
+    /// Measures the time to export ten minutes of looped audio, and reports the render speed as a multiple of real time.
+    func testExportPerformance() {
+        measure {
+            /// Duration of the rendered audio divided by the time taken to render it.
+            var realtimeMultiple: Double = 0
+            XCTAssertEqual(noErr, exportLoopedAudio(engine!, exportUrl.path, 14, 0, &realtimeMultiple))
+            print("Export speed: \(realtimeMultiple)x real time")
+        }
+    }
+}
@@ -0,0 +1,111 @@
+import XCTest
+@testable import LoopMusic
+
+/// Benchmarks the loop finder's speed and accuracy with each framerate reduction filter, over a range of reduction factors.
+class DecimationBenchmarkTests: XCTestCase {
+
+    /// Sample rate of the synthetic track.
+    static let SAMPLE_RATE: Double = 44100
+    /// Length of the unrepeated intro, in frames.
+    static let INTRO_FRAMES: Int = 4 * 44100
+    /// Length of the repeated section, in frames. The true loop duration.
+    static let LOOP_FRAMES: Int = 17 * 44100
+    /// Number of times the repeated section plays.
+    static let LOOP_REPEATS: Int = 3
+    /// Framerate reduction factors benchmarked.
+    static let FACTORS: ClosedRange<Int> = 6...16
+
+    /// Interleaved stereo samples of the synthetic track.
+    static var samples: UnsafeMutablePointer<Float>!
+    /// Number of frames in the synthetic track.
+    static let NUM_FRAMES: Int = INTRO_FRAMES + LOOP_FRAMES * LOOP_REPEATS
+
+    override class func setUp() {
+        samples = UnsafeMutablePointer<Float>.allocate(capacity: NUM_FRAMES * 2)
+        /// State of the pseudo-random generator, seeded so every run benchmarks the same track.
+        var seed: UInt64 = 0x2545_F491_4F6C_DD1D
+        /// Draws a pseudo-random number between -1 and 1.
+        func nextRandom() -> Float {
+            seed = seed &* 6364136223846793005 &+ 1442695040888963407
+            return Float(Int64(bitPattern: seed) >> 11) / Float(1 << 52)
+        }
+
+        /// Length of each note, in frames.
+        let noteFrames: Int = 11025
+        /// Frequency of the current note in Hz.
+        var frequency: Float = 0
+        /// Level of the high-frequency noise in the current note, which aliases when the framerate is reduced without filtering.
+        var noiseLevel: Float = 0
+        for frame in 0..<(INTRO_FRAMES + LOOP_FRAMES) {
+            if frame % noteFrames == 0 || frame == INTRO_FRAMES {
+                frequency = 110 * powf(2, Float(Int((nextRandom() + 1) * 18)) / 12)
+                noiseLevel = 0.1 * (nextRandom() + 1)
+            }
+            /// Time in seconds.
+            let t: Float = Float(frame) / Float(SAMPLE_RATE)
+            /// Tone with a few harmonics.
+            let tone: Float = 0.3 * sinf(2 * Float.pi * frequency * t) + 0.1 * sinf(6 * Float.pi * frequency * t) + 0.05 * sinf(10 * Float.pi * frequency * t)
+            /// Noise alternating in sign each frame, so it sits near the top of the spectrum.
+            let hiss: Float = noiseLevel * nextRandom() * (frame % 2 == 0 ? 1 : -1)
+            samples[2 * frame] = tone + hiss
+            samples[2 * frame + 1] = tone - hiss
+        }
+        // Repeat the loop section.
+        for repeatIndex in 1..<LOOP_REPEATS {
+            (samples + 2 * (INTRO_FRAMES + repeatIndex * LOOP_FRAMES)).assign(from: samples + 2 * INTRO_FRAMES, count: 2 * LOOP_FRAMES)
+        }
+    }
+
+    override class func tearDown() {
+        samples.deallocate()
+    }
+
+    /// Runs the loop finder on the synthetic track.
+    /// - parameter filter: Filter used to reduce the framerate.
+    /// - parameter factor: Framerate reduction factor.
+    /// - returns: Time taken in seconds, and the top-ranked loop duration in frames, or nil if none was found.
+    func findLoop(filter: DecimationFilter, factor: Int) -> (seconds: Double, duration: Int?) {
+        /// Loop finder with default settings, allowing the factor being benchmarked.
+        let loopFinder: LoopFinderAuto = LoopFinderAuto()
+        loopFinder.setFramerateReductionLimitFloat(Float(DecimationBenchmarkTests.FACTORS.upperBound))
+        loopFinder.framerateReductionFactor = Int32(factor)
+        loopFinder.decimationFilter = filter
+        defer {
+            loopFinder.performFFTDestroy()
+        }
+
+        /// The synthetic track.
+        var audioData: AudioData = AudioData(audioBuffer: AudioBuffer(mNumberChannels: 2, mDataByteSize: UInt32(DecimationBenchmarkTests.NUM_FRAMES * 8), mData: DecimationBenchmarkTests.samples), numSamples: Int32(DecimationBenchmarkTests.NUM_FRAMES), sampleRate: DecimationBenchmarkTests.SAMPLE_RATE, sampleFormat: SampleFormatFloat32)
+        /// Uptime before finding the loop, in nanoseconds.
+        let start: UInt64 = DispatchTime.now().uptimeNanoseconds
+        /// Durations and loop points found by the loop finder.
+        let results: [AnyHashable : Any] = loopFinder.findLoop(&audioData)
+        /// Time taken in seconds.
+        let seconds: Double = Double(DispatchTime.now().uptimeNanoseconds - start) / 1e9
+
+        return (seconds, (results["baseDurations"] as! NSArray).firstObject as? Int)
+    }
+
+    /// Gets the error of a loop duration in milliseconds.
+    /// - parameter duration: Loop duration in frames.
+    /// - returns: Distance from the true loop duration in milliseconds.
+    func getErrorMilliseconds(_ duration: Int) -> Double {
+        return Double(abs(duration - DecimationBenchmarkTests.LOOP_FRAMES)) / DecimationBenchmarkTests.SAMPLE_RATE * 1000
+    }
+
+    /// Reports the loop finder's time and top-ranked duration error with each filter at each reduction factor.
+    func testDecimationFilters() {
+        print("factor   boxcar (s)  error (ms)     FIR (s)  error (ms)")
+        for factor in DecimationBenchmarkTests.FACTORS {
+            /// Results with the boxcar filter.
+            let boxcar: (seconds: Double, duration: Int?) = findLoop(filter: DecimationFilterBoxcar, factor: factor)
+            /// Results with the FIR filter.
+            let fir: (seconds: Double, duration: Int?) = findLoop(filter: DecimationFilterFIR, factor: factor)
+            guard let boxcarDuration: Int = boxcar.duration, let firDuration: Int = fir.duration else {
+                XCTFail(String(format: "No loop found at factor %d.", factor))
+                continue
+            }
+            print(String(format: "%6d %12.3f %11.2f %11.3f %11.2f", factor, boxcar.seconds, getErrorMilliseconds(boxcarDuration), fir.seconds, getErrorMilliseconds(firDuration)))
+        }
+    }
+}
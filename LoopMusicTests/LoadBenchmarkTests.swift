@@ -0,0 +1,154 @@
+import XCTest
+import AudioToolbox
+@testable import LoopMusic
+
+/// Benchmarks loading tracks into the music player, reporting percentiles of the time spent in each phase of the load.
+class LoadBenchmarkTests: XCTestCase {
+
+    /// Number of times each file in the corpus is loaded.
+    static let ITERATIONS: Int = 20
+    /// Length of each file in the corpus, in seconds.
+    static let DURATION: Double = 60
+    /// Prefix of the names of the corpus tracks in the database.
+    static let TRACK_NAME_PREFIX: String = "Load Benchmark"
+
+    /// A synthetic file in the benchmark corpus.
+    struct CorpusFile {
+        /// Name of the file, including its extension.
+        let name: String
+        /// Container type of the file.
+        let fileType: AudioFileTypeID
+        /// Audio description of the file's data.
+        let audioDesc: AudioStreamBasicDescription
+    }
+
+    /// Files loaded by the benchmark, covering integer PCM at two rates and a compressed format.
+    static let CORPUS: [CorpusFile] = [
+        CorpusFile(name: "pcm16_44k.wav", fileType: kAudioFileWAVEType, audioDesc: AudioStreamBasicDescription(mSampleRate: 44100, mFormatID: kAudioFormatLinearPCM, mFormatFlags: kLinearPCMFormatFlagIsSignedInteger | kLinearPCMFormatFlagIsPacked, mBytesPerPacket: 4, mFramesPerPacket: 1, mBytesPerFrame: 4, mChannelsPerFrame: 2, mBitsPerChannel: 16, mReserved: 0)),
+        CorpusFile(name: "pcm24_96k.wav", fileType: kAudioFileWAVEType, audioDesc: AudioStreamBasicDescription(mSampleRate: 96000, mFormatID: kAudioFormatLinearPCM, mFormatFlags: kLinearPCMFormatFlagIsSignedInteger | kLinearPCMFormatFlagIsPacked, mBytesPerPacket: 6, mFramesPerPacket: 1, mBytesPerFrame: 6, mChannelsPerFrame: 2, mBitsPerChannel: 24, mReserved: 0)),
+        CorpusFile(name: "aac_44k.m4a", fileType: kAudioFileM4AType, audioDesc: AudioStreamBasicDescription(mSampleRate: 44100, mFormatID: kAudioFormatMPEG4AAC, mFormatFlags: 0, mBytesPerPacket: 0, mFramesPerPacket: 1024, mBytesPerFrame: 0, mChannelsPerFrame: 2, mBitsPerChannel: 0, mReserved: 0))
+    ]
+
+    /// Directory holding the corpus.
+    static let CORPUS_DIRECTORY: URL = FileManager.default.temporaryDirectory.appendingPathComponent("LoadBenchmarkTests")
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(at: CORPUS_DIRECTORY, withIntermediateDirectories: true, attributes: nil)
+        for file in CORPUS {
+            do {
+                try writeCorpusFile(file)
+            } catch {
+                print("Failed to write benchmark file:", file.name, error.localizedDescription)
+            }
+        }
+    }
+
+    override class func tearDown() {
+        try? FileManager.default.removeItem(at: CORPUS_DIRECTORY)
+        try? MusicData.data.executeSql(query: String(format: "DELETE FROM Tracks WHERE name LIKE '%@%%'", TRACK_NAME_PREFIX), errorMessage: "")
+    }
+
+    override func setUp() {
+        do {
+            try MusicData.data.openConnection()
+        } catch {
+            XCTFail(String(format: "Failed to open database connection. %@", error.localizedDescription))
+        }
+    }
+
+    /// Writes a corpus file holding a sine sweep, so compressed formats can't encode it trivially.
+    /// - parameter file: The file to write.
+    static func writeCorpusFile(_ file: CorpusFile) throws {
+        /// Audio description of the file's data.
+        var fileDesc: AudioStreamBasicDescription = file.audioDesc
+        /// The file being written.
+        var audioFileOptional: ExtAudioFileRef? = nil
+        /// Holds any errors from Core Audio API calls.
+        var error: OSStatus = ExtAudioFileCreateWithURL(CORPUS_DIRECTORY.appendingPathComponent(file.name) as CFURL, file.fileType, &fileDesc, nil, AudioFileFlags.eraseFile.rawValue, &audioFileOptional)
+        if error != noErr {
+            throw MessageError("Failed to create audio file.", error)
+        }
+        let audioFile: ExtAudioFileRef = audioFileOptional!
+        defer {
+            ExtAudioFileDispose(audioFile)
+        }
+
+        /// Interleaved float format the samples are written in.
+        var clientDesc: AudioStreamBasicDescription = AudioStreamBasicDescription(mSampleRate: fileDesc.mSampleRate, mFormatID: kAudioFormatLinearPCM, mFormatFlags: kAudioFormatFlagIsFloat | kLinearPCMFormatFlagIsPacked, mBytesPerPacket: 8, mFramesPerPacket: 1, mBytesPerFrame: 8, mChannelsPerFrame: 2, mBitsPerChannel: 32, mReserved: 0)
+        error = ExtAudioFileSetProperty(audioFile, kExtAudioFileProperty_ClientDataFormat, UInt32(MemoryLayout<AudioStreamBasicDescription>.size), &clientDesc)
+        if error != noErr {
+            throw MessageError("Failed to set audio description.", error)
+        }
+
+        /// Frames written by each write call.
+        let chunkFrames: Int = 65536
+        /// Samples of the chunk being written.
+        let samples: UnsafeMutablePointer<Float> = UnsafeMutablePointer<Float>.allocate(capacity: chunkFrames * 2)
+        defer {
+            samples.deallocate()
+        }
+        let bufferList: UnsafeMutableAudioBufferListPointer = AudioBufferList.allocate(maximumBuffers: 1)
+        defer {
+            free(bufferList.unsafeMutablePointer)
+        }
+        /// Number of frames in the file.
+        let numFrames: Int = Int(DURATION * fileDesc.mSampleRate)
+        /// Phase of the sweep in radians.
+        var phase: Double = 0
+        for chunkStart in stride(from: 0, to: numFrames, by: chunkFrames) {
+            /// Frames in this chunk.
+            let frames: Int = min(chunkFrames, numFrames - chunkStart)
+            for i in 0..<frames {
+                /// Sweep frequency in Hz, rising from 100 Hz to 5 kHz over the file.
+                let frequency: Double = 100 + 4900 * Double(chunkStart + i) / Double(numFrames)
+                phase += 2 * Double.pi * frequency / fileDesc.mSampleRate
+                samples[2 * i] = Float(0.5 * sin(phase))
+                samples[2 * i + 1] = Float(0.5 * cos(phase))
+            }
+            bufferList[0] = AudioBuffer(mNumberChannels: 2, mDataByteSize: UInt32(frames * 8), mData: samples)
+            error = ExtAudioFileWrite(audioFile, UInt32(frames), bufferList.unsafeMutablePointer)
+            if error != noErr {
+                throw MessageError("Failed to write audio file.", error)
+            }
+        }
+    }
+
+    /// Gets a percentile of some durations by nearest rank.
+    /// - parameter sortedDurations: Durations sorted in increasing order.
+    /// - parameter percentile: The percentile to get, from 0 to 100.
+    /// - returns: The duration at the percentile.
+    func getPercentile(_ sortedDurations: [Double], _ percentile: Double) -> Double {
+        /// Index of the nearest rank.
+        let index: Int = Int((percentile / 100 * Double(sortedDurations.count)).rounded(.up)) - 1
+        return sortedDurations[max(0, min(index, sortedDurations.count - 1))]
+    }
+
+    /// Loads every file in the corpus repeatedly with the decoded audio cache cleared, so each load decodes from the file, and reports p50, p95 and p99 of each load phase in milliseconds.
+    func testLoadTimePercentiles() throws {
+        /// Timings of every load.
+        var allTimings: [LoadTimings] = []
+        for _ in 0..<LoadBenchmarkTests.ITERATIONS {
+            for (i, file) in LoadBenchmarkTests.CORPUS.enumerated() {
+                /// Media item for the corpus file.
+                let mediaItem: TestMPMediaItem = TestMPMediaItem()
+                mediaItem._assetURL = LoadBenchmarkTests.CORPUS_DIRECTORY.appendingPathComponent(file.name)
+                mediaItem._title = String(format: "%@ %d", LoadBenchmarkTests.TRACK_NAME_PREFIX, i)
+                PCMCache.cache.clear()
+                try MusicPlayer.player.loadTrack(mediaItem: mediaItem, updateHistory: false)
+                allTimings.append(MusicPlayer.player.lastLoadTimings)
+            }
+        }
+        try MusicPlayer.player.stopTrack()
+
+        /// Every phase, followed by the total.
+        let phases: [(name: String, keyPath: KeyPath<LoadTimings, Double>)] = LoadTimings.PHASES + [("total", \.total)]
+        print("phase".padding(toLength: 12, withPad: " ", startingAt: 0) + "   p50 (ms)   p95 (ms)   p99 (ms)")
+        for phase in phases {
+            /// Durations of the phase across every load, in increasing order.
+            let durations: [Double] = allTimings.map { $0[keyPath: phase.keyPath] * 1000 }.sorted()
+            print(phase.name.padding(toLength: 12, withPad: " ", startingAt: 0) + String(format: " %10.3f %10.3f %10.3f", getPercentile(durations, 50), getPercentile(durations, 95), getPercentile(durations, 99)))
+        }
+        XCTAssertEqual(LoadBenchmarkTests.ITERATIONS * LoadBenchmarkTests.CORPUS.count, allTimings.count)
+        XCTAssertTrue(allTimings.allSatisfy { $0.total > 0 })
+    }
+}
@@ -0,0 +1,67 @@
+import XCTest
+@testable import LoopMusic
+
+/// Tests integrated loudness measurement.
+class LoudnessTests: XCTestCase {
+
+    /// Sample rate of the test track.
+    let SAMPLE_RATE: Double = 44100
+    /// Number of frames in the test track, long enough to be split into several segments, and not a whole number of gating blocks.
+    let NUM_FRAMES: Int = 44100 * 300 + 1234
+
+    /// Interleaved stereo 16-bit samples of the test track.
+    var samples: UnsafeMutablePointer<Int16>!
+
+    override func setUp() {
+        samples = UnsafeMutablePointer<Int16>.allocate(capacity: NUM_FRAMES * 2)
+        for frame in 0..<NUM_FRAMES {
+            /// Time in seconds.
+            let t: Double = Double(frame) / SAMPLE_RATE
+            // Alternate loud and quiet passages, with silence in between, so both gates discard blocks.
+            /// Amplitude of the current passage.
+            let amplitude: Double = [0.5, 0.02, 0][Int(t / 7) % 3]
+            samples[2 * frame] = Int16(32767 * amplitude * sin(2 * Double.pi * 220 * t))
+            samples[2 * frame + 1] = Int16(32767 * amplitude * sin(2 * Double.pi * 3520 * t))
+        }
+    }
+
+    override func tearDown() {
+        samples.deallocate()
+    }
+
+    /// Gets the test track as audio data.
+    /// - returns: The test track.
+    func getAudioData() -> AudioData {
+        return AudioData(audioBuffer: AudioBuffer(mNumberChannels: 2, mDataByteSize: UInt32(NUM_FRAMES * 4), mData: samples), numSamples: Int32(NUM_FRAMES), sampleRate: SAMPLE_RATE, sampleFormat: SampleFormatInt16)
+    }
+
+    /// Tests that measuring segments in parallel matches measuring the whole track in one pass.
+    func testParallelMatchesSerial() {
+        var audioData: AudioData = getAudioData()
+        guard let meter: OpaquePointer = createLoudnessMeter(2, SAMPLE_RATE, SampleFormatInt16) else {
+            return XCTFail("Failed to create loudness meter.")
+        }
+        defer {
+            disposeLoudnessMeter(meter)
+        }
+        /// Loudness measured in one pass.
+        var serialLoudness: Double = 0
+        XCTAssertEqual(0, addLoudnessMeterFrames(meter, samples, NUM_FRAMES))
+        XCTAssertEqual(0, getLoudnessMeterLoudness(meter, &serialLoudness))
+
+        /// Loudness measured in parallel.
+        var parallelLoudness: Double = 0
+        XCTAssertEqual(0, calcIntegratedLoudnessInParallel(&audioData, NUM_FRAMES, &parallelLoudness))
+        XCTAssertEqual(serialLoudness, parallelLoudness, accuracy: 1e-6)
+    }
+
+    /// Measures the time to compute the loudness of the test track in parallel.
+    func testParallelPerformance() {
+        var audioData: AudioData = getAudioData()
+        /// Loudness of the test track.
+        var loudness: Double = 0
+        measure {
+            XCTAssertEqual(0, calcIntegratedLoudnessInParallel(&audioData, NUM_FRAMES, &loudness))
+        }
+    }
+}
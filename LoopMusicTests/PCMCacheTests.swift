@@ -0,0 +1,64 @@
+import XCTest
+import AudioToolbox
+@testable import LoopMusic
+
+/// Tests the decoded audio cache.
+class PCMCacheTests: XCTestCase {
+
+    /// Number of frames in the test track.
+    let NUM_FRAMES: Int64 = 1000
+    /// Source URL of the test track. Doesn't need to exist, since it's only used as a key.
+    let TEST_URL: URL = URL(fileURLWithPath: "/nonexistent/track.m4a")
+    /// Audio description of the test track.
+    let AUDIO_DESC: AudioStreamBasicDescription = AudioStreamBasicDescription(mSampleRate: 44100, mFormatID: kAudioFormatLinearPCM, mFormatFlags: kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked, mBytesPerPacket: 4, mFramesPerPacket: 1, mBytesPerFrame: 4, mChannelsPerFrame: 2, mBitsPerChannel: 16, mReserved: 0)
+
+    /// Cache stored in a temporary directory.
+    var cache: PCMCache!
+
+    override func setUp() {
+        cache = PCMCache(directory: FileManager.default.temporaryDirectory.appendingPathComponent("PCMCacheTests"), maxBytes: PCMCache.DEFAULT_MAX_BYTES)
+        cache.clear()
+    }
+
+    override func tearDown() {
+        cache.clear()
+    }
+
+    /// Tests that committed audio is mapped by later loads.
+    func testCommittedAudioIsCached() {
+        guard let data: UnsafeMutableRawPointer = cache.create(url: TEST_URL, numFrames: NUM_FRAMES, audioDesc: AUDIO_DESC) else {
+            return XCTFail("Failed to create cache file.")
+        }
+        data.storeBytes(of: 0x1234_5678, toByteOffset: Int(NUM_FRAMES - 1) * 4, as: UInt32.self)
+        cache.commit(data)
+        XCTAssertTrue(cache.unmap(data))
+
+        guard let cachedData: UnsafeMutableRawPointer = cache.map(url: TEST_URL, numFrames: NUM_FRAMES, audioDesc: AUDIO_DESC) else {
+            return XCTFail("Committed audio wasn't cached.")
+        }
+        XCTAssertEqual(0x1234_5678, cachedData.load(fromByteOffset: Int(NUM_FRAMES - 1) * 4, as: UInt32.self))
+        XCTAssertTrue(cache.unmap(cachedData))
+    }
+
+    /// Tests that audio that was never committed, or was decoded differently, isn't mapped.
+    func testUncachedAudioMisses() {
+        guard let data: UnsafeMutableRawPointer = cache.create(url: TEST_URL, numFrames: NUM_FRAMES, audioDesc: AUDIO_DESC) else {
+            return XCTFail("Failed to create cache file.")
+        }
+        XCTAssertNil(cache.map(url: TEST_URL, numFrames: NUM_FRAMES, audioDesc: AUDIO_DESC))
+        cache.commit(data)
+        cache.unmap(data)
+
+        XCTAssertNil(cache.map(url: TEST_URL, numFrames: NUM_FRAMES + 1, audioDesc: AUDIO_DESC))
+        /// Audio description with a different sample rate.
+        var otherAudioDesc: AudioStreamBasicDescription = AUDIO_DESC
+        otherAudioDesc.mSampleRate = 48000
+        XCTAssertNil(cache.map(url: TEST_URL, numFrames: NUM_FRAMES, audioDesc: otherAudioDesc))
+
+        // Memory not mapped by the cache is left alone.
+        /// Memory owned by the test.
+        let otherData: UnsafeMutableRawPointer = malloc(4)
+        XCTAssertFalse(cache.unmap(otherData))
+        free(otherData)
+    }
+}
@@ -0,0 +1,92 @@
+import XCTest
+import MediaPlayer
+@testable import LoopMusic
+
+/// Media item with its own persistent ID, so items compare as different tracks.
+class PrefetchTestMPMediaItem: TestMPMediaItem {
+
+    /// Mock persistent ID for testing.
+    var _persistentID: MPMediaEntityPersistentID = 0
+
+    /// Overrides persistent ID with mock field.
+    override var persistentID: MPMediaEntityPersistentID {
+        get {
+            return _persistentID
+        }
+    }
+}
+
+/// Tests the cache of decoded upcoming tracks.
+class PrefetchCacheTests: XCTestCase {
+
+    /// Size of each test track's decoded audio in bytes.
+    let TRACK_BYTES: UInt32 = 1024
+
+    /// Audio freed by the cache.
+    var freedAudio: [UnsafeMutableRawPointer] = []
+    /// Cache with room for two test tracks.
+    var cache: PrefetchCache!
+
+    override func setUp() {
+        freedAudio = []
+        cache = PrefetchCache(maxBytes: Int64(TRACK_BYTES) * 2, freeAudioData: { audioBuffer in
+            self.freedAudio.append(audioBuffer.mData!)
+            free(audioBuffer.mData)
+        })
+    }
+
+    override func tearDown() {
+        cache.removeAll()
+    }
+
+    /// Creates a decoded test track.
+    /// - parameter id: Persistent ID of the track.
+    /// - returns: The track, whose audio is owned by the caller until inserted.
+    func makeTrack(id: MPMediaEntityPersistentID) -> PreloadedTrack {
+        /// Media item of the track.
+        let mediaItem: PrefetchTestMPMediaItem = PrefetchTestMPMediaItem()
+        mediaItem._persistentID = id
+        return PreloadedTrack(mediaItem: mediaItem, track: MusicTrack.BLANK_MUSIC_TRACK, audioBuffer: AudioBuffer(mNumberChannels: 2, mDataByteSize: TRACK_BYTES, mData: malloc(Int(TRACK_BYTES))), audioDesc: AudioStreamBasicDescription(), numSamples: Int64(TRACK_BYTES / 4))
+    }
+
+    /// Tests that the least recently used track is evicted to make room.
+    func testEvictsLeastRecentlyUsed() {
+        let first: PreloadedTrack = makeTrack(id: 1)
+        let second: PreloadedTrack = makeTrack(id: 2)
+        let third: PreloadedTrack = makeTrack(id: 3)
+        XCTAssertTrue(cache.insert(first, keeping: []))
+        XCTAssertTrue(cache.insert(second, keeping: []))
+        XCTAssertTrue(cache.insert(third, keeping: []))
+
+        XCTAssertFalse(cache.contains(first.mediaItem))
+        XCTAssertEqual([first.audioBuffer.mData!], freedAudio)
+        XCTAssertEqual(Int64(TRACK_BYTES) * 2, cache.totalBytes)
+
+        // Taken tracks belong to the caller, so they aren't freed.
+        /// The taken track.
+        let taken: PreloadedTrack? = cache.take(second.mediaItem)
+        XCTAssertEqual(second.audioBuffer.mData, taken?.audioBuffer.mData)
+        XCTAssertFalse(cache.contains(second.mediaItem))
+        XCTAssertEqual(1, freedAudio.count)
+        free(taken!.audioBuffer.mData!)
+    }
+
+    /// Tests that kept tracks aren't evicted, and that a track that doesn't fit is freed instead.
+    func testKeepsUpcomingTracks() {
+        let first: PreloadedTrack = makeTrack(id: 1)
+        let second: PreloadedTrack = makeTrack(id: 2)
+        let third: PreloadedTrack = makeTrack(id: 3)
+        cache.insert(first, keeping: [])
+        cache.insert(second, keeping: [])
+        XCTAssertFalse(cache.insert(third, keeping: [first.mediaItem, second.mediaItem]))
+
+        XCTAssertTrue(cache.contains(first.mediaItem))
+        XCTAssertTrue(cache.contains(second.mediaItem))
+        XCTAssertEqual([third.audioBuffer.mData!], freedAudio)
+
+        // Disabling the cache frees everything in it.
+        cache.maxBytes = 0
+        XCTAssertEqual(0, cache.count)
+        XCTAssertEqual(3, freedAudio.count)
+    }
+}
@@ -0,0 +1,84 @@
+import XCTest
+@testable import LoopMusic
+
+/// Tests sample-rate conversion against ideal sines at the output rate.
+class ResamplerTests: XCTestCase {
+
+    /// Amplitude of the test sines.
+    let AMPLITUDE: Double = 0.5
+    /// Output frames skipped at each end of the resampled sine, where the filter reads silence.
+    let EDGE_FRAMES: Int = 1000
+
+    /// Resamples a stereo sine and measures it against the ideal sine at the output rate.
+    /// - parameter inputRate: Sample rate of the input sine.
+    /// - parameter outputRate: Sample rate to convert to.
+    /// - parameter frequency: Frequency of the sine in Hz.
+    /// - returns: The gain of the resampled sine in decibels, and its THD+N: the power of everything but the ideal sine relative to the ideal sine, in decibels.
+    func measureSine(inputRate: Double, outputRate: Double, frequency: Double) -> (gain: Double, thdPlusNoise: Double) {
+        guard let filter: UnsafeMutablePointer<ResampleFilter> = createResampleFilter(inputRate, outputRate) else {
+            XCTFail("Failed to create resample filter.")
+            return (0, 0)
+        }
+        defer {
+            free(filter)
+        }
+        /// Number of input frames, one second of audio.
+        let numInputFrames: Int = Int(inputRate)
+        /// Interleaved stereo input sine.
+        var input: [Float] = [Float](repeating: 0, count: numInputFrames * 2)
+        for frame in 0..<numInputFrames {
+            input[2 * frame] = Float(AMPLITUDE * sin(2 * Double.pi * frequency * Double(frame) / inputRate))
+            input[2 * frame + 1] = input[2 * frame]
+        }
+        /// Most output frames to compute.
+        let maxOutputFrames: Int = Int(outputRate)
+        /// Interleaved stereo output.
+        var output: [Float] = [Float](repeating: 0, count: maxOutputFrames * 2)
+        /// Position of the next output frame in input frames, as 32.32 fixed point.
+        var position: UInt64 = 0
+        /// Number of output frames computed.
+        let numOutputFrames: Int = Int(resampleFrames(filter, input, Int64(numInputFrames), 2, &position, &output, 2, Int64(maxOutputFrames)))
+
+        /// Power of the resampled sine.
+        var signalPower: Double = 0
+        /// Power of the ideal sine.
+        var referencePower: Double = 0
+        /// Power of the difference between them.
+        var errorPower: Double = 0
+        for frame in EDGE_FRAMES..<(numOutputFrames - EDGE_FRAMES) {
+            // Each output frame is centered RESAMPLER_TAPS / 2 - 1 input frames after its position.
+            /// Time of the output frame in the input, in seconds.
+            let t: Double = (Double(frame) * inputRate / outputRate + Double(RESAMPLER_TAPS / 2 - 1)) / inputRate
+            /// Ideal sample at the output frame.
+            let reference: Double = AMPLITUDE * sin(2 * Double.pi * frequency * t)
+            /// Resampled sample at the output frame.
+            let sample: Double = Double(output[2 * frame])
+            XCTAssertEqual(output[2 * frame], output[2 * frame + 1])
+            signalPower += sample * sample
+            referencePower += reference * reference
+            errorPower += (sample - reference) * (sample - reference)
+        }
+        return (10 * log10(signalPower / referencePower), 10 * log10(errorPower / referencePower))
+    }
+
+    /// Tests that sines across the passband keep their level and gain no distortion, both upsampling and downsampling.
+    func testPassbandIsFlatAndClean() {
+        /// Input and output sample rates to convert between.
+        let rates: [(Double, Double)] = [(44100, 48000), (48000, 44100), (96000, 44100), (22050, 48000)]
+        for (inputRate, outputRate) in rates {
+            for frequency in [100.0, 1000, 5000, 8000] {
+                /// Measurements of the resampled sine.
+                let measured: (gain: Double, thdPlusNoise: Double) = measureSine(inputRate: inputRate, outputRate: outputRate, frequency: frequency)
+                XCTAssertEqual(0, measured.gain, accuracy: 0.01, "\(inputRate) to \(outputRate) Hz at \(frequency) Hz")
+                XCTAssertLessThan(measured.thdPlusNoise, -80, "\(inputRate) to \(outputRate) Hz at \(frequency) Hz")
+            }
+        }
+    }
+
+    /// Tests that a sine above the output Nyquist frequency is filtered out rather than aliased when downsampling.
+    func testStopbandIsAttenuated() {
+        /// Measurements of a 30 kHz sine downsampled to 44.1 kHz, which would alias to 14.1 kHz.
+        let measured: (gain: Double, thdPlusNoise: Double) = measureSine(inputRate: 96000, outputRate: 44100, frequency: 30000)
+        XCTAssertLessThan(measured.gain, -70)
+    }
+}
@@ -102,15 +102,12 @@ class Migrations: XCTestCase {
             var audioData = player.audioData
             // Only use up to the loop end for the loudness calculation (loopEnd is exclusive). For reasons I don't understand, it appears that sometimes loopEnd and audioData.numSamples can get out of sync by the number of priming frames...so ensure that loopEnd <= audioData.numSamples.
             let numSamples = min(MusicPlayer.player.loopEnd, Int(audioData.numSamples))
-            // Never reduce the framerate by more than a factor of 4. For a standard 44.1 kHz signal, a factor of 4 reduction gives an effective framerate of 11.025 kHz, with a corresponding Nyquist frequency of 5.5125 kHz. Since the human ear is most sensitive to frequencies between 2 kHz and 5 kHz, reducing any further would seriously degrade the quality of the loudness calculation, which is designed to weight frequencies in a way that reflects human perception.
-            let framerateReductionLimit: Int = min(4, Int(round(settings.frameRateReductionLimit)))
-            let lengthLimit: Int = Int(settings.trackLengthLimit)
             var intrinsicLoudness: Double = 0
             // Wait for the track to be loaded fully. We need to do this here because we're trying to calculate the loudness right after loading the track, at programmatic speed. Normally by the time the user can open the UI to trigger this function call, the track will already have been loaded fully, and we wouldn't want to make the user wait like that anyway.
             while (!player.trackFullyLoaded) {
                 usleep(10000)
             }
-            if (calcIntegratedLoudnessFromBufferFormat(&audioData, numSamples, framerateReductionLimit, lengthLimit, &intrinsicLoudness) < 0) {
+            if (calcIntegratedLoudnessInParallel(&audioData, numSamples, &intrinsicLoudness) < 0) {
                 print("WARNING: Failed to calculate integrated loudness for track: \(track.title!)")
                 continue
             }
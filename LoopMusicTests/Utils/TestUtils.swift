@@ -1,2 +1,23 @@
+import AudioToolbox
+
 /// Delta to use for floating-point assertions.
 let EPSILON: Double = 0.000001
+
+/// Makes the description of packed, interleaved linear PCM audio, as the engine expects to load.
+/// - parameter sampleRate: Sample rate of the audio.
+/// - parameter numChannels: Number of interleaved channels.
+/// - parameter bitsPerChannel: Size of each sample. 32 for float samples, 16 or 24 for signed integer samples.
+/// - returns: The audio description.
+func makeAudioDesc(sampleRate: Double, numChannels: UInt32, bitsPerChannel: UInt32 = 32) -> AudioStreamBasicDescription {
+    /// Audio description to fill in.
+    var audioDesc: AudioStreamBasicDescription = AudioStreamBasicDescription()
+    audioDesc.mSampleRate = sampleRate
+    audioDesc.mFormatID = kAudioFormatLinearPCM
+    audioDesc.mFormatFlags = kLinearPCMFormatFlagIsPacked | (bitsPerChannel == 32 ? kAudioFormatFlagIsFloat : kLinearPCMFormatFlagIsSignedInteger)
+    audioDesc.mBitsPerChannel = bitsPerChannel
+    audioDesc.mChannelsPerFrame = numChannels
+    audioDesc.mFramesPerPacket = 1
+    audioDesc.mBytesPerFrame = bitsPerChannel / 8 * numChannels
+    audioDesc.mBytesPerPacket = audioDesc.mBytesPerFrame
+    return audioDesc
+}